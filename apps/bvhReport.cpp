@@ -0,0 +1,236 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <cstdlib>
+#include <GRay/rtweekend.hpp>
+#include <GRay/camera.hpp>
+#include <GRay/bvh.h>
+#include <GRay/bvhStats.hpp>
+#include <GRay/linearBvh.hpp>
+#include <GRay/wideBvh.hpp>
+#include <GRay/sphere.hpp>
+#include <GRay/sphereSet.hpp>
+#include <GRay/instanceBvh.hpp>
+#include "scenes.hpp"
+
+using namespace GRay;
+
+// Compares the BVH builders scene by scene: SAH cost of the resulting tree and
+// the traversal work needed for the primary rays of the scene's camera, followed
+// by build time and memory of every builder on a large generated scene and the
+// ray throughput of each acceleration structure over it.
+// The last section places one object many times through a two-level InstanceBvh.
+// Usage: GRayBvhReport [sphere count for the large scene]
+
+struct SceneEntry
+{
+    const char* name;
+    std::function<Math::HittableList(const Solids::BvhBuildOptions&)> build;
+    Math::Point3 lookFrom;
+    Math::Point3 lookAt;
+    double vfov;
+    double aspectRatio;
+};
+
+void reportBuilder(const char* builderName, const SceneEntry& scene, const Solids::BvhBuildOptions& options, int raysPerSide)
+{
+    //Same random stream for every builder, so each of them sees the same scene
+    Utils::threadRandom() = Utils::Random(0xffffffffu, 0);
+    Math::HittableList world = scene.build(options);
+
+    auto start = std::chrono::steady_clock::now();
+    Solids::BvhNode bvh(world, 0, 1, options);
+    double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    Solids::BvhStats stats = Solids::computeBvhStats(bvh, options);
+
+    Camera cam(scene.lookFrom, scene.lookAt, {0, 1, 0}, scene.vfov, scene.aspectRatio, 0.0, 10.0, 0.0, 1.0);
+    Solids::TraversalCounters counters;
+    for (int j = 0; j < raysPerSide; ++j)
+        for (int i = 0; i < raysPerSide; ++i)
+        {
+            Utils::Random rng(j * raysPerSide + i, 0);
+            Math::Ray ray = cam.getRay((i + 0.5) / raysPerSide, (j + 0.5) / raysPerSide, rng);
+            Math::hitRecord rec;
+            Solids::countedHit(bvh, ray, 0.001, Utils::infinity, rec, counters);
+            ++counters.rays;
+        }
+
+    std::cout << std::left << std::setw(18) << scene.name << std::setw(8) << builderName << std::right
+              << std::setw(10) << world.objects.size()
+              << std::setw(10) << stats.nodes
+              << std::setw(8) << stats.maxDepth
+              << std::setw(12) << std::fixed << std::setprecision(2) << stats.sahCost
+              << std::setw(12) << static_cast<double>(counters.nodesVisited) / counters.rays
+              << std::setw(12) << static_cast<double>(counters.primitivesTested) / counters.rays
+              << std::setw(12) << buildMs << '\n';
+}
+
+Math::HittableList sphereCloud(size_t count)
+{
+    Math::HittableList objects;
+    objects.objects.reserve(count);
+    auto material = make_shared<Materials::Lambertian>(Math::Color(0.5, 0.5, 0.5));
+    Utils::Random rng(0, 0, 0xc10d);
+    const double radius = 0.5 / std::cbrt(static_cast<double>(count));
+    for (size_t i = 0; i < count; ++i)
+        objects.add(make_shared<Solids::Sphere>(Math::random(-1, 1, rng), radius * (0.5 + rng.nextDouble()), material));
+    return objects;
+}
+
+template <typename Accelerator>
+void reportLargeBuild(const char* structureName, const char* builderName, const Math::HittableList& world, Solids::BvhBuildOptions options)
+{
+    Solids::BvhBuildStats stats;
+    options.stats = &stats;
+    {
+        Accelerator accelerator(world, 0, 1, options);
+        (void)accelerator;
+    }
+    std::cout << std::left << std::setw(12) << structureName << std::setw(14) << builderName << std::right
+              << std::setw(12) << stats.nodes
+              << std::setw(12) << stats.leaves
+              << std::setw(12) << std::fixed << std::setprecision(1) << stats.buildMilliseconds
+              << std::setw(12) << stats.peakMemoryBytes / (1024.0 * 1024.0) << '\n';
+}
+
+void reportTraversal(const char* structureName, const Math::Hittable& accelerator, size_t rayCount)
+{
+    //Random rays from inside the cloud, closest hit like the integrator asks for
+    Utils::Timer timer;
+    size_t hits = 0;
+    for (size_t i = 0; i < rayCount; ++i)
+    {
+        Utils::Random rng(static_cast<uint32_t>(i), 0, 0x7a11);
+        Math::Ray ray(Math::random(-1, 1, rng), Math::randomUnitVector(rng), 0.0);
+        Math::hitRecord rec;
+        if (accelerator.hit(ray, 0.001, Utils::infinity, rec))
+            ++hits;
+    }
+    double ms = timer.milliseconds();
+    std::cout << std::left << std::setw(12) << structureName << std::right
+              << std::setw(12) << std::fixed << std::setprecision(2) << rayCount / (ms * 1000.0)
+              << std::setw(12) << hits << '\n';
+}
+
+template <typename Accelerator>
+void reportTraversal(const char* structureName, const Math::HittableList& world, size_t rayCount)
+{
+    Accelerator accelerator(world, 0, 1, Solids::BvhBuildOptions(Solids::BvhSplitMethod::SAH));
+    reportTraversal(structureName, accelerator, rayCount);
+}
+
+// The spheres of a list as SphereSet input, rounded to float.
+std::vector<Solids::SphereSet::Particle> sphereParticles(const Math::HittableList& world)
+{
+    std::vector<Solids::SphereSet::Particle> particles;
+    particles.reserve(world.objects.size());
+    for (const shared_ptr<Math::Hittable>& object : world.objects)
+        if (const Solids::Sphere* sphere = dynamic_cast<const Solids::Sphere*>(object.get()))
+            particles.push_back(Solids::SphereSet::Particle{ { static_cast<float>(sphere->center.x()), static_cast<float>(sphere->center.y()),
+                static_cast<float>(sphere->center.z()) }, static_cast<float>(sphere->radius), sphere->material });
+    return particles;
+}
+
+int main(int argc, char * argv[])
+{
+    const int raysPerSide = 256;
+    const size_t largeCount = argc > 1 ? static_cast<size_t>(std::strtoull(argv[1], nullptr, 10)) : 1000000;
+    auto plain = [](Math::HittableList (*builder)())
+    {
+        return [builder](const Solids::BvhBuildOptions&) { return builder(); };
+    };
+
+    std::vector<SceneEntry> scenes = {
+        { "randomScene", plain(randomScene), Math::Point3(13, 2, 3), Math::Point3(0, 0, 0), 20.0, 3.0 / 2.0 },
+        { "twoSpheres", plain(twoSpheres), Math::Point3(13, 2, 3), Math::Point3(0, 0, 0), 20.0, 3.0 / 2.0 },
+        { "simpleLight", plain(simpleLight), Math::Point3(26, 3, 6), Math::Point3(0, 2, 0), 20.0, 3.0 / 2.0 },
+        { "cornelBox", plain(cornelBox), Math::Point3(278, 278, -800), Math::Point3(278, 278, 0), 40.0, 1.0 },
+        { "cornelBoxSmoke", plain(cornelBoxSmoke), Math::Point3(278, 278, -800), Math::Point3(278, 278, 0), 40.0, 1.0 },
+        { "finalScene02", finalScene02, Math::Point3(478, 278, -600), Math::Point3(278, 278, 0), 40.0, 1.0 },
+    };
+
+    std::cout << std::left << std::setw(18) << "scene" << std::setw(8) << "builder" << std::right
+              << std::setw(10) << "objects" << std::setw(10) << "nodes" << std::setw(8) << "depth"
+              << std::setw(12) << "SAH cost" << std::setw(12) << "nodes/ray" << std::setw(12) << "prims/ray"
+              << std::setw(12) << "build ms" << '\n';
+
+    for (const SceneEntry& scene : scenes)
+    {
+        reportBuilder("median", scene, Solids::BvhBuildOptions(Solids::BvhSplitMethod::Median), raysPerSide);
+        reportBuilder("SAH", scene, Solids::BvhBuildOptions(Solids::BvhSplitMethod::SAH), raysPerSide);
+        reportBuilder("Morton", scene, Solids::BvhBuildOptions(Solids::BvhSplitMethod::Morton), raysPerSide);
+    }
+
+    if (largeCount == 0)
+        return 0;
+
+    Math::HittableList cloud = sphereCloud(largeCount);
+    Solids::BvhBuildOptions serialSah(Solids::BvhSplitMethod::SAH);
+    serialSah.threadCount = 1;
+    Solids::BvhBuildOptions parallelSah(Solids::BvhSplitMethod::SAH);
+    Solids::BvhBuildOptions morton(Solids::BvhSplitMethod::Morton);
+    Solids::BvhBuildOptions median(Solids::BvhSplitMethod::Median);
+
+    std::cout << '\n' << largeCount << " spheres, " << Utils::ThreadPool::defaultThreadCount() << " hardware threads\n";
+    std::cout << std::left << std::setw(12) << "structure" << std::setw(14) << "builder" << std::right
+              << std::setw(12) << "nodes" << std::setw(12) << "leaves" << std::setw(12) << "build ms"
+              << std::setw(12) << "peak MiB" << '\n';
+    reportLargeBuild<Solids::BvhNode>("BvhNode", "median", cloud, median);
+    reportLargeBuild<Solids::BvhNode>("BvhNode", "SAH serial", cloud, serialSah);
+    reportLargeBuild<Solids::BvhNode>("BvhNode", "SAH", cloud, parallelSah);
+    reportLargeBuild<Solids::BvhNode>("BvhNode", "Morton", cloud, morton);
+    reportLargeBuild<Solids::LinearBvh>("LinearBvh", "SAH serial", cloud, serialSah);
+    reportLargeBuild<Solids::LinearBvh>("LinearBvh", "SAH", cloud, parallelSah);
+    reportLargeBuild<Solids::LinearBvh>("LinearBvh", "Morton", cloud, morton);
+
+    const size_t rayCount = 500000;
+    std::cout << '\n' << rayCount << " random rays, SAH trees\n";
+    std::cout << std::left << std::setw(12) << "structure" << std::right
+              << std::setw(12) << "Mrays/s" << std::setw(12) << "hits" << '\n';
+    reportTraversal<Solids::BvhNode>("BvhNode", cloud, rayCount);
+    reportTraversal<Solids::LinearBvh>("LinearBvh", cloud, rayCount);
+    reportTraversal<Solids::Bvh4>("Bvh4", cloud, rayCount);
+    reportTraversal<Solids::Bvh8>("Bvh8", cloud, rayCount);
+
+    //Same spheres as one SoA primitive instead of one heap object each
+    Solids::BvhBuildStats setStats;
+    Solids::BvhBuildOptions setOptions(Solids::BvhSplitMethod::SAH);
+    setOptions.stats = &setStats;
+    Solids::SphereSet sphereSet(sphereParticles(cloud), setOptions);
+    reportTraversal("SphereSet", sphereSet, rayCount);
+
+    Solids::Bvh8 perObject(cloud, 0, 1);
+    const size_t perSphere = sizeof(Solids::Sphere) + sizeof(shared_ptr<Math::Hittable>) + 2 * sizeof(void*); //object, list entry, control block
+    std::cout << "\nmemory per sphere: Bvh8 + Sphere objects " << std::setprecision(1)
+              << (perObject.memoryUsage() + largeCount * perSphere) / static_cast<double>(largeCount)
+              << " bytes, SphereSet " << sphereSet.memoryUsage() / static_cast<double>(largeCount)
+              << " bytes (built in " << setStats.buildMilliseconds << " ms)\n";
+
+    //One cluster of spheres placed over and over under random affine transforms
+    const size_t instanceCount = 100000;
+    auto cluster = make_shared<Solids::SphereSet>(sphereParticles(sphereCloud(10000)));
+    Math::HittableList copies;
+    copies.objects.reserve(instanceCount);
+    Utils::Random rng(0, 0, 0x1257);
+    for (size_t i = 0; i < instanceCount; ++i)
+    {
+        const double scale = 0.02 + 0.03 * rng.nextDouble();
+        const Math::Vec3 stretch(scale, scale * (0.5 + rng.nextDouble()), scale);
+        copies.add(make_shared<Math::Instance>(cluster, Math::Transform::translation(Math::random(-1, 1, rng))
+            * Math::Transform::rotation(Math::randomUnitVector(rng), 360 * rng.nextDouble()) * Math::Transform::scaling(stretch)));
+    }
+    Solids::BvhBuildStats instanceStats;
+    Solids::BvhBuildOptions instanceOptions(Solids::BvhSplitMethod::SAH);
+    instanceOptions.stats = &instanceStats;
+    Solids::InstanceBvh instanced(copies, 0, 1, instanceOptions);
+    std::cout << '\n' << instanceCount << " instances of " << cluster->size() << " spheres, built in " << instanceStats.buildMilliseconds << " ms\n";
+    reportTraversal("InstanceBvh", instanced, rayCount);
+    reportTraversal<Solids::Bvh8>("Bvh8", copies, rayCount); //over the Instance wrappers themselves
+    std::cout << "memory: " << cluster->memoryUsage() / (1024.0 * 1024.0) << " MiB shared cluster + "
+              << instanced.memoryUsage() / (1024.0 * 1024.0) << " MiB top level (" << instanced.memoryUsage() / static_cast<double>(instanceCount)
+              << " bytes per instance), against " << instanceCount * cluster->memoryUsage() / (1024.0 * 1024.0) << " MiB for separate copies\n";
+
+    return 0;
+}
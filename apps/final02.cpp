@@ -4,123 +4,23 @@
 #include <GRay/sphere.hpp>
 #include <GRay/hittableList.hpp>
 #include <GRay/camera.hpp>
+#include <GRay/renderer.hpp>
+#include <GRay/imageWriter.hpp>
 #include <GRay/bvh.h>
+#include <GRay/linearBvh.hpp>
 #include <GRay/background.hpp>
+#include <GRay/integrator.hpp>
+#include "scenes.hpp"
 
 using namespace GRay;
 
-Math::Color rayColor(const Math::Ray& ray, const Solids::Background& background, const Solids::BvhNode& world, int depth)
-{
-    if (depth <= 0)
-        return {0, 0, 0};
-
-    Math::hitRecord rec;
-    if (!world.hit(ray, 0.001, Utils::infinity, rec))
-        return background.getValue(ray);
-    
-    Math::Ray scattered;
-    Math::Color attenuation;
-    Math::Color emited = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-
-    if (!rec.mat_ptr->scatter(ray, rec, attenuation, scattered))
-        return emited;
-
-    return emited + attenuation * rayColor(scattered, background, world, depth - 1);
-}
-
-Math::HittableList twoSpheres()
-{
-    Math::HittableList objects;
-    auto checker = make_shared<Materials::CheckerTexture>(Math::Color(0.2, 0.3, 0.1), Math::Color(0.9, 0.9, 0.9));
-
-    objects.add(make_shared<Solids::Sphere>(Math::Point3(0, -10, 0), 10, make_shared<Materials::Lambertian>(checker)));
-    objects.add(make_shared<Solids::Sphere>(Math::Point3(0, 10, 0), 10, make_shared<Materials::Lambertian>(checker)));
-
-    return objects;
-}
-
-Math::HittableList twoPerlinSpheres()
-{
-    Math::HittableList objects;
-    auto pertext = make_shared<Materials::NoiseTexture>(4);
-
-    objects.add(make_shared<Solids::Sphere>(Math::Point3(0, -1000, 0), 1000, make_shared<Materials::Lambertian>(pertext)));
-    objects.add(make_shared<Solids::Sphere>(Math::Point3(0, 2, 0), 2, make_shared<Materials::Lambertian>(pertext)));
-
-    return objects;
-}
-
-Math::HittableList twoSpheresEarth()
-{
-    Math::HittableList objects;
-    auto checker = make_shared<Materials::CheckerTexture>(Math::Color(0.2, 0.3, 0.1), Math::Color(0.9, 0.9, 0.9));
-    auto earthTexture = make_shared<Materials::ImageTexture>("data/earthmap.jpg");
-
-    objects.add(make_shared<Solids::Sphere>(Math::Point3(0, -1000, 0), 1000, make_shared<Materials::Lambertian>(checker)));
-    objects.add(make_shared<Solids::Sphere>(Math::Point3(0, 1, 0), 1, make_shared<Materials::Lambertian>(earthTexture)));
-
-    return objects;
-}
-
-Math::HittableList randomScene()
-{
-    HittableList world;
-    auto checker = make_shared<Materials::CheckerTexture>(Math::Color(0.2, 0.3, 0.1), Math::Color(0.9, 0.9, 0.9));
-    auto groundMaterial = make_shared<Materials::Lambertian>(checker);
-    world.add(make_shared<Solids::Sphere>(Math::Point3(0, -1000, 0), 1000, groundMaterial));
-    for (int a = -11; a < 11; ++a)
-    {
-        for (int b = -11; b < 11; ++b)
-        {
-            auto chooseMat = Utils::randomDouble();
-            Math::Point3 center(a + 0.9 * Utils::randomDouble(), 0.2, b + 0.9 * Utils::randomDouble());
-            if ((center - Math::Point3(4, 0.2, 0)).length() > 0.9)
-            {
-                shared_ptr<Material> sphereMaterial;
-                if(chooseMat < 0.8)
-                {
-                    //diffuse
-                    auto albedo = Math::random() * Math::random();
-                    sphereMaterial = make_shared<Materials::Lambertian>(albedo);
-                    world.add(make_shared<Solids::Sphere>(center, 0.2, sphereMaterial));
-                }
-                else if (chooseMat < 0.95)
-                {
-                    //metal
-                    auto albedo = Math::random(0.5, 1);
-                    auto fuzz = Utils::randomDouble(0, 0.5);
-                    sphereMaterial = make_shared<Materials::Metal>(albedo, fuzz);
-                    world.add(make_shared<Solids::Sphere>(center, 0.2, sphereMaterial));
-                }
-                else
-                {
-                    //glass
-                    sphereMaterial = make_shared<Materials::Dialectric>(1.5);
-                    world.add(make_shared<Solids::Sphere>(center, 0.2, sphereMaterial));
-                }
-            }
-        }
-    }
-
-    auto material1 = make_shared<Materials::Dialectric>(1.5);
-    world.add(make_shared<Solids::Sphere>(Math::Point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<Materials::Lambertian>(Math::Color(0.4, 0.2, 0.1));
-    world.add(make_shared<Solids::Sphere>(Math::Point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = make_shared<Materials::Metal>(Math::Color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<Solids::Sphere>(Math::Point3(4, 1, 0), 1.0, material3));
-
-    return world;
-}
-
 int main(int argc, char * argv[])
 {
     //Image
     const double aspectRatio = 3.0 / 2.0;
     const int imageWidth = 512;
     const int imageHeight = static_cast<int>(imageWidth / aspectRatio);
-    const int samplesPerPixel = 1000;
+    const int samplesPerPixel = 100;
     const int maxDepth = 50;
 
     //World
@@ -131,8 +31,15 @@ int main(int argc, char * argv[])
     double distToFocus = 10;
     double vfov = 40.0;
     double aperture = 0.0;
-    Solids::Background background(make_shared<Materials::ImageTextureHDRI>(argv[1]), 2);
-    //std::static_pointer_cast<Materials::ImageTextureHDRI>(std::static_pointer_cast<Materials::DiffuseLight>(background.mat_ptr)->emit)->subSampling = true;
+    //Texture cache directory: fifth argument, none (default) keeps textures decoded in memory
+    if (argc > 5)
+        Materials::TextureCache::setDirectory(argv[5]);
+    //Texture memory budget in MiB for textures read from the cache: fourth argument, 0 (default) maps whole cache files
+    if (argc > 4)
+        Materials::TileCache::global().setBudget(static_cast<size_t>(atol(argv[4])) << 20);
+    //Most paths escape to the HDRI: the cube map saves the inverse trigonometry of every lookup
+    Solids::Background background(Materials::AssetRegistry::global().imageTextureHDRI(argv[1]), 2, Solids::BackgroundProjection::CubeMap);
+    //Box-filtered HDRI lookups: request the texture with HdriOptions::subSampling set
     std::cerr << 13-(1.5-atoi(argv[2])/200.0) << std::endl;
     switch(1)
     {
@@ -171,27 +78,33 @@ int main(int argc, char * argv[])
             break;
     }
 
-    GRay::Solids::BvhNode bvhTree(world, 0, 0);
+    GRay::Solids::LinearBvh bvhTree(world, 0, 0);
     Camera cam(lookFrom, lookAt, {0, 1, 0}, vfov, aspectRatio, aperture, distToFocus);
-    //Render
-    std::cout << "P3\n" << imageWidth << ' ' << imageHeight << "\n255\n";
-
-    for (int j = imageHeight - 1; j >= 0; --j)
+    //Render; the writer's thread starts now and takes over the image once it is done
+    Rendering::AsyncImageWriter writer;
+    Rendering::RenderSettings settings(imageWidth, imageHeight, samplesPerPixel);
+    settings.reportProgress = false;
+    Rendering::TileRenderer renderer(settings);
+    Rendering::PathStatistics pathStats;
+    Rendering::IntegratorSettings integratorSettings;
+    integratorSettings.maxDepth = maxDepth;
+    integratorSettings.stats = &pathStats;
+    Solids::LightList lights(world);
+    Rendering::PathIntegrator integrator(bvhTree/*world*/, world.materialRegistry(), background, lights, integratorSettings);
+    Rendering::Framebuffer image = renderer.render(cam, integrator.function());
+    std::cerr << "\nAverage path length: " << pathStats.averageLength() << " rays, "
+        << static_cast<double>(pathStats.shadowRays) / pathStats.paths << " shadow rays\n";
+    if (Materials::TileCache::global().budget() > 0)
     {
-        //std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-        for (int i = 0; i < imageWidth; i++)
-        {
-            Math::Color pixelColor(0, 0, 0);
-            for (int s = 0; s < samplesPerPixel; ++s)
-            {
-                double u = (i + Utils::randomDouble()) / (imageWidth - 1);
-                double v = (j + Utils::randomDouble()) / (imageHeight - 1);
-                Math::Ray ray = cam.getRay(u, v);
-                pixelColor += rayColor(ray, background, bvhTree/*world*/, maxDepth);
-            }
-            Colors::writeColor(std::cout, pixelColor, samplesPerPixel);
-        }
+        Materials::TileCache::Statistics tiles = Materials::TileCache::global().statistics();
+        std::cerr << "Texture tiles: " << tiles.hits << " hits, " << tiles.misses << " misses, " << tiles.evictions << " evictions, "
+            << (tiles.peakBytes >> 20) << " MiB peak\n";
     }
+    //Output format: third argument (p3, ppm, pfm, png), ASCII PPM (P3) by default
+    writer.submit(std::move(image), samplesPerPixel, Rendering::imageFormatFromName(argc > 3 ? argv[3] : "p3"), std::cout);
+    writer.wait();
+    if (writer.failedWrites() > 0)
+        return 1;
 
     std::cerr << argv[2] <<" Done.\n";
 
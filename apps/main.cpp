@@ -4,8 +4,10 @@
 #include <GRay/sphere.hpp>
 #include <GRay/hittableList.hpp>
 #include <GRay/camera.hpp>
+#include <GRay/renderer.hpp>
+#include <GRay/imageWriter.hpp>
 
-GRay::Math::Color rayColor(const GRay::Math::Ray& ray, const GRay::Math::Hittable& world, int depth)
+GRay::Math::Color rayColor(const GRay::Math::Ray& ray, const GRay::Math::HittableList& world, int depth, GRay::Utils::Random& rng)
 {
     if (depth <= 0)
         return {0, 0, 0};
@@ -15,8 +17,9 @@ GRay::Math::Color rayColor(const GRay::Math::Ray& ray, const GRay::Math::Hittabl
     {
         GRay::Math::Ray scattered;
         GRay::Math::Color attenuation;
-        if (rec.mat_ptr->scatter(ray, rec, attenuation, scattered))
-            return attenuation * rayColor(scattered, world, depth - 1);
+        rng.setBounce(rng.bounceIndex() + 1);
+        if (rec.materialPtr(world.materialRegistry())->scatter(ray, rec, attenuation, scattered, rng))
+            return attenuation * rayColor(scattered, world, depth - 1, rng);
         return {0, 0, 0};
     }
 
@@ -36,6 +39,8 @@ int main(int argc, char * argv[])
 
     //World
     GRay::Math::HittableList world;
+    world.materials = make_shared<GRay::MaterialRegistry>();
+    GRay::MaterialRegistry::Scope materials(*world.materials);
     auto materialGround = make_shared<GRay::Materials::Lambertian>(GRay::Math::Color(0.8, 0.8, 0.0));
     auto materialCenter = make_shared<GRay::Materials::Lambertian>(GRay::Math::Color(0.1, 0.2, 0.5));
     auto materialLeft = make_shared<GRay::Materials::Dialectric>(1.5);
@@ -51,25 +56,18 @@ int main(int argc, char * argv[])
     GRay::Math::Point3 lookAt(0, 0, -1);
     double distToFocus = (lookAt - lookFrom).length();
     GRay::Camera cam(lookFrom, lookAt, {0, 1, 0}, 20, aspectRatio, 2.0, distToFocus);
-    //Render
-    std::cout << "P3\n" << imageWidth << ' ' << imageHeight << "\n255\n";
-
-    for (int j = imageHeight - 1; j >= 0; --j)
+    //Render; the writer's thread starts now and takes over the image once it is done
+    GRay::Rendering::AsyncImageWriter writer;
+    GRay::Rendering::TileRenderer renderer(GRay::Rendering::RenderSettings(imageWidth, imageHeight, samplesPerPixel));
+    GRay::Rendering::Framebuffer image = renderer.render(cam, [&](const GRay::Math::Ray& ray, GRay::Utils::Random& rng)
     {
-        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-        for (int i = 0; i < imageWidth; i++)
-        {
-            GRay::Math::Color pixelColor(0, 0, 0);
-            for (int s = 0; s < samplesPerPixel; ++s)
-            {
-                double u = (i + GRay::Utils::randomDouble()) / (imageWidth - 1);
-                double v = (j + GRay::Utils::randomDouble()) / (imageHeight - 1);
-                GRay::Math::Ray ray = cam.getRay(u, v);
-                pixelColor += rayColor(ray, world, maxDepth);
-            }
-            GRay::Colors::writeColor(std::cout, pixelColor, samplesPerPixel);
-        }
-    }
+        return rayColor(ray, world, maxDepth, rng);
+    });
+    //Output format: first argument (p3, ppm, pfm, png), ASCII PPM (P3) by default
+    writer.submit(std::move(image), samplesPerPixel, GRay::Rendering::imageFormatFromName(argc > 1 ? argv[1] : "p3"), std::cout);
+    writer.wait();
+    if (writer.failedWrites() > 0)
+        return 1;
 
     std::cerr << "\nDone.\n";
 
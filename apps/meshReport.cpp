@@ -0,0 +1,143 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <GRay/rtweekend.hpp>
+#include <GRay/profiling.hpp>
+#include <GRay/triangleMesh.hpp>
+#include <GRay/meshLoader.hpp>
+
+using namespace GRay;
+
+// Loads a PLY or OBJ mesh serially and on all hardware threads, builds its TriangleMesh and
+// traces random rays from the centre of its bounds. Every ray has to hit a closed mesh, so
+// the hit count also shows whether rays slip through shared edges. With --generate it writes
+// a closed sphere of about the given number of triangles to test with.
+// Usage: GRayMeshReport mesh.(ply|obj)
+//        GRayMeshReport --generate triangles out.(ply|obj)
+
+// Latitude-longitude sphere with shared vertices at the seam and the poles, so it is closed.
+bool writeSphere(const std::string& path, size_t triangles)
+{
+    const size_t slices = std::max<size_t>(3, static_cast<size_t>(std::sqrt(triangles / 2.0)));
+    const size_t stacks = std::max<size_t>(2, triangles / (2 * slices) + 1);
+    const size_t vertexCount = 2 + (stacks - 1) * slices;
+    const size_t faceCount = 2 * slices * (stacks - 1);
+    const bool ply = path.size() > 4 && path.compare(path.size() - 4, 4, ".ply") == 0;
+
+    FILE* out = std::fopen(path.c_str(), ply ? "wb" : "w");
+    if (!out)
+        return false;
+    if (ply)
+        std::fprintf(out, "ply\nformat binary_little_endian 1.0\ncomment GRayMeshReport sphere\nelement vertex %zu\n"
+            "property float x\nproperty float y\nproperty float z\nproperty float nx\nproperty float ny\nproperty float nz\n"
+            "element face %zu\nproperty list uchar int vertex_indices\nend_header\n", vertexCount, faceCount);
+
+    auto vertex = [&](double theta, double phi)
+    {
+        const float p[3] = { static_cast<float>(sin(theta) * cos(phi)), static_cast<float>(cos(theta)), static_cast<float>(sin(theta) * sin(phi)) };
+        if (ply)
+        {
+            std::fwrite(p, sizeof(float), 3, out);
+            std::fwrite(p, sizeof(float), 3, out);
+        }
+        else
+            std::fprintf(out, "v %.7g %.7g %.7g\nvn %.7g %.7g %.7g\n", p[0], p[1], p[2], p[0], p[1], p[2]);
+    };
+    vertex(0, 0);
+    for (size_t i = 1; i < stacks; ++i)
+        for (size_t j = 0; j < slices; ++j)
+            vertex(Math::pi * i / stacks, 2 * Math::pi * j / slices);
+    vertex(Math::pi, 0);
+
+    //Counter-clockwise seen from outside
+    auto face = [&](size_t a, size_t b, size_t c)
+    {
+        if (ply)
+        {
+            const unsigned char corners = 3;
+            const int32_t index[3] = { static_cast<int32_t>(a), static_cast<int32_t>(b), static_cast<int32_t>(c) };
+            std::fwrite(&corners, 1, 1, out);
+            std::fwrite(index, sizeof(int32_t), 3, out);
+        }
+        else
+            std::fprintf(out, "f %zu//%zu %zu//%zu %zu//%zu\n", a + 1, a + 1, b + 1, b + 1, c + 1, c + 1);
+    };
+    auto ring = [&](size_t i, size_t j) { return 1 + (i - 1) * slices + j % slices; };
+    for (size_t j = 0; j < slices; ++j)
+    {
+        face(0, ring(1, j + 1), ring(1, j));
+        for (size_t i = 1; i + 1 < stacks; ++i)
+        {
+            face(ring(i, j), ring(i, j + 1), ring(i + 1, j));
+            face(ring(i, j + 1), ring(i + 1, j + 1), ring(i + 1, j));
+        }
+        face(vertexCount - 1, ring(stacks - 1, j), ring(stacks - 1, j + 1));
+    }
+    return std::fclose(out) == 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 4 && std::strcmp(argv[1], "--generate") == 0)
+    {
+        const size_t triangles = static_cast<size_t>(std::strtoull(argv[2], nullptr, 10));
+        Utils::Timer timer;
+        if (!writeSphere(argv[3], triangles))
+        {
+            std::cerr << "ERROR: Could not write '" << argv[3] << "'.\n";
+            return 1;
+        }
+        std::cout << "wrote " << argv[3] << " in " << std::fixed << std::setprecision(1) << timer.milliseconds() << " ms\n";
+        return 0;
+    }
+    if (argc != 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " mesh.(ply|obj)\n       " << argv[0] << " --generate triangles out.(ply|obj)\n";
+        return 1;
+    }
+
+    Solids::MeshData data;
+    std::cout << std::left << std::setw(22) << "load" << std::right << std::setw(12) << "ms" << '\n';
+    const size_t hardwareThreads = Utils::ThreadPool::defaultThreadCount();
+    const size_t threadCounts[2] = { 1, hardwareThreads };
+    for (size_t threads : threadCounts)
+    {
+        Utils::Timer timer;
+        if (!Solids::loadMesh(argv[1], data, threads))
+            return 1;
+        std::cout << std::left << std::setw(22) << std::to_string(threads) + (threads == 1 ? " thread" : " threads")
+                  << std::right << std::setw(12) << std::fixed << std::setprecision(1) << timer.milliseconds() << '\n';
+    }
+    std::cout << data.triangleCount() << " triangles, " << data.vertexCount() << " vertices"
+              << (data.normals.empty() ? "" : ", normals") << (data.uvs.empty() ? "" : ", uvs")
+              << ", " << data.memoryUsage() / (1024.0 * 1024.0) << " MiB of mesh data\n";
+
+    Solids::BvhBuildStats stats;
+    Solids::BvhBuildOptions options = Solids::TriangleMesh::defaultBuildOptions();
+    options.stats = &stats;
+    Solids::TriangleMesh mesh(std::move(data), invalidMaterial, options);
+    std::cout << "BVH: " << mesh.nodeCount() << " nodes, built in " << stats.buildMilliseconds << " ms, peak "
+              << stats.peakMemoryBytes / (1024.0 * 1024.0) << " MiB, " << mesh.memoryUsage() / static_cast<double>(mesh.size())
+              << " bytes per triangle in total\n";
+
+    Solids::AABB bounds;
+    mesh.boundingBox(0, 1, bounds);
+    const Math::Point3 centre = 0.5 * (bounds.min() + bounds.max());
+    const size_t rayCount = 1000000;
+    size_t hits = 0;
+    Utils::Timer timer;
+    for (size_t i = 0; i < rayCount; ++i)
+    {
+        Utils::Random rng(static_cast<uint32_t>(i), 0, 0x3e54);
+        Math::hitRecord rec;
+        if (mesh.hit(Math::Ray(centre, Math::randomUnitVector(rng), 0.0), 0.0, Utils::infinity, rec))
+            ++hits;
+    }
+    const double ms = timer.milliseconds();
+    std::cout << rayCount << " rays from the centre: " << std::setprecision(2) << rayCount / (ms * 1000.0)
+              << " Mrays/s, " << hits << " hits\n";
+    return 0;
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/sphere.hpp>
+#include <GRay/sphereSet.hpp>
+#include <GRay/movingSphere.hpp>
+#include <GRay/hittableList.hpp>
+#include <GRay/bvh.h>
+#include <GRay/aarect.hpp>
+#include <GRay/box.hpp>
+#include <GRay/constantMedium.hpp>
+#include <GRay/instance.hpp>
+#include <GRay/assetRegistry.hpp>
+
+// Scene builders shared by the apps. Each scene owns the registry of its materials.
+
+using namespace GRay;
+
+Math::HittableList twoSpheres()
+{
+    Math::HittableList objects;
+    objects.materials = make_shared<MaterialRegistry>();
+    MaterialRegistry::Scope materials(*objects.materials);
+    auto checker = make_shared<Materials::CheckerTexture>(Math::Color(0.2, 0.3, 0.1), Math::Color(0.9, 0.9, 0.9));
+
+    objects.add(make_shared<Solids::Sphere>(Math::Point3(0, -10, 0), 10, Materials::AssetRegistry::global().lambertian(checker)));
+    objects.add(make_shared<Solids::Sphere>(Math::Point3(0, 10, 0), 10, Materials::AssetRegistry::global().lambertian(checker)));
+
+    return objects;
+}
+
+Math::HittableList twoPerlinSpheres()
+{
+    Math::HittableList objects;
+    objects.materials = make_shared<MaterialRegistry>();
+    MaterialRegistry::Scope materials(*objects.materials);
+    auto pertext = Materials::AssetRegistry::global().noiseTexture(4);
+
+    objects.add(make_shared<Solids::Sphere>(Math::Point3(0, -1000, 0), 1000, Materials::AssetRegistry::global().lambertian(pertext)));
+    objects.add(make_shared<Solids::Sphere>(Math::Point3(0, 2, 0), 2, Materials::AssetRegistry::global().lambertian(pertext)));
+
+    return objects;
+}
+
+Math::HittableList twoSpheresEarth()
+{
+    Math::HittableList objects;
+    objects.materials = make_shared<MaterialRegistry>();
+    MaterialRegistry::Scope materials(*objects.materials);
+    auto checker = make_shared<Materials::CheckerTexture>(Math::Color(0.2, 0.3, 0.1), Math::Color(0.9, 0.9, 0.9));
+    auto earthTexture = Materials::AssetRegistry::global().imageTexture("data/earthmap.jpg");
+
+    objects.add(make_shared<Solids::Sphere>(Math::Point3(0, -1000, 0), 1000, Materials::AssetRegistry::global().lambertian(checker)));
+    objects.add(make_shared<Solids::Sphere>(Math::Point3(0, 1, 0), 1, Materials::AssetRegistry::global().lambertian(earthTexture)));
+
+    return objects;
+}
+
+Math::HittableList simpleLight()
+{
+    Math::HittableList objects;
+    objects.materials = make_shared<MaterialRegistry>();
+    MaterialRegistry::Scope materials(*objects.materials);
+    auto pertext = Materials::AssetRegistry::global().noiseTexture(4);
+
+    objects.add(make_shared<Solids::Sphere>(Math::Point3(0, -1000, 0), 1000, Materials::AssetRegistry::global().lambertian(pertext)));
+    objects.add(make_shared<Solids::Sphere>(Math::Point3(0, 2, 0), 2, Materials::AssetRegistry::global().lambertian(pertext)));
+
+    auto diffLight = make_shared<Materials::DiffuseLight>(Math::Color(4, 4, 4), 2);
+    objects.add(make_shared<Solids::XYRect>(3, 5, 1, 3, -2, diffLight));
+    objects.add(make_shared<Solids::Sphere>(Math::Point3(0, 6, 0), 1, diffLight));
+
+    return objects;
+}
+
+Math::HittableList cornelBox()
+{
+    Math::HittableList objects;
+    objects.materials = make_shared<MaterialRegistry>();
+    MaterialRegistry::Scope materials(*objects.materials);
+    auto red = make_shared<Materials::Lambertian>(Math::Color(0.6, 0.05, 0.05));
+    auto white = make_shared<Materials::Lambertian>(Math::Color(0.73, 0.73, 0.73));
+    auto green = make_shared<Materials::Lambertian>(Math::Color(0.12, 0.45, 0.15));
+    auto light = make_shared<Materials::DiffuseLight>(Math::Color(15, 15, 15));
+
+    objects.add(make_shared<Solids::YZRect>(0, 555, 0, 555, 555, green));
+    objects.add(make_shared<Solids::YZRect>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<Solids::XZRect>(213, 343, 227, 332, 554, light));
+    objects.add(make_shared<Solids::XZRect>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<Solids::XZRect>(0, 555, 0, 555, 555, white));
+    objects.add(make_shared<Solids::XYRect>(0, 555, 0, 555, 555, white));
+
+    shared_ptr<Math::Hittable> box1 = make_shared<Solids::Box>(Math::Point3(0, 0, 0), Math::Point3(165, 330, 165), white);
+    shared_ptr<Math::Hittable> box2 = make_shared<Solids::Box>(Math::Point3(0, 0, 0), Math::Point3(165, 165, 165), white);
+    box1 = make_shared<Math::Instance>(box1, Math::Transform::translation(Math::Vec3(265, 0, 295)) * Math::Transform::rotation(Math::Vec3(0, 1, 0), 15));
+    objects.add(box1);
+    box2 = make_shared<Math::Instance>(box2, Math::Transform::translation(Math::Vec3(130, 0, 65)) * Math::Transform::rotation(Math::Vec3(0, 1, 0), -18));
+    objects.add(box2);
+
+    return objects;
+}
+
+Math::HittableList cornelBoxSmoke()
+{
+    Math::HittableList objects;
+    objects.materials = make_shared<MaterialRegistry>();
+    MaterialRegistry::Scope materials(*objects.materials);
+    auto red = make_shared<Materials::Lambertian>(Math::Color(0.65, 0.05, 0.05));
+    auto white = make_shared<Materials::Lambertian>(Math::Color(0.73, 0.73, 0.73));
+    auto green = make_shared<Materials::Lambertian>(Math::Color(0.12, 0.45, 0.15));
+    auto light = make_shared<Materials::DiffuseLight>(Math::Color(7, 7, 7));
+
+    objects.add(make_shared<Solids::YZRect>(0, 555, 0, 555, 555, green));
+    objects.add(make_shared<Solids::YZRect>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<Solids::XZRect>(113, 443, 127, 432, 554, light));
+    objects.add(make_shared<Solids::XZRect>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<Solids::XZRect>(0, 555, 0, 555, 555, white));
+    objects.add(make_shared<Solids::XYRect>(0, 555, 0, 555, 555, white));
+
+    shared_ptr<Math::Hittable> box1 = make_shared<Solids::Box>(Math::Point3(0, 0, 0), Math::Point3(165, 330, 165), white);
+    shared_ptr<Math::Hittable> box2 = make_shared<Solids::Box>(Math::Point3(0, 0, 0), Math::Point3(165, 165, 165), white);
+    box1 = make_shared<Math::Instance>(box1, Math::Transform::translation(Math::Vec3(265, 0, 295)) * Math::Transform::rotation(Math::Vec3(0, 1, 0), 15));
+    box2 = make_shared<Math::Instance>(box2, Math::Transform::translation(Math::Vec3(130, 0, 65)) * Math::Transform::rotation(Math::Vec3(0, 1, 0), -18));
+
+    objects.add(make_shared<Solids::ConstantMedium>(box1, 0.01, Math::Color(0, 0, 0)));
+    objects.add(make_shared<Solids::ConstantMedium>(box2, 0.01, Math::Color(1, 1, 1)));
+
+    return objects;
+}
+
+Math::HittableList randomScene()
+{
+    Math::HittableList world;
+    world.materials = make_shared<MaterialRegistry>();
+    MaterialRegistry::Scope materials(*world.materials);
+    auto checker = make_shared<Materials::CheckerTexture>(Math::Color(0.2, 0.3, 0.1), Math::Color(0.9, 0.9, 0.9));
+    auto groundMaterial = make_shared<Materials::Lambertian>(checker);
+    world.add(make_shared<Solids::Sphere>(Math::Point3(0, -1000, 0), 1000, groundMaterial));
+    //The small spheres share one SphereSet
+    std::vector<Solids::SphereSet::Particle> small;
+    auto addSmall = [&small](const Math::Point3& center, double radius, shared_ptr<Material> material)
+    {
+        small.push_back(Solids::SphereSet::Particle{ { static_cast<float>(center.x()), static_cast<float>(center.y()), static_cast<float>(center.z()) },
+            static_cast<float>(radius), MaterialRegistry::current().add(material) });
+    };
+    for (int a = -11; a < 11; ++a)
+    {
+        for (int b = -11; b < 11; ++b)
+        {
+            auto chooseMat = Utils::randomDouble();
+            Math::Point3 center(a + 0.9 * Utils::randomDouble(), 0.2, b + 0.9 * Utils::randomDouble());
+            if ((center - Math::Point3(4, 0.2, 0)).length() > 0.9)
+            {
+                shared_ptr<Material> sphereMaterial;
+                if(chooseMat < 0.8)
+                {
+                    //diffuse
+                    auto albedo = Math::random() * Math::random();
+                    sphereMaterial = make_shared<Materials::Lambertian>(albedo);
+                    addSmall(center, 0.2, sphereMaterial);
+                }
+                else if (chooseMat < 0.95)
+                {
+                    //metal
+                    auto albedo = Math::random(0.5, 1);
+                    auto fuzz = Utils::randomDouble(0, 0.5);
+                    sphereMaterial = make_shared<Materials::Metal>(albedo, fuzz);
+                    addSmall(center, 0.2, sphereMaterial);
+                }
+                else
+                {
+                    //glass
+                    sphereMaterial = make_shared<Materials::Dialectric>(1.5);
+                    addSmall(center, 0.2, sphereMaterial);
+                }
+            }
+        }
+    }
+
+    world.add(make_shared<Solids::SphereSet>(small));
+
+    auto material1 = make_shared<Materials::Dialectric>(1.5);
+    world.add(make_shared<Solids::Sphere>(Math::Point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = make_shared<Materials::Lambertian>(Math::Color(0.4, 0.2, 0.1));
+    world.add(make_shared<Solids::Sphere>(Math::Point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = make_shared<Materials::Metal>(Math::Color(0.7, 0.6, 0.5), 0.0);
+    world.add(make_shared<Solids::Sphere>(Math::Point3(4, 1, 0), 1.0, material3));
+
+    return world;
+}
+
+Math::HittableList finalScene02(const Solids::BvhBuildOptions& bvhOptions = Solids::BvhBuildOptions())
+{
+    Math::HittableList objects;
+    objects.materials = make_shared<MaterialRegistry>();
+    MaterialRegistry::Scope materials(*objects.materials);
+    Math::HittableList boxes1;
+    auto ground = make_shared<Materials::Lambertian>(Math::Color(0.48, 0.83, 0.53));
+
+    const int boxesPerSide = 20;
+    for (int i = 0; i < boxesPerSide; ++i)
+        for (int j = 0; j < boxesPerSide; ++j)
+        {
+            auto w = 100.0;
+            auto x0 = -1000.0 + i*w;
+            auto z0 = -1000.0 + j*w;
+            auto y0 = 0.0;
+            auto x1 = x0 + w;
+            auto z1 = z0 + w;
+            auto y1 = Math::randomDouble(1,101);
+            boxes1.add(make_shared<Solids::Box>(Math::Point3(x0, y0, z0), Math::Point3(x1, y1, z1), ground));
+        }
+
+    objects.add(make_shared<Solids::BvhNode>(boxes1, 0, 1, bvhOptions));
+
+    auto light = make_shared<Materials::DiffuseLight>(Math::Color(7, 7, 7));
+    objects.add(make_shared<Solids::XZRect>(123, 423, 147, 412, 554, light));
+
+    auto center1 = Math::Point3(400, 400, 200);
+    auto center2 = center1 + Math::Vec3(30, 0, 0);
+    auto movingSphereMaterial = make_shared<Materials::Lambertian>(Math::Color(0.7, 0.3, 0.1));
+    objects.add(make_shared<Solids::MovingSphere>(center1, center2, 0, 1, 50, movingSphereMaterial));
+
+    objects.add(make_shared<Solids::Sphere>(Math::Point3(260, 150, 45), 50, make_shared<Materials::Dialectric>(1.5)));
+    objects.add(make_shared<Solids::Sphere>(Math::Point3(0, 150, 145), 50, make_shared<Materials::Metal>(Math::Color(0.8, 0.8, 0.9), 0.4)));
+
+    auto boundary = make_shared<Solids::Sphere>(Math::Point3(360, 150, 145), 70, make_shared<Materials::Dialectric>(1.5));
+    objects.add(boundary);
+    objects.add(make_shared<Solids::ConstantMedium>(boundary, 0.2, Math::Color(0.2, 0.4, 0.9)));
+    boundary = make_shared<Solids::Sphere>(Math::Point3(0, 0, 0), 5000, make_shared<Materials::Dialectric>(1.5));
+    objects.add(make_shared<Solids::ConstantMedium>(boundary, 0.0001, Math::Color(1, 1, 1)));
+
+    auto emat = Materials::AssetRegistry::global().lambertian(Materials::AssetRegistry::global().imageTexture("data/earthmap.jpg"));
+    objects.add(make_shared<Solids::Sphere>(Math::Point3(400, 200, 400), 100, emat));
+    auto pertext = Materials::AssetRegistry::global().noiseTexture(0.05);
+    objects.add(make_shared<Solids::Sphere>(Math::Point3(220, 280, 300), 80, Materials::AssetRegistry::global().lambertian(pertext)));
+
+    std::vector<Solids::SphereSet::Particle> boxes2;
+    MaterialHandle white = MaterialRegistry::current().add(make_shared<Materials::Lambertian>(Math::Color(0.73, 0.73, 0.73)));
+    int ns = 1000;
+    for (int j = 0; j < ns; ++j)
+    {
+        float x = static_cast<float>(Math::randomDouble(0, 165));
+        float y = static_cast<float>(Math::randomDouble(0, 165));
+        float z = static_cast<float>(Math::randomDouble(0, 165));
+        boxes2.push_back(Solids::SphereSet::Particle{ { x, y, z }, 10, white });
+    }
+
+    objects.add(make_shared<Math::Instance>(make_shared<Solids::SphereSet>(boxes2, bvhOptions),
+        Math::Transform::translation(Math::Vec3(-100, 270, 395)) * Math::Transform::rotation(Math::Vec3(0, 1, 0), 15)));
+    return objects;
+}
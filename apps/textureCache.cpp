@@ -0,0 +1,57 @@
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <GRay/rtweekend.hpp>
+#include <GRay/texture.hpp>
+
+using namespace GRay;
+
+// Writes the texture cache of every image given into directory (--dir, the current one by
+// default), so renders using that cache directory map the decoded pixels instead of decoding
+// them. .hdr files are cached as float textures, or as half floats or RGBE with --half or
+// --rgbe before them.
+// Usage: GRayTextureCache [--dir directory] [--half | --rgbe] image...
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " [--dir directory] [--half | --rgbe] image...\n";
+        return 1;
+    }
+    Materials::TextureCache::setDirectory(".");
+    int failed = 0;
+    Materials::TexelFormat format = Materials::TexelFormat::Float32;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* fileName = argv[i];
+        if (std::strcmp(fileName, "--dir") == 0 && i + 1 < argc)
+        {
+            Materials::TextureCache::setDirectory(argv[++i]);
+            continue;
+        }
+        if (std::strcmp(fileName, "--half") == 0 || std::strcmp(fileName, "--rgbe") == 0)
+        {
+            format = fileName[2] == 'h' ? Materials::TexelFormat::Half : Materials::TexelFormat::Rgbe;
+            continue;
+        }
+        const char* extension = std::strrchr(fileName, '.');
+        bool hdr = extension && (std::strcmp(extension, ".hdr") == 0 || std::strcmp(extension, ".HDR") == 0);
+
+        auto start = std::chrono::steady_clock::now();
+        bool loaded;
+        if (hdr)
+            loaded = Materials::ImageTextureHDRI(fileName, format).loaded();
+        else
+            loaded = Materials::ImageTexture(fileName).loaded();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        if (!loaded)
+        {
+            ++failed;
+            continue;
+        }
+        std::cout << fileName << " (" << (hdr ? Materials::texelFormatName(format) : "float") << ", " << ms << " ms)\n";
+    }
+    return failed == 0 ? 0 : 1;
+}
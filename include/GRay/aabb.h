@@ -17,6 +17,12 @@ namespace GRay
             Math::Point3 min() const { return minimum; }
             Math::Point3 max() const { return maximum; }
 
+            double surfaceArea() const
+            {
+                Math::Vec3 d = maximum - minimum;
+                return 2.0 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+            }
+
             bool hit(const Math::Ray& r, double t_min, double t_max) const;
             /*{
                 for (int a = 0; a < 3; ++a)
@@ -9,112 +9,262 @@ namespace GRay
 {
     namespace Solids
     {
+        namespace Detail
+        {
+            // Solid angle density of a point chosen uniformly on a rectangle, as seen from
+            // origin. Rectangles emit from both faces.
+            inline double rectPdf(const Math::Point3& origin, const Math::Point3& p, const Math::Vec3& normal, double area)
+            {
+                Math::Vec3 toLight = p - origin;
+                double distanceSquared = toLight.lenghtSquared();
+                double cosine = fabs(Math::dot(toLight, normal)) / sqrt(distanceSquared);
+                if (cosine < 1e-8 || area <= 0)
+                    return 0;
+                return distanceSquared / (cosine * area);
+            }
+        }
+
         class XYRect : public Math::Hittable
         {
         public:
             XYRect() {}
+            XYRect(double _x0, double _x1, double _y0, double _y1, double _k, MaterialHandle mat) :
+                x0{ _x0 }, x1{ _x1 }, y0{ _y0 }, y1{ _y1 }, k{ _k }, material{ mat } {}
             XYRect(double _x0, double _x1, double _y0, double _y1, double _k, shared_ptr<Material> mat) :
-                x0{ _x0 }, x1{ _x1 }, y0{ _y0 }, y1{ _y1 }, k{ _k }, mp{ mat } {}
-            bool hit(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const override;
+                XYRect(_x0, _x1, _y0, _y1, _k, MaterialRegistry::current().add(mat)) {}
+            bool hit(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const override
+            {
+                return intersectAndFinalize(r, t_min, t_max, rec);
+            }
+            bool intersect(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const override
+            {
+                double t;
+                if (!planeHit(r, t_min, t_max, t))
+                    return false;
+                rec.t = t;
+                rec.object = this;
+                return true;
+            }
+            void finalizeHit(const Math::Ray& r, Math::hitRecord& rec) const override;
+            bool sampleSurface(const Math::Point3& origin, Utils::Random& rng, Math::SurfaceSample& sample) const override;
+            double surfacePdf(const Math::Point3& origin, const Math::hitRecord& rec) const override
+            {
+                return Detail::rectPdf(origin, rec.p, rec.normal, area());
+            }
+            bool occluded(const Math::Ray& r, double t_min, double t_max) const override
+            {
+                double t;
+                return planeHit(r, t_min, t_max, t);
+            }
             bool boundingBox(double time0, double time1, Solids::AABB& outputBox) const override
             {
                 outputBox = Solids::AABB(Math::Point3(x0, y0, k - 0.0001), Math::Point3(x1, y1, k + 0.0001));
                 return true;
             }
         public:
-            shared_ptr<Material> mp;
+            MaterialHandle material;
             double x0, x1, y0, y1, k;
+        private:
+            bool planeHit(const Math::Ray& r, double t_min, double t_max, double& t) const;
+            double area() const { return (x1 - x0) * (y1 - y0); }
         };
 
         class XZRect : public Math::Hittable
         {
         public:
             XZRect() {}
+            XZRect(double _x0, double _x1, double _z0, double _z1, double _k, MaterialHandle mat) :
+                x0{ _x0 }, x1{ _x1 }, z0{ _z0 }, z1{ _z1 }, k{ _k }, material{ mat } {}
             XZRect(double _x0, double _x1, double _z0, double _z1, double _k, shared_ptr<Material> mat) :
-                x0{ _x0 }, x1{ _x1 }, z0{ _z0 }, z1{ _z1 }, k{ _k }, mp{ mat } {}
-            bool hit(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const override;
+                XZRect(_x0, _x1, _z0, _z1, _k, MaterialRegistry::current().add(mat)) {}
+            bool hit(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const override
+            {
+                return intersectAndFinalize(r, t_min, t_max, rec);
+            }
+            bool intersect(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const override
+            {
+                double t;
+                if (!planeHit(r, t_min, t_max, t))
+                    return false;
+                rec.t = t;
+                rec.object = this;
+                return true;
+            }
+            void finalizeHit(const Math::Ray& r, Math::hitRecord& rec) const override;
+            bool sampleSurface(const Math::Point3& origin, Utils::Random& rng, Math::SurfaceSample& sample) const override;
+            double surfacePdf(const Math::Point3& origin, const Math::hitRecord& rec) const override
+            {
+                return Detail::rectPdf(origin, rec.p, rec.normal, area());
+            }
+            bool occluded(const Math::Ray& r, double t_min, double t_max) const override
+            {
+                double t;
+                return planeHit(r, t_min, t_max, t);
+            }
             bool boundingBox(double time0, double time1, Solids::AABB& outputBox) const override
             {
                 outputBox = Solids::AABB(Math::Point3(x0, k - 0.0001, z0), Math::Point3(x1, k + 0.0001, z1));
                 return true;
             }
         public:
-            shared_ptr<Material> mp;
+            MaterialHandle material;
             double x0, x1, z0, z1, k;
+        private:
+            bool planeHit(const Math::Ray& r, double t_min, double t_max, double& t) const;
+            double area() const { return (x1 - x0) * (z1 - z0); }
         };
 
         class YZRect : public Math::Hittable
         {
         public:
             YZRect() {}
+            YZRect(double _y0, double _y1, double _z0, double _z1, double _k, MaterialHandle mat) :
+                y0{ _y0 }, y1{ _y1 }, z0{ _z0 }, z1{ _z1 }, k{ _k }, material{ mat } {}
             YZRect(double _y0, double _y1, double _z0, double _z1, double _k, shared_ptr<Material> mat) :
-                y0{ _y0 }, y1{ _y1 }, z0{ _z0 }, z1{ _z1 }, k{ _k }, mp{ mat } {}
-            bool hit(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const override;
+                YZRect(_y0, _y1, _z0, _z1, _k, MaterialRegistry::current().add(mat)) {}
+            bool hit(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const override
+            {
+                return intersectAndFinalize(r, t_min, t_max, rec);
+            }
+            bool intersect(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const override
+            {
+                double t;
+                if (!planeHit(r, t_min, t_max, t))
+                    return false;
+                rec.t = t;
+                rec.object = this;
+                return true;
+            }
+            void finalizeHit(const Math::Ray& r, Math::hitRecord& rec) const override;
+            bool sampleSurface(const Math::Point3& origin, Utils::Random& rng, Math::SurfaceSample& sample) const override;
+            double surfacePdf(const Math::Point3& origin, const Math::hitRecord& rec) const override
+            {
+                return Detail::rectPdf(origin, rec.p, rec.normal, area());
+            }
+            bool occluded(const Math::Ray& r, double t_min, double t_max) const override
+            {
+                double t;
+                return planeHit(r, t_min, t_max, t);
+            }
             bool boundingBox(double time0, double time1, Solids::AABB& outputBox) const override
             {
                 outputBox = Solids::AABB(Math::Point3(k - 0.0001, y0, z0), Math::Point3(k + 0.0001, y1, z1));
                 return true;
             }
         public:
-            shared_ptr<Material> mp;
+            MaterialHandle material;
             double y0, y1, z0, z1, k;
+        private:
+            bool planeHit(const Math::Ray& r, double t_min, double t_max, double& t) const;
+            double area() const { return (y1 - y0) * (z1 - z0); }
         };
 
-        bool XYRect::hit(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const
+        inline bool XYRect::planeHit(const Math::Ray& r, double t_min, double t_max, double& t) const
         {
-            auto t = (k - r.origin().z()) / r.direction().z();
+            t = (k - r.origin().z()) / r.direction().z();
             if (t < t_min || t > t_max)
                 return false;
             auto x = r.origin().x() + t * r.direction().x();
             auto y = r.origin().y() + t * r.direction().y();
-            if (x < x0 || x > x1 || y < y0 || y > y1)
-                return false;
+            return !(x < x0 || x > x1 || y < y0 || y > y1);
+        }
+
+        inline void XYRect::finalizeHit(const Math::Ray& r, Math::hitRecord& rec) const
+        {
+            auto x = r.origin().x() + rec.t * r.direction().x();
+            auto y = r.origin().y() + rec.t * r.direction().y();
             rec.u = (x - x0) / (x1 - x0);
             rec.v = (y - y0) / (y1 - y0);
-            rec.t = t;
+            rec.uvDensity = 1 / sqrt(area());
             auto outwardNormal = Math::Vec3(0, 0, 1);
             rec.setFaceNormal(r, outwardNormal);
-            rec.mat_ptr = mp;
-            rec.p = r.at(t);
-            return true;
+            rec.material = material;
+            rec.p = r.at(rec.t);
+        }
+
+        inline bool XYRect::sampleSurface(const Math::Point3& origin, Utils::Random& rng, Math::SurfaceSample& sample) const
+        {
+            sample.u = rng.nextDouble();
+            sample.v = rng.nextDouble();
+            double a = x0 + sample.u * (x1 - x0);
+            double b = y0 + sample.v * (y1 - y0);
+            sample.p = Math::Point3(a, b, k);
+            sample.normal = Math::Vec3(0, 0, 1);
+            sample.material = material;
+            sample.pdf = Detail::rectPdf(origin, sample.p, sample.normal, area());
+            return sample.pdf > 0;
         }
 
-        bool XZRect::hit(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const
+        inline bool XZRect::planeHit(const Math::Ray& r, double t_min, double t_max, double& t) const
         {
-            auto t = (k - r.origin().y()) / r.direction().y();
+            t = (k - r.origin().y()) / r.direction().y();
             if (t < t_min || t > t_max)
                 return false;
             auto x = r.origin().x() + t * r.direction().x();
             auto z = r.origin().z() + t * r.direction().z();
-            if (x < x0 || x > x1 || z < z0 || z > z1)
-                return false;
+            return !(x < x0 || x > x1 || z < z0 || z > z1);
+        }
+
+        inline void XZRect::finalizeHit(const Math::Ray& r, Math::hitRecord& rec) const
+        {
+            auto x = r.origin().x() + rec.t * r.direction().x();
+            auto z = r.origin().z() + rec.t * r.direction().z();
             rec.u = (x - x0) / (x1 - x0);
             rec.v = (z - z0) / (z1 - z0);
-            rec.t = t;
+            rec.uvDensity = 1 / sqrt(area());
             auto outwardNormal = Math::Vec3(0, 1, 0);
             rec.setFaceNormal(r, outwardNormal);
-            rec.mat_ptr = mp;
-            rec.p = r.at(t);
-            return true;
+            rec.material = material;
+            rec.p = r.at(rec.t);
         }
 
-        bool YZRect::hit(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const
+        inline bool XZRect::sampleSurface(const Math::Point3& origin, Utils::Random& rng, Math::SurfaceSample& sample) const
         {
-            auto t = (k - r.origin().x()) / r.direction().x();
+            sample.u = rng.nextDouble();
+            sample.v = rng.nextDouble();
+            double a = x0 + sample.u * (x1 - x0);
+            double b = z0 + sample.v * (z1 - z0);
+            sample.p = Math::Point3(a, k, b);
+            sample.normal = Math::Vec3(0, 1, 0);
+            sample.material = material;
+            sample.pdf = Detail::rectPdf(origin, sample.p, sample.normal, area());
+            return sample.pdf > 0;
+        }
+
+        inline bool YZRect::planeHit(const Math::Ray& r, double t_min, double t_max, double& t) const
+        {
+            t = (k - r.origin().x()) / r.direction().x();
             if (t < t_min || t > t_max)
                 return false;
             auto y = r.origin().y() + t * r.direction().y();
             auto z = r.origin().z() + t * r.direction().z();
-            if (y < y0 || y > y1 || z < z0 || z > z1)
-                return false;
+            return !(y < y0 || y > y1 || z < z0 || z > z1);
+        }
+
+        inline void YZRect::finalizeHit(const Math::Ray& r, Math::hitRecord& rec) const
+        {
+            auto y = r.origin().y() + rec.t * r.direction().y();
+            auto z = r.origin().z() + rec.t * r.direction().z();
             rec.u = (y - y0) / (y1 - y0);
             rec.v = (z - z0) / (z1 - z0);
-            rec.t = t;
+            rec.uvDensity = 1 / sqrt(area());
             auto outwardNormal = Math::Vec3(1, 0, 0);
             rec.setFaceNormal(r, outwardNormal);
-            rec.mat_ptr = mp;
-            rec.p = r.at(t);
-            return true;
+            rec.material = material;
+            rec.p = r.at(rec.t);
+        }
+
+        inline bool YZRect::sampleSurface(const Math::Point3& origin, Utils::Random& rng, Math::SurfaceSample& sample) const
+        {
+            sample.u = rng.nextDouble();
+            sample.v = rng.nextDouble();
+            double a = y0 + sample.u * (y1 - y0);
+            double b = z0 + sample.v * (z1 - z0);
+            sample.p = Math::Point3(k, a, b);
+            sample.normal = Math::Vec3(1, 0, 0);
+            sample.material = material;
+            sample.pdf = Detail::rectPdf(origin, sample.p, sample.normal, area());
+            return sample.pdf > 0;
         }
     }
 }
\ No newline at end of file
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace GRay
+{
+    namespace Utils
+    {
+        // Allocator for std::vector that places the buffer on an Alignment-byte boundary
+        // (cache lines, SIMD loads). Works without C++17 aligned new.
+        template <typename T, size_t Alignment = 64>
+        class AlignedAllocator
+        {
+        public:
+            typedef T value_type;
+
+            template <typename U>
+            struct rebind
+            {
+                typedef AlignedAllocator<U, Alignment> other;
+            };
+
+            AlignedAllocator() {}
+            template <typename U>
+            AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+            T* allocate(size_t n)
+            {
+                //Over-allocate and keep the raw pointer just in front of the aligned block
+                size_t bytes = n * sizeof(T) + Alignment + sizeof(void*);
+                void* raw = std::malloc(bytes);
+                if (!raw)
+                    throw std::bad_alloc();
+                uintptr_t start = reinterpret_cast<uintptr_t>(raw) + sizeof(void*);
+                uintptr_t aligned = (start + Alignment - 1) & ~static_cast<uintptr_t>(Alignment - 1);
+                reinterpret_cast<void**>(aligned)[-1] = raw;
+                return reinterpret_cast<T*>(aligned);
+            }
+
+            void deallocate(T* p, size_t)
+            {
+                if (p)
+                    std::free(reinterpret_cast<void**>(p)[-1]);
+            }
+        };
+
+        template <typename T, typename U, size_t A>
+        bool operator==(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&) { return true; }
+
+        template <typename T, typename U, size_t A>
+        bool operator!=(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&) { return false; }
+    }
+}
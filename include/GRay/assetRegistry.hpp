@@ -0,0 +1,210 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/texture.hpp>
+#include <GRay/material.hpp>
+#include <GRay/perlin.hpp>
+#include <GRay/threadPool.hpp>
+#include <cstdio>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace GRay
+{
+    namespace Materials
+    {
+        // Textures and materials shared by everything that asks for the same source and load
+        // options, so an image referenced by hundreds of objects is decoded once. Textures are
+        // handed out const, their options fixed at construction; treat the materials as
+        // read-only too, since changing one changes it for every user.
+        // Assets are loaded on first request. Concurrent requests for one asset wait for that
+        // load, while distinct assets load in parallel.
+        class AssetRegistry
+        {
+        public:
+            struct HdriOptions
+            {
+                HdriOptions() : format{ TexelFormat::Float32 }, subSampling{ false }, subSamplingRadius{ 0.01 }, useClamping{ false },
+                    remapingFactor{ 1 / 2.2 } {}
+                TexelFormat format;
+                bool subSampling;
+                double subSamplingRadius;
+                bool useClamping;
+                double remapingFactor;
+            };
+
+            struct Statistics
+            {
+                size_t requests;    //calls handing out an asset
+                size_t loads;       //assets built
+                size_t loadedBytes; //size of the assets built
+                size_t savedBytes;  //size of the copies the repeated requests would have built
+            };
+
+            AssetRegistry() {}
+            AssetRegistry(const AssetRegistry&) = delete;
+            AssetRegistry& operator=(const AssetRegistry&) = delete;
+
+            shared_ptr<const ImageTexture> imageTexture(const std::string& path)
+            {
+                return find<const ImageTexture>("image:" + path, [&]
+                {
+                    auto texture = make_shared<const ImageTexture>(path.c_str());
+                    return Loaded<const ImageTexture>{ texture, texture->decodedBytes() };
+                });
+            }
+
+            shared_ptr<const ImageTextureHDRI> imageTextureHDRI(const std::string& path, const HdriOptions& options = HdriOptions())
+            {
+                char key[128];
+                std::snprintf(key, sizeof(key), "hdri:%u:%d:%.17g:%d:%.17g:", static_cast<unsigned>(options.format), options.subSampling,
+                    options.subSamplingRadius, options.useClamping, options.remapingFactor);
+                return find<const ImageTextureHDRI>(key + path, [&]
+                {
+                    auto texture = make_shared<const ImageTextureHDRI>(path.c_str(), options.format, options.useClamping, options.remapingFactor,
+                        options.subSampling, options.subSamplingRadius);
+                    return Loaded<const ImageTextureHDRI>{ texture, texture->decodedBytes() };
+                });
+            }
+
+            shared_ptr<const Perlin> perlin(uint32_t seed = 0)
+            {
+                return find<const Perlin>("perlin:" + std::to_string(seed), [&]
+                {
+                    auto noise = make_shared<const Perlin>(seed);
+                    return Loaded<const Perlin>{ noise, noise->tableBytes() };
+                });
+            }
+
+            shared_ptr<const NoiseTexture> noiseTexture(double scale, uint32_t seed = 0)
+            {
+                char key[64];
+                std::snprintf(key, sizeof(key), "noise:%.17g:%u", scale, seed);
+                return find<const NoiseTexture>(key, [&]
+                {
+                    return Loaded<const NoiseTexture>{ make_shared<const NoiseTexture>(scale, perlin(seed)), sizeof(NoiseTexture) };
+                });
+            }
+
+            // One Lambertian per albedo texture.
+            shared_ptr<Lambertian> lambertian(const shared_ptr<const Texture>& albedo)
+            {
+                char key[64];
+                std::snprintf(key, sizeof(key), "lambertian:%p", static_cast<const void*>(albedo.get()));
+                return find<Lambertian>(key, [&]
+                {
+                    return Loaded<Lambertian>{ make_shared<Lambertian>(albedo), sizeof(Lambertian) };
+                });
+            }
+
+            // Loads the images at paths in parallel, .hdr files as ImageTextureHDRI with default
+            // options and everything else as ImageTexture. threadCount == 0 picks one worker per
+            // hardware thread.
+            void preloadImages(const std::vector<std::string>& paths, size_t threadCount = 0)
+            {
+                Utils::ThreadPool pool(threadCount);
+                std::vector<std::future<void> > pending;
+                for (const std::string& path : paths)
+                    pending.push_back(pool.submit([this, path]
+                    {
+                        bool hdr = path.size() >= 4 && (path.compare(path.size() - 4, 4, ".hdr") == 0 || path.compare(path.size() - 4, 4, ".HDR") == 0);
+                        if (hdr)
+                            imageTextureHDRI(path);
+                        else
+                            imageTexture(path);
+                    }));
+                for (std::future<void>& done : pending)
+                    done.get();
+            }
+
+            Statistics statistics() const
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                Statistics s{ 0, 0, 0, 0 };
+                for (const auto& entry : assets)
+                {
+                    const Slot& slot = entry.second;
+                    s.requests += slot.requests;
+                    if (!slot.ready)
+                        continue;
+                    ++s.loads;
+                    s.loadedBytes += slot.bytes;
+                    s.savedBytes += slot.bytes * (slot.requests - 1);
+                }
+                return s;
+            }
+
+            // Forgets every asset; objects already handed out stay valid.
+            void clear()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                assets.clear();
+            }
+
+            static AssetRegistry& global()
+            {
+                static AssetRegistry registry;
+                return registry;
+            }
+
+        private:
+            template<class T>
+            struct Loaded
+            {
+                shared_ptr<T> asset;
+                size_t bytes;
+            };
+
+            struct Slot
+            {
+                Slot() : requests{ 0 }, bytes{ 0 }, ready{ false } {}
+                std::shared_future<shared_ptr<const void> > asset;
+                size_t requests;
+                size_t bytes;
+                bool ready;
+            };
+
+            // Keys start with the asset type, so one key always maps to one T. Materials are
+            // handed out mutable because primitives register them as shared_ptr<Material>.
+            template<class T, class Load>
+            shared_ptr<T> find(const std::string& key, Load load)
+            {
+                std::promise<shared_ptr<const void> > promise;
+                std::shared_future<shared_ptr<const void> > asset;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    Slot& slot = assets[key];
+                    ++slot.requests;
+                    if (slot.asset.valid())
+                        asset = slot.asset;
+                    else
+                        slot.asset = promise.get_future().share();
+                }
+                if (!asset.valid())
+                {
+                    //First request: load outside the lock so other assets can load meanwhile
+                    Loaded<T> loaded = load();
+                    promise.set_value(loaded.asset);
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        auto slot = assets.find(key);
+                        if (slot != assets.end())
+                        {
+                            slot->second.bytes = loaded.bytes;
+                            slot->second.ready = true;
+                        }
+                    }
+                    return loaded.asset;
+                }
+                return std::const_pointer_cast<T>(std::static_pointer_cast<const T>(asset.get()));
+            }
+
+        private:
+            std::unordered_map<std::string, Slot> assets;
+            mutable std::mutex mutex;
+        };
+    }
+}
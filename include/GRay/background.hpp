@@ -2,6 +2,10 @@
 
 #include <GRay/rtweekend.hpp>
 #include <GRay/texture.hpp>
+#include <GRay/material.hpp>
+#include <GRay/distribution.hpp>
+#include <GRay/environmentMap.hpp>
+#include <vector>
 
 using namespace GRay;
 
@@ -13,19 +17,112 @@ namespace GRay
         {
         public:
             Background(Math::Color c, double att = 1.0) : mat_ptr{ make_shared<Materials::DiffuseLight>(c, att) } {}
-            Background(shared_ptr<Materials::Texture> t, double att = 1.0) : mat_ptr{ make_shared<Materials::DiffuseLight>(t, att) } {}
+            // HDRI textures can be resampled into projection at load, which makes lookups cheaper
+            // than the lat-long texture's; other textures always use the lat-long mapping.
+            Background(shared_ptr<const Materials::Texture> t, double att = 1.0, BackgroundProjection projection = BackgroundProjection::Equirect)
+                : mat_ptr{ make_shared<Materials::DiffuseLight>(t, att) }
+            {
+                if (auto hdri = std::dynamic_pointer_cast<const Materials::ImageTextureHDRI>(t))
+                {
+                    if (projection != BackgroundProjection::Equirect && hdri->loaded())
+                        buildEnvironmentMap(*hdri, att, projection);
+                    else
+                        buildDistribution(*hdri);
+                }
+            }
 
             Math::Color getValue(const Math::Ray& ray) const
             {
+                if (environment)
+                    return environment->value(ray.direction());
                 double u, v;
                 Math::Vec3 unitRay = Math::unitVector(ray.direction());
                 getSphereUV(static_cast<Math::Point3>(unitRay), u, v);
                 return mat_ptr->emitted(u, v, static_cast<Math::Point3>(unitRay));
             }
 
+            // Importance sampling of HDRI backgrounds, in proportion to luminance times the
+            // solid angle of each pixel: of the environment map when there is one, since that is
+            // what escaped rays see, otherwise of the lat-long image.
+            bool canSample() const { return environment != nullptr || distribution != nullptr; }
+
+            bool sample(Utils::Random& rng, Math::Vec3& direction, Math::Color& radiance, double& pdf) const
+            {
+                double x, y, imagePdf;
+                double u1 = rng.nextDouble();
+                double u2 = rng.nextDouble();
+                if (environment)
+                    return environment->sample(u1, u2, direction, radiance, pdf);
+                distribution->sampleContinuous(u1, u2, x, y, imagePdf);
+
+                //Inverse of getSphereUV with the texture's v = 1 - y
+                double theta = Math::pi * (1 - y);
+                double phi = 2 * Math::pi * x;
+                double sinTheta = sin(theta);
+                if (imagePdf <= 0 || sinTheta <= 0)
+                    return false;
+                direction = Math::Vec3(-cos(phi) * sinTheta, -cos(theta), sin(phi) * sinTheta);
+                radiance = mat_ptr->emitted(x, 1 - y, static_cast<Math::Point3>(direction));
+                pdf = imagePdf / (2 * Math::pi * Math::pi * sinTheta);
+                return true;
+            }
+
+            // Solid angle density of sample() for direction.
+            double pdf(const Math::Vec3& direction) const
+            {
+                if (environment)
+                    return environment->pdf(direction);
+                double u, v;
+                Math::Vec3 unitDirection = Math::unitVector(direction);
+                getSphereUV(static_cast<Math::Point3>(unitDirection), u, v);
+                double sinTheta = sin(Math::pi * v);
+                if (sinTheta <= 0)
+                    return 0;
+                return distribution->pdf(u, 1 - v) / (2 * Math::pi * Math::pi * sinTheta);
+            }
+
         public:
             shared_ptr<GRay::Material> mat_ptr;
         private:
+            void buildDistribution(const Materials::ImageTextureHDRI& hdri)
+            {
+                const int width = hdri.getWidth();
+                const int height = hdri.getHeight();
+                if (!hdri.loaded() || width <= 0 || height <= 0)
+                    return;
+                distribution = make_shared<Utils::Distribution2D>(width, height, [&](size_t i, size_t j)
+                {
+                    //Rows near the poles cover less solid angle
+                    double sinTheta = sin(Math::pi * (j + 0.5) / height);
+                    return std::max(Math::luminance(hdri.texel(static_cast<int>(i), static_cast<int>(j))), 0.0) * sinTheta;
+                });
+            }
+
+            // Texel counts match the equator of the lat-long image; every texel takes a bilinear
+            // lookup at the mip level of its own footprint.
+            void buildEnvironmentMap(const Materials::ImageTextureHDRI& hdri, double att, BackgroundProjection projection)
+            {
+                const int width = hdri.getWidth();
+                int resolution;
+                if (projection == BackgroundProjection::CubeMap)
+                    resolution = std::max(width / 4, 1);
+                else
+                    resolution = std::max(static_cast<int>(width / std::sqrt(2.0)), 1);
+                //Angular size of a texel, as a fraction of the image's 2 pi wide rows
+                double footprint = (projection == BackgroundProjection::CubeMap ? 0.25 : 0.5) / resolution;
+                double level = std::max(std::log2(footprint * width), 0.0);
+                environment = make_shared<EnvironmentMap>(projection, resolution, [&](const Math::Vec3& direction)
+                {
+                    double u, v;
+                    getSphereUV(static_cast<Math::Point3>(direction), u, v);
+                    if (hdri.subSampling)
+                        return att * hdri.value(u, v, static_cast<Math::Point3>(direction));
+                    return att * hdri.trilinear(u, 1 - v, level);
+                }, hdri.texelFormat());
+            }
+
+            shared_ptr<const Utils::Distribution2D> distribution;
+            shared_ptr<const EnvironmentMap> environment;
             static void getSphereUV(const Math::Point3& p, double& u, double& v)
             {
                 // p: a given point on the sphere of radius one, centered at the origin.
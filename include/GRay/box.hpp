@@ -1,8 +1,8 @@
 #pragma once
 
 #include <GRay/rtweekend.hpp>
-#include <GRay/aarect.hpp>
-#include <GRay/hittableList.hpp>
+#include <GRay/hittable.hpp>
+#include <array>
 
 using namespace GRay;
 
@@ -10,13 +10,42 @@ namespace GRay
 {
     namespace Solids
     {
+        // Axis-aligned box intersected with a single slab test. Face normals and UVs are derived
+        // from the face that was hit; UVs follow the rectangles of aarect.hpp, so textures land
+        // on each face as they did on a box built from six of them.
         class Box : public Math::Hittable
         {
         public:
+            // Face order of the per-face materials.
+            enum Face { MinX, MaxX, MinY, MaxY, MinZ, MaxZ };
+
             Box() {}
-            Box(const Math::Point3& p0, const Math::Point3& p1, shared_ptr<Material> mat_ptr);
+            Box(const Math::Point3& p0, const Math::Point3& p1, MaterialHandle material) :
+                Box(p0, p1, std::array<MaterialHandle, 6>{ { material, material, material, material, material, material } }) {}
+            Box(const Math::Point3& p0, const Math::Point3& p1, shared_ptr<Material> mat_ptr) :
+                Box(p0, p1, MaterialRegistry::current().add(mat_ptr)) {}
+            // One material per face, indexed by Face.
+            Box(const Math::Point3& p0, const Math::Point3& p1, const std::array<MaterialHandle, 6>& faceMaterials);
 
-            bool hit(const Ray& r, double t_min, double t_max, hitRecord& rec) const override;
+            bool hit(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const override
+            {
+                return intersectAndFinalize(r, t_min, t_max, rec);
+            }
+            bool intersect(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const override
+            {
+                double t;
+                if (!slabHit(r, t_min, t_max, t))
+                    return false;
+                rec.t = t;
+                rec.object = this;
+                return true;
+            }
+            void finalizeHit(const Math::Ray& r, Math::hitRecord& rec) const override;
+            bool occluded(const Math::Ray& r, double t_min, double t_max) const override
+            {
+                double t;
+                return slabHit(r, t_min, t_max, t);
+            }
             bool boundingBox(double time0, double time1, GRay::Solids::AABB& outputBox) const override
             {
                 outputBox = AABB(boxMin, boxMax);
@@ -25,27 +54,85 @@ namespace GRay
         public:
             Math::Point3 boxMin;
             Math::Point3 boxMax;
-            Math::HittableList sides;
+            std::array<MaterialHandle, 6> materials;
+        private:
+            bool slabHit(const Math::Ray& r, double t_min, double t_max, double& t) const;
         };
 
-        Box::Box(const Math::Point3& p0, const Math::Point3& p1, shared_ptr<Material> mat_ptr)
+        inline Box::Box(const Math::Point3& p0, const Math::Point3& p1, const std::array<MaterialHandle, 6>& faceMaterials) :
+            materials(faceMaterials)
         {
-            boxMin = p0;
-            boxMax = p1;
-
-            sides.add(make_shared<XYRect>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), mat_ptr));
-            sides.add(make_shared<XYRect>(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), mat_ptr));
-
-            sides.add(make_shared<XZRect>(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), mat_ptr));
-            sides.add(make_shared<XZRect>(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), mat_ptr));
+            for (int a = 0; a < 3; ++a)
+            {
+                boxMin[a] = fmin(p0[a], p1[a]);
+                boxMax[a] = fmax(p0[a], p1[a]);
+            }
+        }
 
-            sides.add(make_shared<YZRect>(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), mat_ptr));
-            sides.add(make_shared<YZRect>(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), mat_ptr));
+        //Nearest crossing of the box surface in [t_min, t_max]: the entry point, or the exit point
+        //for rays starting inside
+        inline bool Box::slabHit(const Math::Ray& r, double t_min, double t_max, double& t) const
+        {
+            double tEnter = -Utils::infinity, tExit = Utils::infinity;
+            for (int a = 0; a < 3; ++a)
+            {
+                double invD = 1.0 / r.direction()[a];
+                double t0 = (boxMin[a] - r.origin()[a]) * invD;
+                double t1 = (boxMax[a] - r.origin()[a]) * invD;
+                if (invD < 0.0)
+                    std::swap(t0, t1);
+                tEnter = t0 > tEnter ? t0 : tEnter;
+                tExit = t1 < tExit ? t1 : tExit;
+            }
+            if (!(tEnter <= tExit))
+                return false;
+            if (tEnter >= t_min && tEnter <= t_max)
+                t = tEnter;
+            else if (tExit >= t_min && tExit <= t_max)
+                t = tExit;
+            else
+                return false;
+            return true;
         }
 
-        bool Box::hit(const Ray& r, double t_min, double t_max, hitRecord& rec) const
+        inline void Box::finalizeHit(const Math::Ray& r, Math::hitRecord& rec) const
         {
-            return sides.hit(r, t_min, t_max, rec);
+            rec.p = r.at(rec.t);
+
+            //The face is the box plane closest to the hit point
+            int face = MinX;
+            double closest = Utils::infinity;
+            for (int a = 0; a < 3; ++a)
+            {
+                double toMin = fabs(rec.p[a] - boxMin[a]);
+                double toMax = fabs(rec.p[a] - boxMax[a]);
+                if (toMin < closest)
+                {
+                    closest = toMin;
+                    face = 2 * a;
+                }
+                if (toMax < closest)
+                {
+                    closest = toMax;
+                    face = 2 * a + 1;
+                }
+            }
+
+            //UVs span the other two axes in increasing order, as XYRect, XZRect and YZRect do
+            int axis = face / 2;
+            int uAxis = axis == 0 ? 1 : 0;
+            int vAxis = axis == 2 ? 1 : 2;
+            double uExtent = boxMax[uAxis] - boxMin[uAxis];
+            double vExtent = boxMax[vAxis] - boxMin[vAxis];
+            rec.u = uExtent > 0 ? (rec.p[uAxis] - boxMin[uAxis]) / uExtent : 0;
+            rec.v = vExtent > 0 ? (rec.p[vAxis] - boxMin[vAxis]) / vExtent : 0;
+            double faceArea = uExtent * vExtent;
+            rec.uvDensity = faceArea > 0 ? 1 / sqrt(faceArea) : 0; //no footprint on zero-area faces
+
+            Math::Vec3 outwardNormal(0, 0, 0);
+            outwardNormal[axis] = face % 2 ? 1 : -1;
+            rec.setFaceNormal(r, outwardNormal);
+            rec.material = materials[face];
         }
     }
-}
\ No newline at end of file
+}
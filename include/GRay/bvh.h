@@ -3,7 +3,9 @@
 #include <GRay/rtweekend.hpp>
 #include <GRay/hittable.hpp>
 #include <GRay/hittableList.hpp>
+#include <GRay/bvhBuilder.hpp>
 #include <algorithm>
+#include <vector>
 
 namespace GRay
 {
@@ -12,103 +14,138 @@ namespace GRay
         class BvhNode : public GRay::Math::Hittable
         {
         public:
-            BvhNode();
-            BvhNode(const GRay::Math::HittableList& list, double time0, double time1) :
-                BvhNode(list.objects, 0, list.objects.size(), time0, time1) {}
+            BvhNode() {}
+            BvhNode(const GRay::Math::HittableList& list, double time0, double time1,
+                const BvhBuildOptions& options = BvhBuildOptions());
             BvhNode(const std::vector<shared_ptr<GRay::Math::Hittable> >& srcObjects,
                 size_t start, size_t end, double time0, double time1);
-            bool hit(const GRay::Math::Ray& r, double t_min, double t_max, GRay::Math::hitRecord& rec) const override;
+            // Converts a finished build tree; subtrees larger than parallelThreshold are converted on the pool.
+            BvhNode(const BvhBuildNode& node, const std::vector<BvhPrimitive>& primitives,
+                Utils::ThreadPool* pool = nullptr, size_t parallelThreshold = 0);
+            bool hit(const GRay::Math::Ray& r, double t_min, double t_max, GRay::Math::hitRecord& rec) const override
+            {
+                return intersectAndFinalize(r, t_min, t_max, rec);
+            }
+            bool intersect(const GRay::Math::Ray& r, double t_min, double t_max, GRay::Math::hitRecord& rec) const override;
             bool boundingBox(double time0, double time1, GRay::Solids::AABB& outputBox) const override;
+            bool occluded(const GRay::Math::Ray& r, double t_min, double t_max) const override
+            {
+                if (!left || !box.hit(r, t_min, t_max))
+                    return false;
+                return left->occluded(r, t_min, t_max) || (right && right->occluded(r, t_min, t_max));
+            }
         public:
             shared_ptr<GRay::Math::Hittable> left;
-            shared_ptr<GRay::Math::Hittable> right;
+            shared_ptr<GRay::Math::Hittable> right; //null when the node holds a single child
             AABB box;
+        private:
+            void build(const std::vector<shared_ptr<GRay::Math::Hittable> >& objects,
+                size_t start, size_t end, double time0, double time1, const BvhBuildOptions& options);
+            void attach(const BvhBuildNode& node, const std::vector<BvhPrimitive>& primitives,
+                Utils::ThreadPool* pool, size_t parallelThreshold);
+            void makeLeaf(const std::vector<BvhPrimitive>& primitives, size_t start, size_t end);
+            static shared_ptr<GRay::Math::Hittable> makeChild(const BvhBuildNode& node, const std::vector<BvhPrimitive>& primitives,
+                Utils::ThreadPool* pool, size_t parallelThreshold);
         };
 
-        bool BvhNode::boundingBox(double time0, double time1, GRay::Solids::AABB& outputBox) const
+        inline bool BvhNode::boundingBox(double time0, double time1, GRay::Solids::AABB& outputBox) const
         {
             outputBox = box;
             return true;
         }
 
-        bool BvhNode::hit(const GRay::Math::Ray& r, double t_min, double t_max, GRay::Math::hitRecord& rec) const
+        inline bool BvhNode::intersect(const GRay::Math::Ray& r, double t_min, double t_max, GRay::Math::hitRecord& rec) const
         {
-            if (!box.hit(r, t_min, t_max))
+            if (!left || !box.hit(r, t_min, t_max))
                 return false;
 
-            bool hitLeft = left->hit(r, t_min, t_max, rec);
-            bool hitRight = right->hit(r, t_min, hitLeft ? rec.t : t_max, rec);
+            bool hitLeft = left->intersect(r, t_min, t_max, rec);
+            if (!right)
+                return hitLeft;
+            bool hitRight = right->intersect(r, t_min, hitLeft ? rec.t : t_max, rec);
 
             return hitLeft || hitRight;
         }
 
-        inline bool boxComapre(const shared_ptr<GRay::Math::Hittable> a, const shared_ptr<GRay::Math::Hittable> b, int axis)
+        inline BvhNode::BvhNode(const GRay::Math::HittableList& list, double time0, double time1, const BvhBuildOptions& options)
         {
-            AABB boxA;
-            AABB boxB;
-
-            if (!a->boundingBox(0, 0, boxA) || !b->boundingBox(0, 0, boxB))
-                std::cerr << "No bounding box in  bvhNode constructor";
-            return boxA.min().e[axis] < boxB.min().e[axis];
+            build(list.objects, 0, list.objects.size(), time0, time1, options);
         }
 
-        bool boxXCompare(const shared_ptr<GRay::Math::Hittable> a, const shared_ptr<GRay::Math::Hittable> b)
+        inline BvhNode::BvhNode(const std::vector<shared_ptr<GRay::Math::Hittable> >& srcObjects, size_t start, size_t end, double time0, double time1)
         {
-            return boxComapre(a, b, 0);
+            build(srcObjects, start, end, time0, time1, BvhBuildOptions());
         }
 
-        bool boxYCompare(const shared_ptr<GRay::Math::Hittable> a, const shared_ptr<GRay::Math::Hittable> b)
+        inline void BvhNode::build(const std::vector<shared_ptr<GRay::Math::Hittable> >& objects,
+            size_t start, size_t end, double time0, double time1, const BvhBuildOptions& options)
         {
-            return boxComapre(a, b, 1);
+            BvhBuilder builder(options);
+            std::vector<BvhPrimitive> primitives = builder.makePrimitives(objects, start, end, time0, time1);
+            std::unique_ptr<BvhBuildNode> root = builder.build(primitives);
+            if (root)
+                attach(*root, primitives, builder.threadPool(), builder.buildOptions().parallelThreshold);
+            builder.finish();
         }
 
-        bool boxZCompare(const shared_ptr<GRay::Math::Hittable> a, const shared_ptr<GRay::Math::Hittable> b)
+        inline BvhNode::BvhNode(const BvhBuildNode& node, const std::vector<BvhPrimitive>& primitives,
+            Utils::ThreadPool* pool, size_t parallelThreshold)
         {
-            return boxComapre(a, b, 2);
+            attach(node, primitives, pool, parallelThreshold);
         }
 
-        BvhNode::BvhNode(const std::vector<shared_ptr<GRay::Math::Hittable> >& srcObjects, size_t start, size_t end, double time0, double time1)
+        inline void BvhNode::attach(const BvhBuildNode& node, const std::vector<BvhPrimitive>& primitives,
+            Utils::ThreadPool* pool, size_t parallelThreshold)
         {
-            auto objects = srcObjects;
-            int axis = Utils::randomInt(0, 2);
-            auto comparator = (axis == 0) ? boxXCompare : (axis == 1) ? boxYCompare : boxZCompare;
-
-            size_t objectSpan = end - start;
-
-            if (objectSpan == 0)
+            box = node.bounds;
+            if (node.isLeaf())
             {
-                left = right = nullptr;
+                makeLeaf(primitives, node.start, node.end);
                 return;
             }
-            else if (objectSpan == 1)
-            {
-                left = right = objects[start];
-            }
-            else if (objectSpan == 2)
+
+            if (pool && node.count() >= parallelThreshold)
             {
-                if (comparator(objects[start], objects[start + 1]))
-                {
-                    left = objects[start];
-                    right = objects[start + 1];
-                }
-                else
+                std::future<shared_ptr<GRay::Math::Hittable> > pending = pool->submit([&]
                 {
-                    left = objects[start + 1];
-                    right = objects[start];
-                }
+                    return makeChild(*node.children[0], primitives, pool, parallelThreshold);
+                });
+                right = makeChild(*node.children[1], primitives, pool, parallelThreshold);
+                left = pool->waitFor(pending);
             }
             else
             {
-                std::sort(objects.begin() + start, objects.begin() + end, comparator);
-                auto mid = start + objectSpan / 2;
-                left = make_shared<BvhNode>(objects, start, mid, time0, time1);
-                right = make_shared<BvhNode>(objects, mid, end, time0, time1);
+                left = makeChild(*node.children[0], primitives, pool, parallelThreshold);
+                right = makeChild(*node.children[1], primitives, pool, parallelThreshold);
             }
+        }
 
-            AABB boxLeft, boxRight;
-            if (!left->boundingBox(time0, time1, boxLeft) || !right->boundingBox(time0, time1, boxRight))
-                std::cerr << "No bounding box in BvhNode constructor.\n";
-            box = surroundingBox(boxLeft, boxRight);
+        inline shared_ptr<GRay::Math::Hittable> BvhNode::makeChild(const BvhBuildNode& node, const std::vector<BvhPrimitive>& primitives,
+            Utils::ThreadPool* pool, size_t parallelThreshold)
+        {
+            //Single primitives hang directly off the parent instead of getting a node of their own
+            if (node.isLeaf() && node.count() == 1)
+                return primitives[node.start].object;
+            return make_shared<BvhNode>(node, primitives, pool, parallelThreshold);
+        }
+
+        inline void BvhNode::makeLeaf(const std::vector<BvhPrimitive>& primitives, size_t start, size_t end)
+        {
+            size_t count = end - start;
+            if (count == 1)
+                left = primitives[start].object;
+            else if (count == 2)
+            {
+                left = primitives[start].object;
+                right = primitives[start + 1].object;
+            }
+            else
+            {
+                auto leaf = make_shared<GRay::Math::HittableList>();
+                for (size_t i = start; i < end; ++i)
+                    leaf->add(primitives[i].object);
+                left = leaf;
+            }
         }
     }
-}
\ No newline at end of file
+}
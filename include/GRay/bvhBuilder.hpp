@@ -0,0 +1,523 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/hittable.hpp>
+#include <GRay/threadPool.hpp>
+#include <GRay/profiling.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace GRay
+{
+    namespace Solids
+    {
+        enum class BvhSplitMethod
+        {
+            Median, //random axis, split at the object median
+            SAH,    //binned surface area heuristic
+            Morton  //linear BVH: sort by Morton code, split at the highest differing bit
+        };
+
+        struct BvhBuildStats
+        {
+            BvhBuildStats() : buildMilliseconds{ 0 }, nodes{ 0 }, leaves{ 0 }, peakMemoryBytes{ 0 } {}
+
+            double buildMilliseconds;
+            size_t nodes;
+            size_t leaves;
+            size_t peakMemoryBytes; //process high-water mark over the build (Linux), 0 when unknown
+        };
+
+        struct BvhBuildOptions
+        {
+            BvhBuildOptions(BvhSplitMethod m = BvhSplitMethod::Median) :
+                method{ m }, maxLeafSize{ 2 }, binCount{ 16 }, traversalCost{ 1.0 }, intersectionCost{ 1.0 },
+                maxDepth{ 0 }, threadCount{ 0 }, parallelThreshold{ 4096 }, stats{ nullptr } {}
+
+            BvhSplitMethod method;
+            int maxLeafSize;            //SAH and Morton
+            int binCount;               //SAH only
+            double traversalCost;       //relative cost of visiting a node
+            double intersectionCost;    //relative cost of testing a primitive
+            int maxDepth;               //0 - unlimited, deeper ranges become leaves
+            size_t threadCount;         //0 - one thread per hardware thread, 1 - serial build
+            size_t parallelThreshold;   //ranges smaller than this are built on the current thread
+            BvhBuildStats* stats;       //filled in by the build when set
+        };
+
+        // Object with its bounds and centroid cached for the builder. Structures over plain
+        // data (e.g. SphereSet) leave object null and find their items through index.
+        struct BvhPrimitive
+        {
+            shared_ptr<GRay::Math::Hittable> object;
+            AABB box;
+            GRay::Math::Point3 centroid;
+            uint32_t mortonCode;
+            uint32_t index; //position in the input
+        };
+
+        // Intermediate tree produced by BvhBuilder. After the build every node covers the
+        // contiguous primitive range [start, end), and leaves appear in depth-first order.
+        struct BvhBuildNode
+        {
+            AABB bounds;
+            size_t start;
+            size_t end;
+            int axis;
+            std::unique_ptr<BvhBuildNode> children[2];
+
+            bool isLeaf() const { return !children[0]; }
+            size_t count() const { return end - start; }
+        };
+
+        // Float conversions that round outwards, for compact node bounds that still enclose the primitives.
+        inline float roundDownToFloat(double v)
+        {
+            float f = static_cast<float>(v);
+            return f > v ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+        }
+
+        inline float roundUpToFloat(double v)
+        {
+            float f = static_cast<float>(v);
+            return f < v ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+        }
+
+        // Builds in place: primitives are partitioned, never copied per level. Subtrees larger
+        // than parallelThreshold are forked onto a thread pool, and large SAH ranges are binned
+        // in parallel chunks.
+        class BvhBuilder
+        {
+        public:
+            static const size_t maxLeafCapacity = 65535;
+
+            explicit BvhBuilder(const BvhBuildOptions& opts) :
+                options{ opts }, nodeCount{ 0 }, leafCount{ 0 }, peakTracked{ false }
+            {
+                if (options.stats)
+                    peakTracked = Utils::resetPeakMemory();
+            }
+
+            std::vector<BvhPrimitive> makePrimitives(const std::vector<shared_ptr<GRay::Math::Hittable> >& objects,
+                size_t start, size_t end, double time0, double time1);
+            std::unique_ptr<BvhBuildNode> build(std::vector<BvhPrimitive>& primitives);
+            // Fills options.stats; call once the final structure has been assembled.
+            void finish();
+
+            Utils::ThreadPool* threadPool() const { return pool.get(); }
+            size_t nodes() const { return nodeCount; }
+            const BvhBuildOptions& buildOptions() const { return options; }
+
+        private:
+            struct Bin
+            {
+                size_t count = 0;
+                AABB box;
+            };
+
+            void ensurePool(size_t primitiveCount);
+            std::unique_ptr<BvhBuildNode> buildRange(std::vector<BvhPrimitive>& primitives, size_t start, size_t end, int depth);
+            bool partition(std::vector<BvhPrimitive>& primitives, size_t start, size_t end, AABB& bounds, size_t& mid, int& axis);
+            bool partitionSah(std::vector<BvhPrimitive>& primitives, size_t start, size_t end,
+                const AABB& bounds, const AABB& centroidBounds, size_t& mid, int& axis);
+            bool partitionMorton(std::vector<BvhPrimitive>& primitives, size_t start, size_t end, size_t& mid, int& axis);
+            void computeBounds(const std::vector<BvhPrimitive>& primitives, size_t start, size_t end, AABB& bounds, AABB& centroidBounds);
+            void assignMortonCodes(std::vector<BvhPrimitive>& primitives);
+            void sortByMortonCode(std::vector<BvhPrimitive>& primitives);
+            bool runParallel(size_t count) const { return pool && count >= options.parallelThreshold; }
+
+            static uint32_t expandBits(uint32_t v)
+            {
+                v = (v * 0x00010001u) & 0xFF0000FFu;
+                v = (v * 0x00000101u) & 0x0F00F00Fu;
+                v = (v * 0x00000011u) & 0xC30C30C3u;
+                v = (v * 0x00000005u) & 0x49249249u;
+                return v;
+            }
+
+        private:
+            BvhBuildOptions options;
+            std::unique_ptr<Utils::ThreadPool> pool;
+            std::atomic<size_t> nodeCount;
+            std::atomic<size_t> leafCount;
+            Utils::Timer timer;
+            bool peakTracked;
+        };
+
+        inline void BvhBuilder::ensurePool(size_t primitiveCount)
+        {
+            size_t threads = options.threadCount == 0 ? Utils::ThreadPool::defaultThreadCount() : options.threadCount;
+            if (!pool && threads > 1 && primitiveCount >= options.parallelThreshold)
+                pool.reset(new Utils::ThreadPool(threads));
+        }
+
+        inline std::vector<BvhPrimitive> BvhBuilder::makePrimitives(const std::vector<shared_ptr<GRay::Math::Hittable> >& objects,
+            size_t start, size_t end, double time0, double time1)
+        {
+            ensurePool(end - start);
+            std::vector<BvhPrimitive> primitives(end - start);
+            auto fill = [&](size_t b, size_t e)
+            {
+                for (size_t i = b; i < e; ++i)
+                {
+                    BvhPrimitive& primitive = primitives[i];
+                    primitive.object = objects[start + i];
+                    if (!primitive.object->boundingBox(time0, time1, primitive.box))
+                        std::cerr << "No bounding box in BvhNode constructor.\n";
+                    primitive.centroid = 0.5 * (primitive.box.min() + primitive.box.max());
+                    primitive.mortonCode = 0;
+                    primitive.index = static_cast<uint32_t>(i);
+                }
+            };
+            if (runParallel(primitives.size()))
+                pool->parallelFor(0, primitives.size(), options.parallelThreshold, fill);
+            else
+                fill(0, primitives.size());
+            return primitives;
+        }
+
+        inline std::unique_ptr<BvhBuildNode> BvhBuilder::build(std::vector<BvhPrimitive>& primitives)
+        {
+            if (primitives.empty())
+                return nullptr;
+            ensurePool(primitives.size());
+            if (options.method == BvhSplitMethod::Morton)
+            {
+                assignMortonCodes(primitives);
+                sortByMortonCode(primitives);
+            }
+            return buildRange(primitives, 0, primitives.size(), 1);
+        }
+
+        inline void BvhBuilder::finish()
+        {
+            if (!options.stats)
+                return;
+            options.stats->buildMilliseconds = timer.milliseconds();
+            options.stats->nodes = nodeCount;
+            options.stats->leaves = leafCount;
+            options.stats->peakMemoryBytes = peakTracked ? Utils::peakMemoryBytes() : 0;
+        }
+
+        inline std::unique_ptr<BvhBuildNode> BvhBuilder::buildRange(std::vector<BvhPrimitive>& primitives, size_t start, size_t end, int depth)
+        {
+            std::unique_ptr<BvhBuildNode> node(new BvhBuildNode());
+            node->start = start;
+            node->end = end;
+
+            const size_t count = end - start;
+            size_t mid = start;
+            int axis = 0;
+            bool split = partition(primitives, start, end, node->bounds, mid, axis);
+            if (!split && count > maxLeafCapacity)
+            {
+                mid = start + count / 2;
+                split = true;
+            }
+            else if (split && options.maxDepth > 0 && depth >= options.maxDepth && count <= maxLeafCapacity)
+                split = false;
+
+            node->axis = axis;
+            ++nodeCount;
+            if (!split)
+            {
+                ++leafCount;
+                return node;
+            }
+
+            if (runParallel(count))
+            {
+                std::future<std::unique_ptr<BvhBuildNode> > left = pool->submit([this, &primitives, start, mid, depth]
+                {
+                    return buildRange(primitives, start, mid, depth + 1);
+                });
+                node->children[1] = buildRange(primitives, mid, end, depth + 1);
+                node->children[0] = pool->waitFor(left);
+            }
+            else
+            {
+                node->children[0] = buildRange(primitives, start, mid, depth + 1);
+                node->children[1] = buildRange(primitives, mid, end, depth + 1);
+            }
+            return node;
+        }
+
+        inline void BvhBuilder::computeBounds(const std::vector<BvhPrimitive>& primitives, size_t start, size_t end, AABB& bounds, AABB& centroidBounds)
+        {
+            auto accumulate = [&](size_t b, size_t e, AABB& box, AABB& centroids)
+            {
+                box = primitives[b].box;
+                centroids = AABB(primitives[b].centroid, primitives[b].centroid);
+                for (size_t i = b + 1; i < e; ++i)
+                {
+                    box = surroundingBox(box, primitives[i].box);
+                    centroids = surroundingBox(centroids, AABB(primitives[i].centroid, primitives[i].centroid));
+                }
+            };
+
+            if (!runParallel(end - start))
+            {
+                accumulate(start, end, bounds, centroidBounds);
+                return;
+            }
+
+            std::mutex mergeMutex;
+            bool first = true;
+            pool->parallelFor(start, end, options.parallelThreshold, [&](size_t b, size_t e)
+            {
+                AABB box, centroids;
+                accumulate(b, e, box, centroids);
+                std::lock_guard<std::mutex> lock(mergeMutex);
+                bounds = first ? box : surroundingBox(bounds, box);
+                centroidBounds = first ? centroids : surroundingBox(centroidBounds, centroids);
+                first = false;
+            });
+        }
+
+        inline bool BvhBuilder::partition(std::vector<BvhPrimitive>& primitives, size_t start, size_t end, AABB& bounds, size_t& mid, int& axis)
+        {
+            AABB centroidBounds;
+            computeBounds(primitives, start, end, bounds, centroidBounds);
+
+            const size_t count = end - start;
+            axis = 0;
+            if (count == 1)
+                return false;
+
+            switch (options.method)
+            {
+                case BvhSplitMethod::SAH:
+                    return partitionSah(primitives, start, end, bounds, centroidBounds, mid, axis);
+                case BvhSplitMethod::Morton:
+                    return partitionMorton(primitives, start, end, mid, axis);
+                case BvhSplitMethod::Median:
+                default:
+                {
+                    if (count <= 2)
+                        return false;
+                    //Axis keyed by the range so parallel builds stay reproducible
+                    axis = Utils::Random(static_cast<uint32_t>(start), static_cast<uint32_t>(end), 0xb7e1u).nextInt(0, 2);
+                    mid = start + count / 2;
+                    std::nth_element(primitives.begin() + start, primitives.begin() + mid, primitives.begin() + end,
+                        [axis](const BvhPrimitive& a, const BvhPrimitive& b) { return a.box.min()[axis] < b.box.min()[axis]; });
+                    return true;
+                }
+            }
+        }
+
+        inline bool BvhBuilder::partitionSah(std::vector<BvhPrimitive>& primitives, size_t start, size_t end,
+            const AABB& bounds, const AABB& centroidBounds, size_t& mid, int& axis)
+        {
+            const size_t count = end - start;
+            const int binCount = std::max(2, options.binCount);
+            const double parentArea = std::max(bounds.surfaceArea(), 1e-12);
+
+            auto binIndex = [&](const BvhPrimitive& p, int a)
+            {
+                const double cmin = centroidBounds.min()[a];
+                const double extent = centroidBounds.max()[a] - cmin;
+                return std::min(binCount - 1, static_cast<int>(binCount * (p.centroid[a] - cmin) / extent));
+            };
+
+            //Bin all three axes in one pass over the primitives
+            std::vector<Bin> bins(3 * binCount);
+            auto fillBins = [&](size_t b, size_t e, std::vector<Bin>& out)
+            {
+                for (int a = 0; a < 3; ++a)
+                {
+                    if (centroidBounds.max()[a] - centroidBounds.min()[a] <= 0)
+                        continue;
+                    for (size_t i = b; i < e; ++i)
+                    {
+                        Bin& bin = out[a * binCount + binIndex(primitives[i], a)];
+                        bin.box = bin.count == 0 ? primitives[i].box : surroundingBox(bin.box, primitives[i].box);
+                        ++bin.count;
+                    }
+                }
+            };
+            if (runParallel(count))
+            {
+                std::mutex mergeMutex;
+                pool->parallelFor(start, end, options.parallelThreshold, [&](size_t b, size_t e)
+                {
+                    std::vector<Bin> local(3 * binCount);
+                    fillBins(b, e, local);
+                    std::lock_guard<std::mutex> lock(mergeMutex);
+                    for (size_t k = 0; k < local.size(); ++k)
+                    {
+                        if (local[k].count == 0)
+                            continue;
+                        bins[k].box = bins[k].count == 0 ? local[k].box : surroundingBox(bins[k].box, local[k].box);
+                        bins[k].count += local[k].count;
+                    }
+                });
+            }
+            else
+                fillBins(start, end, bins);
+
+            int bestAxis = -1;
+            int bestSplit = 0;
+            double bestCost = Utils::infinity;
+            std::vector<double> rightArea(binCount);
+            std::vector<size_t> rightCount(binCount);
+            for (int a = 0; a < 3; ++a)
+            {
+                if (centroidBounds.max()[a] - centroidBounds.min()[a] <= 0)
+                    continue;
+                const Bin* axisBins = &bins[a * binCount];
+
+                //Sweep from the right to get the area and count of everything above each split plane
+                AABB accum;
+                size_t accumCount = 0;
+                for (int b = binCount - 1; b > 0; --b)
+                {
+                    if (axisBins[b].count > 0)
+                    {
+                        accum = accumCount == 0 ? axisBins[b].box : surroundingBox(accum, axisBins[b].box);
+                        accumCount += axisBins[b].count;
+                    }
+                    rightArea[b] = accumCount > 0 ? accum.surfaceArea() : 0.0;
+                    rightCount[b] = accumCount;
+                }
+
+                accumCount = 0;
+                for (int split = 1; split < binCount; ++split)
+                {
+                    const Bin& bin = axisBins[split - 1];
+                    if (bin.count > 0)
+                    {
+                        accum = accumCount == 0 ? bin.box : surroundingBox(accum, bin.box);
+                        accumCount += bin.count;
+                    }
+                    if (accumCount == 0 || rightCount[split] == 0)
+                        continue;
+                    double cost = options.traversalCost + options.intersectionCost *
+                        (accum.surfaceArea() * accumCount + rightArea[split] * rightCount[split]) / parentArea;
+                    if (cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestAxis = a;
+                        bestSplit = split;
+                    }
+                }
+            }
+
+            const double leafCost = options.intersectionCost * count;
+            if (count <= static_cast<size_t>(std::max(1, options.maxLeafSize)) && (bestAxis < 0 || leafCost <= bestCost))
+                return false;
+
+            if (bestAxis < 0)
+            {
+                mid = start + count / 2; //all centroids coincide, any split is as good as another
+                return true;
+            }
+
+            axis = bestAxis;
+            auto it = std::partition(primitives.begin() + start, primitives.begin() + end, [&](const BvhPrimitive& p)
+            {
+                return binIndex(p, bestAxis) < bestSplit;
+            });
+            mid = it - primitives.begin();
+            return true;
+        }
+
+        inline bool BvhBuilder::partitionMorton(std::vector<BvhPrimitive>& primitives, size_t start, size_t end, size_t& mid, int& axis)
+        {
+            const size_t count = end - start;
+            if (count <= static_cast<size_t>(std::max(1, options.maxLeafSize)))
+                return false;
+
+            const uint32_t first = primitives[start].mortonCode;
+            const uint32_t last = primitives[end - 1].mortonCode;
+            if (first == last)
+            {
+                mid = start + count / 2;
+                return true;
+            }
+
+            //The range is sorted and shares every bit above the highest differing one
+            int bit = 31;
+            while (!(((first ^ last) >> bit) & 1u))
+                --bit;
+            const uint32_t mask = 1u << bit;
+            auto it = std::partition_point(primitives.begin() + start, primitives.begin() + end,
+                [mask](const BvhPrimitive& p) { return (p.mortonCode & mask) == 0; });
+            mid = it - primitives.begin();
+            axis = 2 - bit % 3; //codes interleave as ...xyzxyz
+            return true;
+        }
+
+        inline void BvhBuilder::assignMortonCodes(std::vector<BvhPrimitive>& primitives)
+        {
+            AABB bounds, centroidBounds;
+            computeBounds(primitives, 0, primitives.size(), bounds, centroidBounds);
+            const GRay::Math::Vec3 extent = centroidBounds.max() - centroidBounds.min();
+
+            auto assign = [&](size_t b, size_t e)
+            {
+                for (size_t i = b; i < e; ++i)
+                {
+                    uint32_t cell[3];
+                    for (int a = 0; a < 3; ++a)
+                    {
+                        double offset = extent[a] > 0 ? (primitives[i].centroid[a] - centroidBounds.min()[a]) / extent[a] : 0.0;
+                        cell[a] = static_cast<uint32_t>(std::min(std::max(offset * 1024.0, 0.0), 1023.0));
+                    }
+                    primitives[i].mortonCode = (expandBits(cell[0]) << 2) | (expandBits(cell[1]) << 1) | expandBits(cell[2]);
+                }
+            };
+            if (runParallel(primitives.size()))
+                pool->parallelFor(0, primitives.size(), options.parallelThreshold, assign);
+            else
+                assign(0, primitives.size());
+        }
+
+        inline void BvhBuilder::sortByMortonCode(std::vector<BvhPrimitive>& primitives)
+        {
+            auto byCode = [](const BvhPrimitive& a, const BvhPrimitive& b) { return a.mortonCode < b.mortonCode; };
+            const size_t n = primitives.size();
+            if (!runParallel(n))
+            {
+                std::sort(primitives.begin(), primitives.end(), byCode);
+                return;
+            }
+
+            //Sort equal chunks in parallel, then merge neighbouring runs pairwise
+            size_t chunks = 1;
+            while (chunks < pool->size() + 1 && n / (2 * chunks) >= options.parallelThreshold)
+                chunks *= 2;
+            std::vector<size_t> bounds(chunks + 1);
+            for (size_t c = 0; c <= chunks; ++c)
+                bounds[c] = n * c / chunks;
+
+            std::vector<std::future<void> > pending;
+            for (size_t c = 0; c < chunks; ++c)
+                pending.push_back(pool->submit([&, c] { std::sort(primitives.begin() + bounds[c], primitives.begin() + bounds[c + 1], byCode); }));
+            for (std::future<void>& task : pending)
+                pool->waitFor(task);
+
+            for (size_t width = 1; width < chunks; width *= 2)
+            {
+                pending.clear();
+                for (size_t c = 0; c + width < chunks; c += 2 * width)
+                {
+                    size_t b = bounds[c], m = bounds[c + width], e = bounds[std::min(c + 2 * width, chunks)];
+                    pending.push_back(pool->submit([&, b, m, e]
+                    {
+                        std::inplace_merge(primitives.begin() + b, primitives.begin() + m, primitives.begin() + e, byCode);
+                    }));
+                }
+                for (std::future<void>& task : pending)
+                    pool->waitFor(task);
+            }
+        }
+    }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/bvh.h>
+#include <algorithm>
+#include <cstdint>
+
+namespace GRay
+{
+    namespace Solids
+    {
+        struct BvhStats
+        {
+            BvhStats() : sahCost{ 0 }, nodes{ 0 }, primitiveRefs{ 0 }, maxDepth{ 0 } {}
+
+            double sahCost;       //expected cost of a random ray, normalized by the root area
+            size_t nodes;
+            size_t primitiveRefs; //a primitive stored twice in a node counts twice
+            size_t maxDepth;
+        };
+
+        struct TraversalCounters
+        {
+            TraversalCounters() : rays{ 0 }, nodesVisited{ 0 }, primitivesTested{ 0 } {}
+
+            uint64_t rays;
+            uint64_t nodesVisited;
+            uint64_t primitivesTested;
+        };
+
+        namespace Detail
+        {
+            inline size_t leafPrimitiveCount(const GRay::Math::Hittable& object)
+            {
+                auto list = dynamic_cast<const GRay::Math::HittableList*>(&object);
+                return list ? list->objects.size() : 1;
+            }
+
+            inline void accumulateBvhStats(const BvhNode& node, size_t depth, const BvhBuildOptions& costs, BvhStats& stats)
+            {
+                ++stats.nodes;
+                stats.maxDepth = std::max(stats.maxDepth, depth);
+                double area = node.box.surfaceArea();
+                stats.sahCost += costs.traversalCost * area;
+                const GRay::Math::Hittable* children[2] = { node.left.get(), node.right.get() };
+                for (const GRay::Math::Hittable* child : children)
+                {
+                    if (!child)
+                        continue;
+                    if (auto inner = dynamic_cast<const BvhNode*>(child))
+                        accumulateBvhStats(*inner, depth + 1, costs, stats);
+                    else
+                    {
+                        size_t count = leafPrimitiveCount(*child);
+                        stats.primitiveRefs += count;
+                        stats.sahCost += costs.intersectionCost * count * area;
+                    }
+                }
+            }
+        }
+
+        // Walks the tree and evaluates its SAH cost with the given cost constants.
+        inline BvhStats computeBvhStats(const BvhNode& root, const BvhBuildOptions& costs = BvhBuildOptions())
+        {
+            BvhStats stats;
+            Detail::accumulateBvhStats(root, 1, costs, stats);
+            double rootArea = root.box.surfaceArea();
+            stats.sahCost = rootArea > 0 ? stats.sahCost / rootArea : 0;
+            return stats;
+        }
+
+        // Same traversal as BvhNode::hit, counting node visits and primitive tests.
+        inline bool countedHit(const BvhNode& node, const GRay::Math::Ray& r, double t_min, double t_max,
+            GRay::Math::hitRecord& rec, TraversalCounters& counters)
+        {
+            ++counters.nodesVisited;
+            if (!node.left || !node.box.hit(r, t_min, t_max))
+                return false;
+
+            bool hitAnything = false;
+            const GRay::Math::Hittable* children[2] = { node.left.get(), node.right.get() };
+            for (const GRay::Math::Hittable* child : children)
+            {
+                if (!child)
+                    continue;
+                bool hitChild;
+                if (auto inner = dynamic_cast<const BvhNode*>(child))
+                    hitChild = countedHit(*inner, r, t_min, t_max, rec, counters);
+                else
+                {
+                    counters.primitivesTested += Detail::leafPrimitiveCount(*child);
+                    hitChild = child->hit(r, t_min, t_max, rec);
+                }
+                if (hitChild)
+                {
+                    hitAnything = true;
+                    t_max = rec.t;
+                }
+            }
+            return hitAnything;
+        }
+    }
+}
@@ -25,16 +25,29 @@ namespace GRay
             vertical = focusDist * viewportHeight * v;
             lowerLeftCorner = origin - horizontal / 2 - vertical / 2 - focusDist * w;
 
+            viewportAngle = viewportHeight;
             lensRadius = apperture / 2;
             time0 = _time0;
             time1 = _time1;
         }
 
-        Ray getRay(double s, double t) const
+        Ray getRay(double s, double t, Utils::Random& rng) const
         {
-            Vec3 rd = lensRadius * randomInUnitDisc();
+            Vec3 rd = lensRadius * randomInUnitDisc(rng);
             Vec3 offset = u * rd.x() + v * rd.y();
-            return Ray(origin + offset, lowerLeftCorner + s*horizontal + t*vertical - origin - offset, Utils::randomDouble(time0, time1));
+            double time = rng.nextDouble(time0, time1);
+            return Ray(origin + offset, lowerLeftCorner + s*horizontal + t*vertical - origin - offset, time);
+        }
+
+        Ray getRay(double s, double t) const
+        {
+            return getRay(s, t, Utils::threadRandom());
+        }
+
+        // Angle subtended by one pixel row, the spread of the camera's ray cones.
+        double pixelSpread(int imageHeight) const
+        {
+            return atan(viewportAngle / imageHeight);
         }
     private:
         Point3 origin;
@@ -43,6 +56,7 @@ namespace GRay
         Vec3 vertical;
         Vec3 u, v, w;
         double lensRadius;
+        double viewportAngle; //viewport height at unit distance
         double time0, time1; //shutter open/close times
     };
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <GRay/hittable.hpp>
 #include <GRay/material.hpp>
 #include <GRay/texture.hpp>
+#include <cstring>
 
 using namespace GRay;
 
@@ -14,34 +15,57 @@ namespace GRay
         class ConstantMedium : public Math::Hittable
         {
         public:
-            ConstantMedium(shared_ptr<Math::Hittable> b, double d, shared_ptr<Materials::Texture> a) :
-                boundary{ b }, negInvDensity{ -1 / d }, phaseFunction(make_shared<Materials::Isotropic>(a)) {}
+            ConstantMedium(shared_ptr<Math::Hittable> b, double d, shared_ptr<const Materials::Texture> a) :
+                boundary{ b }, negInvDensity{ -1 / d }, phaseFunction{ MaterialRegistry::current().add(make_shared<Materials::Isotropic>(a)) } {}
             ConstantMedium(shared_ptr<Math::Hittable> b, double d, Math::Color c) :
-                boundary{ b }, negInvDensity{ -1 / d }, phaseFunction(make_shared<Materials::Isotropic>(c)) {}
+                boundary{ b }, negInvDensity{ -1 / d }, phaseFunction{ MaterialRegistry::current().add(make_shared<Materials::Isotropic>(c)) } {}
             bool hit(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const override;
+            // Same free-flight decision as hit(), so shadow rays see exactly what scattered rays see.
+            bool occluded(const Math::Ray& r, double t_min, double t_max) const override
+            {
+                double t;
+                return scatterDistance(r, t_min, t_max, t);
+            }
             bool boundingBox(double time0, double time1, GRay::Solids::AABB& outputBox) const override
             {
                 return boundary->boundingBox(time0, time1, outputBox);
             }
         public:
             shared_ptr<Math::Hittable> boundary;
-            shared_ptr<Material> phaseFunction;
+            MaterialHandle phaseFunction;
             double negInvDensity;
+        private:
+            bool scatterDistance(const Math::Ray& r, double t_min, double t_max, double& t) const;
+            static Utils::Random segmentRandom(const Math::Ray& r, double entry);
         };
 
-        bool ConstantMedium::hit(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const
+        // hit() carries no sample stream, so the free-flight distance is drawn from a
+        // counter-based stream keyed by the ray and the entry distance. Both are already
+        // deterministic functions of (pixel, sample, bounce).
+        inline Utils::Random ConstantMedium::segmentRandom(const Math::Ray& r, double entry)
         {
-            const bool enableDebug = false;
-            const bool debugging = enableDebug && Utils::randomDouble() < 0.00001;
+            const double values[8] = { r.origin().x(), r.origin().y(), r.origin().z(),
+                                       r.direction().x(), r.direction().y(), r.direction().z(), r.time(), entry };
+            uint32_t key[4] = { 0, 0, 0, 0 };
+            for (double value : values)
+            {
+                uint32_t bits[2];
+                std::memcpy(bits, &value, sizeof(bits));
+                Utils::Random::pcg4d(key[0] ^ bits[0], key[1] ^ bits[1], key[2], key[3], key);
+            }
+            return Utils::Random(key[0], key[1], key[2]);
+        }
 
+        // Ray parameter of the sampled scattering event inside the boundary, if it falls in [t_min, t_max].
+        inline bool ConstantMedium::scatterDistance(const Math::Ray& r, double t_min, double t_max, double& t) const
+        {
             Math::hitRecord rec1, rec2;
-            if (!boundary->hit(r, -Math::infinity, Math::infinity, rec1))
+            //Only the boundary distances are needed
+            if (!boundary->intersect(r, -Math::infinity, Math::infinity, rec1))
                 return false;
-            if (!boundary->hit(r, rec1.t + 0.0001, Math::infinity, rec2))
+            if (!boundary->intersect(r, rec1.t + 0.0001, Math::infinity, rec2))
                 return false;
 
-            if (debugging) std::cerr << "\nt_min=" << rec1.t << ", t_max=" << rec2.t << '\n';
-
             if (rec1.t < t_min) rec1.t = t_min;
             if (rec2.t > t_max) rec2.t = t_max;
 
@@ -53,24 +77,34 @@ namespace GRay
 
             const auto rayLength = r.direction().length();
             const auto distanceInsideBoundary = (rec2.t - rec1.t) * rayLength;
-            const auto hitDistance = negInvDensity * log(Math::randomDouble());
+            Utils::Random rng = segmentRandom(r, rec1.t);
+            const auto hitDistance = negInvDensity * log(1.0 - rng.nextDouble());
 
             if (hitDistance > distanceInsideBoundary)
                 return false;
 
-            rec.t = rec1.t + hitDistance / rayLength;
+            t = rec1.t + hitDistance / rayLength;
+            return true;
+        }
+
+        bool ConstantMedium::hit(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const
+        {
+            const bool enableDebug = false;
+            const bool debugging = enableDebug && Utils::randomDouble() < 0.00001; //debug only, not reproducible
+
+            if (!scatterDistance(r, t_min, t_max, rec.t))
+                return false;
             rec.p = r.at(rec.t);
 
             if (debugging)
             {
-                std::cerr << "histDistance = " << hitDistance << '\n'
-                    << "rec.t = " << rec.t << '\n'
+                std::cerr << "\nrec.t = " << rec.t << '\n'
                     << "rec.p" << rec.p << '\n';
             }
 
             rec.normal = Math::Vec3(1, 0, 0);
             rec.frontFace = true;
-            rec.mat_ptr = phaseFunction;
+            rec.material = phaseFunction;
 
             return true;
         }
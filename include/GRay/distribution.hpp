@@ -0,0 +1,105 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <algorithm>
+#include <vector>
+
+namespace GRay
+{
+    namespace Utils
+    {
+        // Piecewise-constant density on [0, 1) built from n non-negative function values.
+        // An all-zero function falls back to the uniform density. Only the cdf is kept, in
+        // floats; densities are its steps, so they match what sampleContinuous() draws exactly.
+        class Distribution1D
+        {
+        public:
+            Distribution1D() : integral{ 0 } {}
+            Distribution1D(const double* f, size_t n) : Distribution1D(n, [f](size_t i) { return f[i]; }) {}
+            // Takes the values from f(i), i in [0, n), without a copy of them.
+            template <typename Function>
+            Distribution1D(size_t n, Function f) : cdf(n + 1), integral{ 0 }
+            {
+                double sum = 0;
+                cdf[0] = 0;
+                for (size_t i = 0; i < n; ++i)
+                {
+                    sum += f(i);
+                    cdf[i + 1] = static_cast<float>(sum);
+                }
+                integral = sum / n;
+                for (size_t i = 1; i < n; ++i)
+                    cdf[i] = sum > 0 ? static_cast<float>(cdf[i] / sum) : static_cast<float>(static_cast<double>(i) / n);
+                cdf[n] = 1;
+            }
+
+            size_t count() const { return cdf.empty() ? 0 : cdf.size() - 1; }
+            double functionIntegral() const { return integral; }
+
+            // Maps a uniform u to x in [0, 1); pdf is the density at x and offset its segment.
+            double sampleContinuous(double u, double& pdf, size_t& offset) const
+            {
+                offset = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+                offset = std::min(offset > 0 ? offset - 1 : 0, count() - 1);
+                double du = u - cdf[offset];
+                double width = cdf[offset + 1] - cdf[offset];
+                if (width > 0)
+                    du /= width;
+                pdf = density(offset);
+                return std::min((offset + du) / count(), 1.0 - 1e-12);
+            }
+
+            double density(size_t index) const
+            {
+                return (static_cast<double>(cdf[index + 1]) - cdf[index]) * count();
+            }
+
+        private:
+            std::vector<float> cdf;
+            double integral;
+        };
+
+        // Piecewise-constant density on [0, 1)^2 over a width x height grid stored row by row:
+        // a marginal density picks the row, the row's conditional density the column.
+        class Distribution2D
+        {
+        public:
+            Distribution2D() {}
+            Distribution2D(const double* f, size_t width, size_t height) :
+                Distribution2D(width, height, [f, width](size_t x, size_t y) { return f[y * width + x]; }) {}
+            // Takes the values from f(x, y) one row at a time, without a copy of the grid.
+            template <typename Function>
+            Distribution2D(size_t width, size_t height, Function f)
+            {
+                conditional.reserve(height);
+                std::vector<double> rowIntegrals(height);
+                for (size_t y = 0; y < height; ++y)
+                {
+                    conditional.emplace_back(width, [&f, y](size_t x) { return f(x, y); });
+                    rowIntegrals[y] = conditional.back().functionIntegral();
+                }
+                marginal = Distribution1D(rowIntegrals.data(), height);
+            }
+
+            void sampleContinuous(double u1, double u2, double& x, double& y, double& pdf) const
+            {
+                double pdfX, pdfY;
+                size_t row, column;
+                y = marginal.sampleContinuous(u2, pdfY, row);
+                x = conditional[row].sampleContinuous(u1, pdfX, column);
+                pdf = pdfX * pdfY;
+            }
+
+            double pdf(double x, double y) const
+            {
+                size_t column = std::min(static_cast<size_t>(Utils::clamp(x, 0.0, 1.0) * conditional[0].count()), conditional[0].count() - 1);
+                size_t row = std::min(static_cast<size_t>(Utils::clamp(y, 0.0, 1.0) * marginal.count()), marginal.count() - 1);
+                return marginal.density(row) * conditional[row].density(column);
+            }
+
+        private:
+            std::vector<Distribution1D> conditional;
+            Distribution1D marginal;
+        };
+    }
+}
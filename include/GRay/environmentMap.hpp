@@ -0,0 +1,229 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/threadPool.hpp>
+#include <GRay/texelFormat.hpp>
+#include <GRay/distribution.hpp>
+#include <cmath>
+#include <functional>
+#include <future>
+#include <vector>
+
+namespace GRay
+{
+    namespace Solids
+    {
+        enum class BackgroundProjection
+        {
+            Equirect,   //look up the lat-long texture directly (acos + atan2 per ray)
+            CubeMap,    //six square faces, picked by the major axis of the direction
+            Octahedral  //one square, the sphere projected onto an octahedron and unfolded
+        };
+
+        // Radiance over all directions resampled into a cube map or an octahedral map, so a
+        // lookup costs a few compares and one divide instead of inverse trigonometry.
+        // Lookups return the nearest texel; directions need not be normalized. Texels are
+        // importance sampled in proportion to luminance times solid angle, again without
+        // trigonometry.
+        class EnvironmentMap
+        {
+        public:
+            // radiance(direction) is evaluated once per texel centre, from several threads at once;
+            // resolution is the cube face or octahedral square size in texels. Texels are stored
+            // as format.
+            EnvironmentMap(BackgroundProjection projection, int resolution, const std::function<Math::Color(const Math::Vec3&)>& radiance,
+                Materials::TexelFormat format = Materials::TexelFormat::Float32)
+                : projection{ projection }, size{ std::max(resolution, 1) }, format{ format }, stride{ Materials::texelBytes(format) }
+            {
+                int faces = projection == BackgroundProjection::CubeMap ? 6 : 1;
+                int rows = faces * size;
+                texels.resize(static_cast<size_t>(rows) * size * stride);
+
+                Utils::ThreadPool pool;
+                std::vector<std::future<void> > pending;
+                int chunk = std::max(rows / static_cast<int>(pool.size() * 8), 1);
+                for (int first = 0; first < rows; first += chunk)
+                    pending.push_back(pool.submit([&, first]
+                    {
+                        for (int row = first; row < std::min(first + chunk, rows); ++row)
+                            fillRow(row / size, row % size, radiance);
+                    }));
+                for (std::future<void>& done : pending)
+                    done.get();
+
+                //Rows of all faces stacked, top to bottom
+                distribution = Utils::Distribution2D(size, rows, [&](size_t i, size_t row)
+                {
+                    int face = static_cast<int>(row) / size, j = static_cast<int>(row) % size;
+                    double s = (i + 0.5) / size, t = (j + 0.5) / size;
+                    Math::Vec3 p = projection == BackgroundProjection::CubeMap ? cubeDirection(face, s, t) : octahedralDirection(s, t);
+                    return std::max(Math::luminance(texel(face, static_cast<int>(i), j)), 0.0) / areaPerSolidAngle(p);
+                });
+            }
+
+            Math::Color value(const Math::Vec3& direction) const
+            {
+                int face, i, j;
+                double s, t;
+                locate(direction, face, s, t, i, j);
+                return texel(face, i, j);
+            }
+
+            // Direction with probability density pdf per unit solid angle, from uniform u1, u2.
+            bool sample(double u1, double u2, Math::Vec3& direction, Math::Color& radiance, double& pdf) const
+            {
+                double x, y, imagePdf;
+                distribution.sampleContinuous(u1, u2, x, y, imagePdf);
+                int faces = projection == BackgroundProjection::CubeMap ? 6 : 1;
+                double row = y * faces;
+                int face = std::min(static_cast<int>(row), faces - 1);
+                Math::Vec3 p = projection == BackgroundProjection::CubeMap ? cubeDirection(face, x, row - face) : octahedralDirection(x, row - face);
+                if (imagePdf <= 0)
+                    return false;
+                direction = Math::unitVector(p);
+                radiance = value(direction);
+                pdf = imagePdf * areaPerSolidAngle(p) / (faces * 4);
+                return true;
+            }
+
+            // Solid angle density of sample() for direction.
+            double pdf(const Math::Vec3& direction) const
+            {
+                int face, i, j;
+                double s, t;
+                locate(direction, face, s, t, i, j);
+                int faces = projection == BackgroundProjection::CubeMap ? 6 : 1;
+                Math::Vec3 p = projection == BackgroundProjection::CubeMap ? cubeDirection(face, s, t) : octahedralDirection(s, t);
+                double imagePdf = distribution.pdf((i + 0.5) / size, (static_cast<double>(face) * size + j + 0.5) / (faces * size));
+                return imagePdf * areaPerSolidAngle(p) / (faces * 4);
+            }
+
+            size_t memoryBytes() const { return texels.size(); }
+
+        private:
+            void locate(const Math::Vec3& direction, int& face, double& s, double& t, int& i, int& j) const
+            {
+                face = 0;
+                if (projection == BackgroundProjection::CubeMap)
+                    cubeCoordinates(direction, face, s, t);
+                else
+                    octahedralCoordinates(direction, s, t);
+                i = std::min(static_cast<int>(s * size), size - 1);
+                j = std::min(static_cast<int>(t * size), size - 1);
+            }
+
+            Math::Color texel(int face, int i, int j) const
+            {
+                float c[3];
+                Materials::decodeTexel(format, &texels[((static_cast<size_t>(face) * size + j) * size + i) * stride], c);
+                return Math::Color(c[0], c[1], c[2]);
+            }
+
+            // Map area per unit solid angle at p, a point on the cube (max norm 1) or the
+            // octahedron (L1 norm 1), for faces spanning [-1, 1]^2: |p|^3. A cube face or the
+            // octahedral square spans 4 such units, so densities over the image divide by faces * 4.
+            static double areaPerSolidAngle(const Math::Vec3& p)
+            {
+                double length = p.length();
+                return length * length * length;
+            }
+
+            void fillRow(int face, int j, const std::function<Math::Color(const Math::Vec3&)>& radiance)
+            {
+                for (int i = 0; i < size; ++i)
+                {
+                    double s = (i + 0.5) / size;
+                    double t = (j + 0.5) / size;
+                    Math::Vec3 direction = projection == BackgroundProjection::CubeMap ? cubeDirection(face, s, t) : octahedralDirection(s, t);
+                    Math::Color c = radiance(Math::unitVector(direction));
+                    const float rgb[3] = { static_cast<float>(c[0]), static_cast<float>(c[1]), static_cast<float>(c[2]) };
+                    Materials::encodeTexel(format, rgb, &texels[((static_cast<size_t>(face) * size + j) * size + i) * stride]);
+                }
+            }
+
+            // Faces +x, -x, +y, -y, +z, -z; s, t in [0, 1].
+            static void cubeCoordinates(const Math::Vec3& d, int& face, double& s, double& t)
+            {
+                double ax = std::fabs(d.x()), ay = std::fabs(d.y()), az = std::fabs(d.z());
+                double major, sc, tc;
+                if (ax >= ay && ax >= az)
+                {
+                    face = d.x() >= 0 ? 0 : 1;
+                    major = ax;
+                    sc = d.x() >= 0 ? -d.z() : d.z();
+                    tc = -d.y();
+                }
+                else if (ay >= az)
+                {
+                    face = d.y() >= 0 ? 2 : 3;
+                    major = ay;
+                    sc = d.x();
+                    tc = d.y() >= 0 ? d.z() : -d.z();
+                }
+                else
+                {
+                    face = d.z() >= 0 ? 4 : 5;
+                    major = az;
+                    sc = d.z() >= 0 ? d.x() : -d.x();
+                    tc = -d.y();
+                }
+                double inverse = major > 0 ? 0.5 / major : 0;
+                s = Utils::clamp(sc * inverse + 0.5, 0.0, 1.0);
+                t = Utils::clamp(tc * inverse + 0.5, 0.0, 1.0);
+            }
+
+            static Math::Vec3 cubeDirection(int face, double s, double t)
+            {
+                double sc = 2 * s - 1, tc = 2 * t - 1;
+                switch (face)
+                {
+                case 0: return Math::Vec3(1, -tc, -sc);
+                case 1: return Math::Vec3(-1, -tc, sc);
+                case 2: return Math::Vec3(sc, 1, tc);
+                case 3: return Math::Vec3(sc, -1, -tc);
+                case 4: return Math::Vec3(sc, -tc, 1);
+                default: return Math::Vec3(-sc, -tc, -1);
+                }
+            }
+
+            // Upper hemisphere (y >= 0) in the inner diamond, the lower one folded to the corners.
+            static void octahedralCoordinates(const Math::Vec3& d, double& s, double& t)
+            {
+                double norm = std::fabs(d.x()) + std::fabs(d.y()) + std::fabs(d.z());
+                double inverse = norm > 0 ? 1 / norm : 0;
+                double x = d.x() * inverse, z = d.z() * inverse;
+                if (d.y() < 0)
+                {
+                    double fx = (1 - std::fabs(z)) * (x >= 0 ? 1 : -1);
+                    double fz = (1 - std::fabs(x)) * (z >= 0 ? 1 : -1);
+                    x = fx;
+                    z = fz;
+                }
+                s = Utils::clamp(0.5 * x + 0.5, 0.0, 1.0);
+                t = Utils::clamp(0.5 * z + 0.5, 0.0, 1.0);
+            }
+
+            static Math::Vec3 octahedralDirection(double s, double t)
+            {
+                double x = 2 * s - 1, z = 2 * t - 1;
+                double y = 1 - std::fabs(x) - std::fabs(z);
+                if (y < 0)
+                {
+                    double fx = (1 - std::fabs(z)) * (x >= 0 ? 1 : -1);
+                    double fz = (1 - std::fabs(x)) * (z >= 0 ? 1 : -1);
+                    x = fx;
+                    z = fz;
+                }
+                return Math::Vec3(x, y, z);
+            }
+
+        private:
+            BackgroundProjection projection;
+            int size;
+            Materials::TexelFormat format;
+            size_t stride; //bytes per texel
+            std::vector<uint8_t> texels; //faces, then rows top to bottom, RGB
+            Utils::Distribution2D distribution;
+        };
+    }
+}
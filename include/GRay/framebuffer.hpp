@@ -0,0 +1,37 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/color.hpp>
+#include <iostream>
+#include <vector>
+
+namespace GRay
+{
+    namespace Rendering
+    {
+        // Accumulated (not yet averaged) radiance per pixel, stored top row first.
+        class Framebuffer
+        {
+        public:
+            Framebuffer() : width{ 0 }, height{ 0 } {}
+            Framebuffer(int w, int h) : width{ w }, height{ h }, pixels(static_cast<size_t>(w) * h) {}
+
+            int getWidth() const { return width; }
+            int getHeight() const { return height; }
+
+            Math::Color& at(int x, int y) { return pixels[static_cast<size_t>(y) * width + x]; }
+            const Math::Color& at(int x, int y) const { return pixels[static_cast<size_t>(y) * width + x]; }
+
+            void writePPM(std::ostream& out, int samplesPerPixel) const
+            {
+                out << "P3\n" << width << ' ' << height << "\n255\n";
+                for (const Math::Color& pixel : pixels)
+                    Colors::writeColor(out, pixel, samplesPerPixel);
+            }
+
+        private:
+            int width, height;
+            std::vector<Math::Color> pixels;
+        };
+    }
+}
@@ -2,31 +2,48 @@
 
 #include <GRay/rtweekend.hpp>
 #include <GRay/aabb.h>
-
-namespace GRay
-{
-    class Material;
-}
+#include <GRay/materialRegistry.hpp>
 
 namespace GRay
 {
     namespace Math
     {
+        class Hittable;
+
         struct hitRecord
         {
             Point3 p;
             Vec3 normal;
-            shared_ptr<GRay::Material> mat_ptr;
+            MaterialHandle material = invalidMaterial; //index into the scene's MaterialRegistry
             double t;
             double u;
             double v;
             bool frontFace;
+            const Hittable* object = nullptr; //primitive that produced the hit, set by intersect()
+            uint32_t primitive = 0; //element of object that was hit, for objects made of many (SphereSet)
+            const Hittable* instanced = nullptr; //what was hit inside a transformed instance, when object is an InstanceBvh
+            uint32_t instance = 0;               //which instance of that InstanceBvh
+            double uvDensity = 0;   //texture coordinate units per world unit, 0 when not textured
+            double uvFootprint = 0; //ray cone width at p in texture coordinates, for filtering
 
             inline void setFaceNormal(const Ray& r, const Vec3& outwardNormal)
             {
                 frontFace = dot(r.direction(), outwardNormal) < 0;
                 normal = frontFace ? outwardNormal : -outwardNormal;
             }
+
+            const GRay::Material* materialPtr(const MaterialRegistry& materials) const { return materials.get(material); }
+        };
+
+        // Point picked on an emitter for next-event estimation.
+        struct SurfaceSample
+        {
+            Point3 p;
+            Vec3 normal;
+            double u;
+            double v;
+            MaterialHandle material;
+            double pdf; //per unit solid angle, as seen from the shading point
         };
 
         class Hittable
@@ -34,6 +51,41 @@ namespace GRay
         public:
             virtual bool hit(const Ray& r, double t_min, double t_max, hitRecord& rec) const = 0;
             virtual bool boundingBox(double time0, double time1, GRay::Solids::AABB& outputBox) const = 0;
+            // Any-hit query for shadow and visibility rays: may stop at the first intersection
+            // in [t_min, t_max] and fills no hitRecord.
+            virtual bool occluded(const Ray& r, double t_min, double t_max) const
+            {
+                hitRecord rec;
+                return intersect(r, t_min, t_max, rec);
+            }
+
+            // Two-phase closest hit. intersect() only has to set rec.t and rec.object; the
+            // rest of the record is filled by rec.object->finalizeHit() once the closest hit
+            // is known. Objects that do all the work in hit() keep these defaults.
+            virtual bool intersect(const Ray& r, double t_min, double t_max, hitRecord& rec) const
+            {
+                if (!hit(r, t_min, t_max, rec))
+                    return false;
+                rec.object = this;
+                return true;
+            }
+            virtual void finalizeHit(const Ray& r, hitRecord& rec) const {}
+
+            // Samples a point on the surface as seen from origin, for shapes that can be used
+            // as lights. Returns false when the shape cannot be sampled or has no visible area.
+            virtual bool sampleSurface(const Point3& origin, Utils::Random& rng, SurfaceSample& sample) const { return false; }
+            // Solid angle density with which sampleSurface() picks the point of rec, a hit on this object.
+            virtual double surfacePdf(const Point3& origin, const hitRecord& rec) const { return 0; }
+
+        protected:
+            // hit() for objects that implement intersect() and finalizeHit().
+            bool intersectAndFinalize(const Ray& r, double t_min, double t_max, hitRecord& rec) const
+            {
+                if (!intersect(r, t_min, t_max, rec))
+                    return false;
+                rec.object->finalizeHit(r, rec);
+                return true;
+            }
         };
 
         class Translate : public Hittable
@@ -41,6 +93,10 @@ namespace GRay
         public:
             Translate(shared_ptr<Hittable> p, Math::Vec3 displacement) : ptr{ p }, offset{ displacement } {}
             bool hit(const Ray& r, double t_min, double t_max, hitRecord& rec) const override;
+            bool occluded(const Ray& r, double t_min, double t_max) const override
+            {
+                return ptr->occluded(Math::Ray(r.origin() - offset, r.direction(), r.time()), t_min, t_max);
+            }
             bool boundingBox(double time0, double time1, GRay::Solids::AABB& outputBox) const override;
         public:
             shared_ptr<Hittable> ptr;
@@ -52,6 +108,10 @@ namespace GRay
         public:
             RotateY(shared_ptr<Hittable> p, double angle);
             bool hit(const Ray& r, double t_min, double t_max, hitRecord& rec) const override;
+            bool occluded(const Ray& r, double t_min, double t_max) const override
+            {
+                return ptr->occluded(toObjectSpace(r), t_min, t_max);
+            }
             bool boundingBox(double time0, double time1, GRay::Solids::AABB& outputBox) const override
             {
                 outputBox = bbox;
@@ -63,6 +123,8 @@ namespace GRay
             double cosTheta;
             bool hasBox;
             Solids::AABB bbox;
+        private:
+            Ray toObjectSpace(const Ray& r) const;
         };
 
         bool Translate::hit(const Ray& r, double t_min, double t_max, hitRecord& rec) const
@@ -71,7 +133,6 @@ namespace GRay
             if (!ptr->hit(movedRay, t_min, t_max, rec))
                 return false;
             rec.p += offset;
-            rec.setFaceNormal(movedRay, rec.normal);
             return true;
         }
 
@@ -114,7 +175,7 @@ namespace GRay
             bbox = Solids::AABB(min, max);
         }
 
-        bool RotateY::hit(const Ray& r, double t_min, double t_max, hitRecord& rec) const
+        inline Ray RotateY::toObjectSpace(const Ray& r) const
         {
             auto origin = r.origin();
             auto direction = r.direction();
@@ -124,7 +185,12 @@ namespace GRay
             direction[0] = cosTheta * r.direction()[0] - sinTheta * r.direction()[2];
             direction[2] = sinTheta * r.direction()[0] + cosTheta * r.direction()[2];
 
-            Math::Ray rotatedRay(origin, direction, r.time());
+            return Math::Ray(origin, direction, r.time());
+        }
+
+        bool RotateY::hit(const Ray& r, double t_min, double t_max, hitRecord& rec) const
+        {
+            Math::Ray rotatedRay = toObjectSpace(r);
             if (!ptr->hit(rotatedRay, t_min, t_max, rec))
                 return false;
 
@@ -137,7 +203,8 @@ namespace GRay
             normal[2] = -sinTheta * rec.normal[0] + cosTheta * rec.normal[2];
 
             rec.p = p;
-            rec.setFaceNormal(rotatedRay, normal);
+            //Already facing the ray; setFaceNormal() again would lose frontFace
+            rec.normal = normal;
             return true;
         }
     }
@@ -17,25 +17,41 @@ namespace GRay
 
             void clear() { objects.clear(); }
             void add(std::shared_ptr<Hittable> object) { objects.push_back(object); }
-            bool hit(const Ray& r, double t_min, double t_max, hitRecord& rec) const override;
+            bool hit(const Ray& r, double t_min, double t_max, hitRecord& rec) const override
+            {
+                return intersectAndFinalize(r, t_min, t_max, rec);
+            }
+            bool intersect(const Ray& r, double t_min, double t_max, hitRecord& rec) const override;
             bool boundingBox(double time0, double time1, GRay::Solids::AABB& outputBox) const override;
+            bool occluded(const Ray& r, double t_min, double t_max) const override
+            {
+                for (const std::shared_ptr<Hittable>& object : objects)
+                    if (object->occluded(r, t_min, t_max))
+                        return true;
+                return false;
+            }
+            // Registry the hit records of this scene resolve their materials in.
+            const MaterialRegistry& materialRegistry() const { return materials ? *materials : MaterialRegistry::global(); }
+
         public:
             std::vector<std::shared_ptr<Hittable> > objects;
+            // Materials of the scene, for the list that holds a whole scene; null while they
+            // are in MaterialRegistry::global().
+            std::shared_ptr<MaterialRegistry> materials;
         };
 
-        bool HittableList::hit(const Ray& r, double t_min, double t_max, hitRecord& rec) const
+        inline bool HittableList::intersect(const Ray& r, double t_min, double t_max, hitRecord& rec) const
         {
-            hitRecord tmpRec;
+            //Objects only write rec when they report a closer hit, so no scratch record is needed
             bool hitAnything = false;
             double closestHitSoFar = t_max;
 
             for (const std::shared_ptr<Hittable>& object : objects)
             {
-                if (object->hit(r, t_min, closestHitSoFar, tmpRec))
+                if (object->intersect(r, t_min, closestHitSoFar, rec))
                 {
                     hitAnything = true;
-                    closestHitSoFar = tmpRec.t;
-                    rec = tmpRec;
+                    closestHitSoFar = rec.t;
                 }
             }
             return hitAnything;
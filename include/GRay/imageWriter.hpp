@@ -0,0 +1,334 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/framebuffer.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace GRay
+{
+    namespace Rendering
+    {
+        enum class ImageFormat
+        {
+            PPMAscii, //P3, what Colors::writeColor produces
+            PPM,      //P6, 8-bit binary
+            PFM,      //32-bit float, linear radiance
+            PNG       //8-bit RGB
+        };
+
+        // Accepts a format name ("p3", "ppm", "p6", "pfm", "png") or a file name ending in
+        // .ppm/.pfm/.png. Anything else selects binary PPM.
+        inline ImageFormat imageFormatFromName(std::string name)
+        {
+            std::transform(name.begin(), name.end(), name.begin(), [](char c) { return static_cast<char>(std::tolower(c)); });
+            size_t dot = name.rfind('.');
+            if (dot != std::string::npos)
+                name = name.substr(dot + 1);
+            if (name == "p3")
+                return ImageFormat::PPMAscii;
+            if (name == "pfm")
+                return ImageFormat::PFM;
+            if (name == "png")
+                return ImageFormat::PNG;
+            return ImageFormat::PPM;
+        }
+
+        namespace Detail
+        {
+            inline uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+            {
+                static uint32_t table[256];
+                static std::once_flag once;
+                std::call_once(once, []
+                {
+                    for (uint32_t n = 0; n < 256; ++n)
+                    {
+                        uint32_t c = n;
+                        for (int k = 0; k < 8; ++k)
+                            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                        table[n] = c;
+                    }
+                });
+                crc = ~crc;
+                for (size_t i = 0; i < size; ++i)
+                    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+                return ~crc;
+            }
+
+            inline uint32_t adler32(const uint8_t* data, size_t size)
+            {
+                uint32_t a = 1, b = 0;
+                while (size > 0)
+                {
+                    //5552 is the largest block that cannot overflow before the modulo
+                    size_t block = std::min<size_t>(size, 5552);
+                    size -= block;
+                    for (size_t i = 0; i < block; ++i)
+                    {
+                        a += *data++;
+                        b += a;
+                    }
+                    a %= 65521;
+                    b %= 65521;
+                }
+                return (b << 16) | a;
+            }
+
+            inline void appendBigEndian32(std::vector<uint8_t>& out, uint32_t v)
+            {
+                out.push_back(static_cast<uint8_t>(v >> 24));
+                out.push_back(static_cast<uint8_t>(v >> 16));
+                out.push_back(static_cast<uint8_t>(v >> 8));
+                out.push_back(static_cast<uint8_t>(v));
+            }
+
+            inline void appendText(std::vector<uint8_t>& out, const std::string& text)
+            {
+                out.insert(out.end(), text.begin(), text.end());
+            }
+
+            inline void appendPngChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data)
+            {
+                appendBigEndian32(out, static_cast<uint32_t>(data.size()));
+                size_t start = out.size();
+                out.insert(out.end(), type, type + 4);
+                out.insert(out.end(), data.begin(), data.end());
+                appendBigEndian32(out, crc32(&out[start], out.size() - start));
+            }
+
+            // Same mapping as Colors::writeColor: average, gamma 2, clamp, scale to 0..255.
+            inline uint8_t displayByte(double accumulated, double scale)
+            {
+                return static_cast<uint8_t>(256 * Utils::clamp(sqrt(accumulated * scale), 0.0, 0.999));
+            }
+        }
+
+        inline void encodeImage(const Framebuffer& image, int samplesPerPixel, ImageFormat format, std::vector<uint8_t>& out)
+        {
+            const int width = image.getWidth();
+            const int height = image.getHeight();
+            const double scale = 1.0 / samplesPerPixel;
+            out.clear();
+
+            switch (format)
+            {
+                case ImageFormat::PPMAscii:
+                {
+                    std::ostringstream text;
+                    image.writePPM(text, samplesPerPixel);
+                    Detail::appendText(out, text.str());
+                    break;
+                }
+                case ImageFormat::PPM:
+                {
+                    Detail::appendText(out, "P6\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n255\n");
+                    out.reserve(out.size() + static_cast<size_t>(width) * height * 3);
+                    for (int y = 0; y < height; ++y)
+                        for (int x = 0; x < width; ++x)
+                            for (int c = 0; c < 3; ++c)
+                                out.push_back(Detail::displayByte(image.at(x, y)[c], scale));
+                    break;
+                }
+                case ImageFormat::PFM:
+                {
+                    //A negative scale marks little-endian samples; rows go bottom to top
+                    const uint16_t probe = 1;
+                    const bool littleEndian = *reinterpret_cast<const uint8_t*>(&probe) == 1;
+                    Detail::appendText(out, "PF\n" + std::to_string(width) + ' ' + std::to_string(height) + (littleEndian ? "\n-1.0\n" : "\n1.0\n"));
+                    size_t offset = out.size();
+                    out.resize(offset + static_cast<size_t>(width) * height * 3 * sizeof(float));
+                    for (int y = height - 1; y >= 0; --y)
+                        for (int x = 0; x < width; ++x)
+                            for (int c = 0; c < 3; ++c)
+                            {
+                                float value = static_cast<float>(image.at(x, y)[c] * scale);
+                                std::memcpy(&out[offset], &value, sizeof(float));
+                                offset += sizeof(float);
+                            }
+                    break;
+                }
+                case ImageFormat::PNG:
+                {
+                    //Scanlines with filter type 0, wrapped in uncompressed (stored) deflate blocks
+                    std::vector<uint8_t> raw;
+                    raw.reserve(static_cast<size_t>(width * 3 + 1) * height);
+                    for (int y = 0; y < height; ++y)
+                    {
+                        raw.push_back(0);
+                        for (int x = 0; x < width; ++x)
+                            for (int c = 0; c < 3; ++c)
+                                raw.push_back(Detail::displayByte(image.at(x, y)[c], scale));
+                    }
+
+                    std::vector<uint8_t> zlib = { 0x78, 0x01 };
+                    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+                    size_t pos = 0;
+                    do
+                    {
+                        size_t block = std::min<size_t>(raw.size() - pos, 65535);
+                        zlib.push_back(pos + block == raw.size() ? 1 : 0);
+                        zlib.push_back(static_cast<uint8_t>(block));
+                        zlib.push_back(static_cast<uint8_t>(block >> 8));
+                        zlib.push_back(static_cast<uint8_t>(~block));
+                        zlib.push_back(static_cast<uint8_t>(~block >> 8));
+                        zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + block);
+                        pos += block;
+                    } while (pos < raw.size());
+                    Detail::appendBigEndian32(zlib, Detail::adler32(raw.data(), raw.size()));
+
+                    std::vector<uint8_t> header;
+                    Detail::appendBigEndian32(header, static_cast<uint32_t>(width));
+                    Detail::appendBigEndian32(header, static_cast<uint32_t>(height));
+                    header.insert(header.end(), { 8, 2, 0, 0, 0 }); //8-bit RGB, no interlace
+
+                    const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+                    out.insert(out.end(), signature, signature + 8);
+                    Detail::appendPngChunk(out, "IHDR", header);
+                    Detail::appendPngChunk(out, "IDAT", zlib);
+                    Detail::appendPngChunk(out, "IEND", std::vector<uint8_t>());
+                    break;
+                }
+            }
+        }
+
+        inline bool writeImage(std::ostream& out, const Framebuffer& image, int samplesPerPixel, ImageFormat format)
+        {
+            std::vector<uint8_t> bytes;
+            encodeImage(image, samplesPerPixel, format, bytes);
+            out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+            out.flush();
+            return static_cast<bool>(out);
+        }
+
+        // Encodes and writes images on a background thread, in submission order, so the
+        // render loop never waits on formatting or on the output stream. The destructor
+        // finishes every queued image.
+        class AsyncImageWriter
+        {
+        public:
+            AsyncImageWriter() : stopping{ false }, busy{ false }, failures{ 0 }
+            {
+                worker = std::thread([this] { writerLoop(); });
+            }
+
+            ~AsyncImageWriter()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(queueMutex);
+                    stopping = true;
+                }
+                queueCondition.notify_all();
+                worker.join();
+            }
+
+            AsyncImageWriter(const AsyncImageWriter&) = delete;
+            AsyncImageWriter& operator=(const AsyncImageWriter&) = delete;
+
+            // Takes the pixels over; the stream must outlive the write.
+            void submit(Framebuffer image, int samplesPerPixel, ImageFormat format, std::ostream& out)
+            {
+                enqueue(Job{ std::move(image), samplesPerPixel, format, &out, std::string() });
+            }
+
+            void submit(Framebuffer image, int samplesPerPixel, ImageFormat format, const std::string& path)
+            {
+                enqueue(Job{ std::move(image), samplesPerPixel, format, nullptr, path });
+            }
+
+            // Blocks until every submitted image has been written.
+            void wait()
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                idleCondition.wait(lock, [this] { return jobs.empty() && !busy; });
+            }
+
+            size_t failedWrites() const { return failures; }
+
+        private:
+            struct Job
+            {
+                Framebuffer image;
+                int samplesPerPixel;
+                ImageFormat format;
+                std::ostream* stream;
+                std::string path;
+            };
+
+            void enqueue(Job job)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(queueMutex);
+                    jobs.push_back(std::move(job));
+                }
+                queueCondition.notify_one();
+            }
+
+            void writerLoop()
+            {
+                std::vector<uint8_t> bytes;
+                while (true)
+                {
+                    Job job;
+                    {
+                        std::unique_lock<std::mutex> lock(queueMutex);
+                        queueCondition.wait(lock, [this] { return stopping || !jobs.empty(); });
+                        if (jobs.empty())
+                            return;
+                        job = std::move(jobs.front());
+                        jobs.pop_front();
+                        busy = true;
+                    }
+
+                    encodeImage(job.image, job.samplesPerPixel, job.format, bytes);
+                    bool written;
+                    if (job.stream)
+                    {
+                        job.stream->write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+                        job.stream->flush();
+                        written = static_cast<bool>(*job.stream);
+                    }
+                    else
+                    {
+                        std::ofstream file(job.path, std::ios::binary);
+                        file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+                        written = static_cast<bool>(file);
+                    }
+                    if (!written)
+                    {
+                        ++failures;
+                        std::cerr << "ERROR: Could not write image" << (job.path.empty() ? "" : " '" + job.path + "'") << ".\n";
+                    }
+
+                    {
+                        std::lock_guard<std::mutex> lock(queueMutex);
+                        busy = false;
+                    }
+                    idleCondition.notify_all();
+                }
+            }
+
+        private:
+            std::thread worker;
+            std::deque<Job> jobs;
+            std::mutex queueMutex;
+            std::condition_variable queueCondition;
+            std::condition_variable idleCondition;
+            bool stopping;
+            bool busy;
+            std::atomic<size_t> failures;
+        };
+    }
+}
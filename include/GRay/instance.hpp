@@ -0,0 +1,103 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/hittable.hpp>
+#include <GRay/transform.hpp>
+
+namespace GRay
+{
+    namespace Math
+    {
+        class Instance;
+
+        // Strips Translate, RotateY and Instance wrappers off object and returns what they wrap.
+        // Their transforms are composed onto toWorld, which then maps the returned object to
+        // where the wrappers placed it.
+        shared_ptr<Hittable> flattenTransforms(shared_ptr<Hittable> object, Transform& toWorld);
+
+        // Object under an arbitrary affine transform: one wrapper instead of a chain of
+        // Translate and RotateY, which are folded into it at construction. Shared objects can be
+        // placed many times; an InstanceBvh built over instances shares their acceleration
+        // structures as well.
+        class Instance : public Hittable
+        {
+        public:
+            Instance(shared_ptr<Hittable> p, const Transform& transform, double time0 = 0, double time1 = 1);
+
+            bool hit(const Ray& r, double t_min, double t_max, hitRecord& rec) const override;
+            bool occluded(const Ray& r, double t_min, double t_max) const override
+            {
+                return object->occluded(toObject.applyToRay(r), t_min, t_max);
+            }
+            bool boundingBox(double time0, double time1, GRay::Solids::AABB& outputBox) const override
+            {
+                outputBox = bbox;
+                return hasBox;
+            }
+
+            // Moves a hit found with toObject.applyToRay(r) into world space.
+            static void toWorldSpace(const Transform& toWorld, const Transform& toObject, hitRecord& rec)
+            {
+                rec.p = toWorld.applyToPoint(rec.p);
+                //The inverse transpose keeps the normal on the side the ray came from
+                rec.normal = unitVector(toObject.applyTransposeToVector(rec.normal));
+                rec.uvDensity /= toWorld.scale();
+            }
+
+        public:
+            shared_ptr<Hittable> object;
+            Transform toWorld;
+            Transform toObject;
+            bool hasBox;
+            Solids::AABB bbox;
+        };
+
+        inline shared_ptr<Hittable> flattenTransforms(shared_ptr<Hittable> object, Transform& toWorld)
+        {
+            for (;;)
+            {
+                shared_ptr<Hittable> inner;
+                if (const Translate* translate = dynamic_cast<const Translate*>(object.get()))
+                {
+                    toWorld = toWorld * Transform::translation(translate->offset);
+                    inner = translate->ptr;
+                }
+                else if (const RotateY* rotate = dynamic_cast<const RotateY*>(object.get()))
+                {
+                    Transform rotation;
+                    rotation.m[0][0] = rotate->cosTheta;
+                    rotation.m[0][2] = rotate->sinTheta;
+                    rotation.m[2][0] = -rotate->sinTheta;
+                    rotation.m[2][2] = rotate->cosTheta;
+                    toWorld = toWorld * rotation;
+                    inner = rotate->ptr;
+                }
+                else if (const Instance* instance = dynamic_cast<const Instance*>(object.get()))
+                {
+                    toWorld = toWorld * instance->toWorld;
+                    inner = instance->object;
+                }
+                else
+                    return object;
+                object = inner;
+            }
+        }
+
+        inline Instance::Instance(shared_ptr<Hittable> p, const Transform& transform, double time0, double time1) : toWorld{ transform }
+        {
+            object = flattenTransforms(p, toWorld);
+            toObject = toWorld.inverse();
+            hasBox = object->boundingBox(time0, time1, bbox);
+            if (hasBox)
+                bbox = toWorld.applyToBox(bbox);
+        }
+
+        inline bool Instance::hit(const Ray& r, double t_min, double t_max, hitRecord& rec) const
+        {
+            if (!object->hit(toObject.applyToRay(r), t_min, t_max, rec))
+                return false;
+            toWorldSpace(toWorld, toObject, rec);
+            return true;
+        }
+    }
+}
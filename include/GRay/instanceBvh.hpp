@@ -0,0 +1,220 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/hittable.hpp>
+#include <GRay/hittableList.hpp>
+#include <GRay/instance.hpp>
+#include <GRay/transform.hpp>
+#include <GRay/bvhBuilder.hpp>
+#include <GRay/wideBvh.hpp>
+#include <GRay/alignedAllocator.hpp>
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+namespace GRay
+{
+    namespace Solids
+    {
+        // Two-level acceleration structure. The top level is an 8-wide BVH over instances, each
+        // a 3x4 transform with its precomputed inverse and a reference to a bottom-level
+        // object that all instances of it share. Translate, RotateY and Instance chains in the
+        // input are flattened into one transform per instance, and transformed HittableLists
+        // get one Bvh8 each, however often they are placed, so n copies of an object cost one
+        // copy plus about 250 bytes each. Members without a transform pass hits through
+        // unchanged; transformed hits are moved into world space only for the closest one.
+        // Meant as the top level: InstanceBvhs in the list are merged into this one, but an
+        // InstanceBvh hidden inside another bottom-level structure is not supported.
+        class InstanceBvh : public GRay::Math::Hittable
+        {
+        public:
+            InstanceBvh() {}
+            InstanceBvh(const GRay::Math::HittableList& list, double time0, double time1,
+                const BvhBuildOptions& options = BvhBuildOptions(BvhSplitMethod::SAH));
+
+            bool hit(const GRay::Math::Ray& r, double t_min, double t_max, GRay::Math::hitRecord& rec) const override
+            {
+                return intersectAndFinalize(r, t_min, t_max, rec);
+            }
+            bool intersect(const GRay::Math::Ray& r, double t_min, double t_max, GRay::Math::hitRecord& rec) const override;
+            void finalizeHit(const GRay::Math::Ray& r, GRay::Math::hitRecord& rec) const override;
+            bool occluded(const GRay::Math::Ray& r, double t_min, double t_max) const override;
+            bool boundingBox(double time0, double time1, GRay::Solids::AABB& outputBox) const override
+            {
+                outputBox = bounds;
+                return !nodes.empty();
+            }
+
+            size_t size() const { return instances.size(); }
+            size_t bottomLevelCount() const { return bottomLevels.size(); }
+            size_t nodeCount() const { return nodes.size(); }
+            // The top level only; bottom-level objects are shared and counted once by their owners.
+            size_t memoryUsage() const
+            {
+                return nodes.size() * sizeof(WideBvhNode<8>) + instances.size() * sizeof(InstanceRecord)
+                    + bottomLevels.size() * sizeof(shared_ptr<GRay::Math::Hittable>);
+            }
+
+        private:
+            struct InstanceRecord
+            {
+                GRay::Math::Transform toWorld;
+                GRay::Math::Transform toObject;
+                uint32_t object;   //index into bottomLevels
+                bool identity;     //rays and hits need no transform
+            };
+
+            // Adds object and, for lists and InstanceBvhs at the top, their members.
+            void addInstances(const shared_ptr<GRay::Math::Hittable>& object, const GRay::Math::Transform& parent,
+                double time0, double time1, const BvhBuildOptions& options);
+            uint32_t bottomLevelIndex(const shared_ptr<GRay::Math::Hittable>& object);
+            GRay::Math::Ray objectRay(const InstanceRecord& instance, const GRay::Math::Ray& r) const
+            {
+                return instance.identity ? r : instance.toObject.applyToRay(r);
+            }
+
+        private:
+            std::vector<WideBvhNode<8>, Utils::AlignedAllocator<WideBvhNode<8>, 64> > nodes; //leaf children index instances
+            std::vector<InstanceRecord> instances; //leaf order
+            std::vector<shared_ptr<GRay::Math::Hittable> > bottomLevels;
+            std::unordered_map<const GRay::Math::Hittable*, uint32_t> bottomLevelIndices; //used while building
+            std::unordered_map<const GRay::Math::Hittable*, shared_ptr<GRay::Math::Hittable> > listBvhs; //used while building
+            AABB bounds;
+        };
+
+        inline uint32_t InstanceBvh::bottomLevelIndex(const shared_ptr<GRay::Math::Hittable>& object)
+        {
+            auto found = bottomLevelIndices.find(object.get());
+            if (found != bottomLevelIndices.end())
+                return found->second;
+            const uint32_t index = static_cast<uint32_t>(bottomLevels.size());
+            bottomLevels.push_back(object);
+            bottomLevelIndices[object.get()] = index;
+            return index;
+        }
+
+        inline void InstanceBvh::addInstances(const shared_ptr<GRay::Math::Hittable>& object, const GRay::Math::Transform& parent,
+            double time0, double time1, const BvhBuildOptions& options)
+        {
+            GRay::Math::Transform toWorld = parent;
+            shared_ptr<GRay::Math::Hittable> inner = GRay::Math::flattenTransforms(object, toWorld);
+            const bool identity = toWorld.isIdentity();
+
+            if (const InstanceBvh* nested = dynamic_cast<const InstanceBvh*>(inner.get()))
+            {
+                for (const InstanceRecord& instance : nested->instances)
+                    addInstances(nested->bottomLevels[instance.object], toWorld * instance.toWorld, time0, time1, options);
+                return;
+            }
+            if (const GRay::Math::HittableList* list = dynamic_cast<const GRay::Math::HittableList*>(inner.get()))
+            {
+                //Untransformed lists are merged into the top level
+                if (identity)
+                {
+                    for (const shared_ptr<GRay::Math::Hittable>& member : list->objects)
+                        addInstances(member, toWorld, time0, time1, options);
+                    return;
+                }
+                if (list->objects.empty())
+                    return;
+                shared_ptr<GRay::Math::Hittable>& bvh = listBvhs[list];
+                if (!bvh)
+                    bvh = make_shared<Bvh8>(*list, time0, time1, options);
+                inner = bvh;
+            }
+
+            InstanceRecord instance;
+            instance.toWorld = toWorld;
+            instance.toObject = toWorld.inverse();
+            instance.object = bottomLevelIndex(inner);
+            instance.identity = identity;
+            instances.push_back(instance);
+        }
+
+        inline InstanceBvh::InstanceBvh(const GRay::Math::HittableList& list, double time0, double time1, const BvhBuildOptions& options)
+        {
+            for (const shared_ptr<GRay::Math::Hittable>& object : list.objects)
+                addInstances(object, GRay::Math::Transform(), time0, time1, options);
+            bottomLevelIndices.clear();
+            listBvhs.clear();
+            if (instances.empty())
+                return;
+
+            BvhBuildOptions buildOptions = options;
+            if (buildOptions.maxDepth <= 0 || buildOptions.maxDepth > Detail::wideBvhMaxDepth)
+                buildOptions.maxDepth = Detail::wideBvhMaxDepth;
+            BvhBuilder builder(buildOptions);
+
+            std::vector<BvhPrimitive> primitives(instances.size());
+            for (size_t i = 0; i < instances.size(); ++i)
+            {
+                AABB box;
+                if (!bottomLevels[instances[i].object]->boundingBox(time0, time1, box))
+                    std::cerr << "No bounding box in InstanceBvh constructor.\n";
+                primitives[i].box = instances[i].toWorld.applyToBox(box);
+                primitives[i].centroid = 0.5 * (primitives[i].box.min() + primitives[i].box.max());
+                primitives[i].mortonCode = 0;
+                primitives[i].index = static_cast<uint32_t>(i);
+            }
+            std::unique_ptr<BvhBuildNode> root = builder.build(primitives);
+            bounds = root->bounds;
+
+            //Leaf order, so leaves index instances directly
+            std::vector<InstanceRecord> ordered(instances.size());
+            for (size_t i = 0; i < primitives.size(); ++i)
+                ordered[i] = instances[primitives[i].index];
+            instances.swap(ordered);
+
+            nodes.reserve(builder.nodes() / 7 + 1);
+            Detail::collapseWide<8>(*root, nodes, [](const BvhBuildNode& leaf, uint32_t& first, uint32_t& count)
+            {
+                first = static_cast<uint32_t>(leaf.start);
+                count = static_cast<uint32_t>(leaf.count());
+            });
+            builder.finish();
+        }
+
+        inline bool InstanceBvh::intersect(const GRay::Math::Ray& r, double t_min, double t_max, GRay::Math::hitRecord& rec) const
+        {
+            return Detail::wideClosestHit<8>(nodes, r, t_min, t_max, [&](uint32_t first, uint32_t count, double& tMax)
+            {
+                bool hitAnything = false;
+                for (uint32_t i = first; i < first + count; ++i)
+                {
+                    const InstanceRecord& instance = instances[i];
+                    if (!bottomLevels[instance.object]->intersect(objectRay(instance, r), t_min, tMax, rec))
+                        continue;
+                    hitAnything = true;
+                    tMax = rec.t;
+                    //Untransformed hits finalize themselves; transformed ones come back here
+                    if (!instance.identity)
+                    {
+                        rec.instanced = rec.object;
+                        rec.instance = i;
+                        rec.object = this;
+                    }
+                }
+                return hitAnything;
+            });
+        }
+
+        inline bool InstanceBvh::occluded(const GRay::Math::Ray& r, double t_min, double t_max) const
+        {
+            return Detail::wideAnyHit<8>(nodes, r, t_min, t_max, [&](uint32_t first, uint32_t count)
+            {
+                for (uint32_t i = first; i < first + count; ++i)
+                    if (bottomLevels[instances[i].object]->occluded(objectRay(instances[i], r), t_min, t_max))
+                        return true;
+                return false;
+            });
+        }
+
+        inline void InstanceBvh::finalizeHit(const GRay::Math::Ray& r, GRay::Math::hitRecord& rec) const
+        {
+            const InstanceRecord& instance = instances[rec.instance];
+            rec.instanced->finalizeHit(instance.toObject.applyToRay(r), rec);
+            GRay::Math::Instance::toWorldSpace(instance.toWorld, instance.toObject, rec);
+        }
+    }
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/hittable.hpp>
+#include <GRay/material.hpp>
+#include <GRay/background.hpp>
+#include <GRay/lightList.hpp>
+#include <GRay/renderer.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+namespace GRay
+{
+    namespace Rendering
+    {
+        // Path counts gathered by the integrator, shared by all render threads.
+        struct PathStatistics
+        {
+            std::atomic<uint64_t> paths{ 0 };
+            std::atomic<uint64_t> segments{ 0 };   //rays traced, camera ray included
+            std::atomic<uint64_t> terminated{ 0 }; //paths ended by Russian roulette
+            std::atomic<uint64_t> shadowRays{ 0 };
+
+            double averageLength() const
+            {
+                return paths == 0 ? 0.0 : static_cast<double>(segments) / paths;
+            }
+        };
+
+        struct IntegratorSettings
+        {
+            IntegratorSettings() : minDepth{ 3 }, maxDepth{ 50 }, maxSurvival{ 0.95 }, tMin{ 0.001 }, stats{ nullptr } {}
+
+            int minDepth;           //bounces before Russian roulette may end a path
+            int maxDepth;           //hard cap on rays per path, like the old recursion depth
+            double maxSurvival;     //upper bound of the continuation probability
+            double tMin;            //self-intersection offset
+            PathStatistics* stats;  //filled in when set
+        };
+
+        // Iterative unidirectional path tracer. Carries the path throughput instead of
+        // recursing, and after minDepth bounces continues a path with probability
+        // min(luminance(throughput), maxSurvival), reweighting survivors so the expected
+        // image is the same as with fixed-depth recursion.
+        // Given a LightList, non-specular hits also sample a point on a light and trace a
+        // shadow ray to it (next-event estimation). Light samples and BSDF samples that reach
+        // a listed light are combined with the power heuristic. HDRI backgrounds are sampled
+        // the same way through Background::sample().
+        inline double powerHeuristic(double pdf, double otherPdf)
+        {
+            return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+        }
+
+        class PathIntegrator
+        {
+        public:
+            // m resolves the material handles of w: the registry of the scene it was built from.
+            PathIntegrator(const Math::Hittable& w, const MaterialRegistry& m, const Solids::Background& b, const IntegratorSettings& s = IntegratorSettings()) :
+                world(w), materials(m), background(b), lights{ nullptr }, settings{ s } {}
+            PathIntegrator(const Math::Hittable& w, const MaterialRegistry& m, const Solids::Background& b, const Solids::LightList& l,
+                const IntegratorSettings& s = IntegratorSettings()) :
+                world(w), materials(m), background(b), lights{ l.empty() ? nullptr : &l }, settings{ s } {}
+
+            Math::Color radiance(const Math::Ray& cameraRay, Utils::Random& rng) const;
+
+            TileRenderer::RadianceFunction function() const
+            {
+                return [this](const Math::Ray& ray, Utils::Random& rng) { return radiance(ray, rng); };
+            }
+
+        private:
+            Math::Color sampleLight(const Math::Ray& ray, const Math::hitRecord& rec, const Material& material, Utils::Random& rng) const;
+            Math::Color sampleBackground(const Math::Ray& ray, const Math::hitRecord& rec, const Material& material, Utils::Random& rng) const;
+
+        private:
+            const Math::Hittable& world;
+            const MaterialRegistry& materials;
+            const Solids::Background& background;
+            const Solids::LightList* lights;
+            IntegratorSettings settings;
+        };
+
+        inline Math::Color PathIntegrator::radiance(const Math::Ray& cameraRay, Utils::Random& rng) const
+        {
+            Math::Color result(0, 0, 0);
+            Math::Color throughput(1, 1, 1);
+            Math::Ray ray = cameraRay;
+            int segments = 0;
+            int shadowRays = 0;
+            bool rouletteEnded = false;
+            bool specularBounce = true; //the camera ray gets no MIS weight either
+            double bsdfPdf = 0;
+            Math::Point3 previousPoint;
+
+            for (int depth = 0; depth < settings.maxDepth; ++depth)
+            {
+                ++segments;
+                Math::hitRecord rec;
+                if (!world.hit(ray, settings.tMin, Utils::infinity, rec))
+                {
+                    Math::Color radiance = background.getValue(ray);
+                    if (background.canSample() && !specularBounce)
+                        radiance *= powerHeuristic(bsdfPdf, background.pdf(ray.direction()));
+                    result += throughput * radiance;
+                    break;
+                }
+
+                //Ray cone footprint, widened by the incidence angle, for texture filtering
+                double coneWidth = ray.coneWidthAt(rec.t);
+                if (rec.uvDensity > 0)
+                {
+                    double cosine = fabs(Math::dot(Math::unitVector(ray.direction()), rec.normal));
+                    rec.uvFootprint = coneWidth / sqrt(fmax(cosine, 1e-2)) * rec.uvDensity;
+                }
+
+                const Material* material = rec.materialPtr(materials);
+                Math::Color emitted = material->emitted(rec.u, rec.v, rec.p);
+                if (lights && !specularBounce)
+                {
+                    double lightPdf = lights->pdf(previousPoint, rec);
+                    if (lightPdf > 0)
+                        emitted *= powerHeuristic(bsdfPdf, lightPdf);
+                }
+                result += throughput * emitted;
+
+                rng.setBounce(rng.bounceIndex() + 1);
+                if (!material->isSpecular())
+                {
+                    if (lights)
+                    {
+                        ++shadowRays;
+                        result += throughput * sampleLight(ray, rec, *material, rng);
+                    }
+                    if (background.canSample())
+                    {
+                        ++shadowRays;
+                        result += throughput * sampleBackground(ray, rec, *material, rng);
+                    }
+                }
+
+                BsdfSample scattered;
+                if (!material->sample(ray, rec, rng, scattered))
+                    break;
+                throughput = throughput * scattered.weight;
+                specularBounce = scattered.specular;
+                bsdfPdf = scattered.pdf;
+                previousPoint = rec.p;
+
+                if (depth + 1 >= settings.minDepth)
+                {
+                    double survival = std::min(Math::luminance(throughput), settings.maxSurvival);
+                    if (survival <= 0.0 || rng.nextDouble() >= survival)
+                    {
+                        rouletteEnded = true;
+                        break;
+                    }
+                    throughput /= survival;
+                }
+                //The cone keeps its spread through bounces; surface curvature is ignored
+                double coneSpread = ray.coneSpread;
+                ray = Math::Ray(rec.p, scattered.direction, ray.time());
+                ray.coneWidth = coneWidth;
+                ray.coneSpread = coneSpread;
+            }
+
+            if (settings.stats)
+            {
+                settings.stats->paths.fetch_add(1, std::memory_order_relaxed);
+                settings.stats->segments.fetch_add(segments, std::memory_order_relaxed);
+                settings.stats->shadowRays.fetch_add(shadowRays, std::memory_order_relaxed);
+                if (rouletteEnded)
+                    settings.stats->terminated.fetch_add(1, std::memory_order_relaxed);
+            }
+            return result;
+        }
+
+        // Direct light from one sampled light point, without the path throughput.
+        inline Math::Color PathIntegrator::sampleLight(const Math::Ray& ray, const Math::hitRecord& rec, const Material& material, Utils::Random& rng) const
+        {
+            Solids::LightSample light;
+            if (!lights->sample(rec.p, rng, light))
+                return Math::Color(0, 0, 0);
+
+            Math::Vec3 toLight = light.p - rec.p;
+            double distance = toLight.length();
+            Math::Vec3 direction = toLight / distance;
+            Math::Color f = material.eval(ray, rec, direction);
+            if (f.x() <= 0 && f.y() <= 0 && f.z() <= 0)
+                return Math::Color(0, 0, 0);
+            if (world.occluded(Math::Ray(rec.p, direction, ray.time()), settings.tMin, distance - settings.tMin))
+                return Math::Color(0, 0, 0);
+            double weight = powerHeuristic(light.pdf, material.pdf(ray, rec, direction));
+            return f * light.radiance * (weight / light.pdf);
+        }
+
+        // Background light from one sampled direction, without the path throughput.
+        inline Math::Color PathIntegrator::sampleBackground(const Math::Ray& ray, const Math::hitRecord& rec, const Material& material, Utils::Random& rng) const
+        {
+            Math::Vec3 direction;
+            Math::Color radiance;
+            double pdf;
+            if (!background.sample(rng, direction, radiance, pdf))
+                return Math::Color(0, 0, 0);
+
+            Math::Color f = material.eval(ray, rec, direction);
+            if (f.x() <= 0 && f.y() <= 0 && f.z() <= 0)
+                return Math::Color(0, 0, 0);
+            if (world.occluded(Math::Ray(rec.p, direction, ray.time()), settings.tMin, Utils::infinity))
+                return Math::Color(0, 0, 0);
+            double weight = powerHeuristic(pdf, material.pdf(ray, rec, direction));
+            return f * radiance * (weight / pdf);
+        }
+    }
+}
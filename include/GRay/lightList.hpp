@@ -0,0 +1,149 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/hittable.hpp>
+#include <GRay/hittableList.hpp>
+#include <GRay/material.hpp>
+#include <GRay/aarect.hpp>
+#include <GRay/sphere.hpp>
+#include <GRay/bvh.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+namespace GRay
+{
+    namespace Solids
+    {
+        struct LightSample
+        {
+            Math::Point3 p;
+            Math::Color radiance; //emitted towards the shading point
+            double pdf;           //per unit solid angle, light selection included
+        };
+
+        // Emissive primitives of a scene, for next-event estimation. A light is picked with
+        // probability proportional to its estimated power, then a point on it is sampled with
+        // Hittable::sampleSurface().
+        class LightList
+        {
+        public:
+            LightList() : materials{ &MaterialRegistry::global() }, totalPower{ 0 } {}
+            explicit LightList(const Math::HittableList& scene) : materials{ &scene.materialRegistry() }, totalPower{ 0 } { collect(scene); }
+            // materials resolves the material handles of world.
+            LightList(const Math::Hittable& world, const MaterialRegistry& registry) : materials{ &registry }, totalPower{ 0 } { collect(world); }
+
+            // Adds every DiffuseLight rect and sphere reachable through lists and BvhNodes.
+            // Lights under Translate, RotateY or Instance are not collected and are only found by BSDF rays.
+            void collect(const Math::Hittable& object);
+            // Adds object if it is a rect or sphere with a DiffuseLight material.
+            bool add(const shared_ptr<Math::Hittable>& object);
+
+            bool sample(const Math::Point3& origin, Utils::Random& rng, LightSample& sample) const;
+            // Density with which sample() would pick the point of rec, a hit on a light of this list.
+            double pdf(const Math::Point3& origin, const Math::hitRecord& rec) const;
+            // True for primitives whose emission sample() accounts for.
+            bool contains(const Math::Hittable* object) const { return members.count(object) != 0; }
+
+            size_t size() const { return lights.size(); }
+            bool empty() const { return lights.empty(); }
+
+        private:
+            bool emitterArea(const Math::Hittable& object, MaterialHandle& material, double& area) const;
+            double selectionPdf(size_t index) const { return (cdf[index] - (index > 0 ? cdf[index - 1] : 0.0)) / totalPower; }
+
+        private:
+            const MaterialRegistry* materials;
+            std::vector<shared_ptr<Math::Hittable> > lights;
+            std::vector<double> cdf; //running sum of light powers
+            std::unordered_map<const Math::Hittable*, size_t> members; //light index by primitive
+            double totalPower;
+        };
+
+        inline bool LightList::emitterArea(const Math::Hittable& object, MaterialHandle& material, double& area) const
+        {
+            if (const XYRect* rect = dynamic_cast<const XYRect*>(&object))
+            {
+                material = rect->material;
+                area = (rect->x1 - rect->x0) * (rect->y1 - rect->y0);
+            }
+            else if (const XZRect* rect = dynamic_cast<const XZRect*>(&object))
+            {
+                material = rect->material;
+                area = (rect->x1 - rect->x0) * (rect->z1 - rect->z0);
+            }
+            else if (const YZRect* rect = dynamic_cast<const YZRect*>(&object))
+            {
+                material = rect->material;
+                area = (rect->y1 - rect->y0) * (rect->z1 - rect->z0);
+            }
+            else if (const Sphere* sphere = dynamic_cast<const Sphere*>(&object))
+            {
+                material = sphere->material;
+                area = 4 * Math::pi * sphere->radius * sphere->radius;
+            }
+            else
+                return false;
+            return area > 0 && dynamic_cast<const Materials::DiffuseLight*>(materials->get(material)) != nullptr;
+        }
+
+        inline void LightList::collect(const Math::Hittable& object)
+        {
+            if (const Math::HittableList* list = dynamic_cast<const Math::HittableList*>(&object))
+            {
+                for (const shared_ptr<Math::Hittable>& child : list->objects)
+                    if (!add(child))
+                        collect(*child);
+            }
+            else if (const BvhNode* node = dynamic_cast<const BvhNode*>(&object))
+            {
+                for (const shared_ptr<Math::Hittable>& child : { node->left, node->right })
+                    if (child && !add(child))
+                        collect(*child);
+            }
+        }
+
+        inline bool LightList::add(const shared_ptr<Math::Hittable>& object)
+        {
+            MaterialHandle material;
+            double area;
+            if (!object || members.count(object.get()) || !emitterArea(*object, material, area))
+                return false;
+
+            //Emission at the centre of the texture stands in for the average
+            AABB box;
+            object->boundingBox(0, 1, box);
+            Math::Point3 centre = 0.5 * (box.min() + box.max());
+            double power = Math::luminance(materials->get(material)->emitted(0.5, 0.5, centre)) * area;
+
+            totalPower += std::max(power, 1e-12);
+            members.emplace(object.get(), lights.size());
+            lights.push_back(object);
+            cdf.push_back(totalPower);
+            return true;
+        }
+
+        inline bool LightList::sample(const Math::Point3& origin, Utils::Random& rng, LightSample& sample) const
+        {
+            if (lights.empty())
+                return false;
+            size_t index = std::upper_bound(cdf.begin(), cdf.end(), rng.nextDouble() * totalPower) - cdf.begin();
+            index = std::min(index, lights.size() - 1);
+            Math::SurfaceSample surface;
+            if (!lights[index]->sampleSurface(origin, rng, surface))
+                return false;
+            sample.p = surface.p;
+            sample.radiance = materials->get(surface.material)->emitted(surface.u, surface.v, surface.p);
+            sample.pdf = surface.pdf * selectionPdf(index);
+            return sample.pdf > 0;
+        }
+
+        inline double LightList::pdf(const Math::Point3& origin, const Math::hitRecord& rec) const
+        {
+            auto found = members.find(rec.object);
+            if (found == members.end())
+                return 0;
+            return selectionPdf(found->second) * rec.object->surfacePdf(origin, rec);
+        }
+    }
+}
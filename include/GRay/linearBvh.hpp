@@ -0,0 +1,221 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/hittable.hpp>
+#include <GRay/hittableList.hpp>
+#include <GRay/bvh.h>
+#include <GRay/alignedAllocator.hpp>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace GRay
+{
+    namespace Solids
+    {
+        // 32-byte node, two per cache line. Bounds are rounded outwards to float.
+        // Interior nodes: the first child follows the node, offset is the second child.
+        // Leaves: offset is the first primitive, primitiveCount > 0.
+        struct alignas(32) LinearBvhNode
+        {
+            float boundsMin[3];
+            float boundsMax[3];
+            uint32_t offset;
+            uint16_t primitiveCount;
+            uint8_t axis;
+            uint8_t pad;
+        };
+        static_assert(sizeof(LinearBvhNode) == 32, "LinearBvhNode must stay 32 bytes");
+
+        // BVH flattened into a depth-first node array and traversed iteratively with an
+        // explicit stack. Any BvhBuilder method works; the depth is capped at maxDepth.
+        class LinearBvh : public GRay::Math::Hittable
+        {
+        public:
+            static const int maxDepth = 64;
+
+            LinearBvh() {}
+            LinearBvh(const GRay::Math::HittableList& list, double time0, double time1,
+                const BvhBuildOptions& options = BvhBuildOptions(BvhSplitMethod::SAH));
+
+            bool hit(const GRay::Math::Ray& r, double t_min, double t_max, GRay::Math::hitRecord& rec) const override
+            {
+                return intersectAndFinalize(r, t_min, t_max, rec);
+            }
+            bool intersect(const GRay::Math::Ray& r, double t_min, double t_max, GRay::Math::hitRecord& rec) const override;
+            bool occluded(const GRay::Math::Ray& r, double t_min, double t_max) const override;
+            bool boundingBox(double time0, double time1, GRay::Solids::AABB& outputBox) const override
+            {
+                outputBox = bounds;
+                return !nodes.empty();
+            }
+
+            size_t nodeCount() const { return nodes.size(); }
+            size_t memoryUsage() const
+            {
+                return nodes.size() * sizeof(LinearBvhNode) + primitives.size() * sizeof(const GRay::Math::Hittable*);
+            }
+
+        private:
+            uint32_t flatten(const BvhBuildNode& buildNode);
+            static bool hitNode(const LinearBvhNode& node, const GRay::Math::Point3& origin, const GRay::Math::Vec3& invDir, double t_min, double t_max);
+
+        private:
+            std::vector<LinearBvhNode, Utils::AlignedAllocator<LinearBvhNode, 64> > nodes;
+            std::vector<const GRay::Math::Hittable*> primitives; //leaf order
+            std::vector<shared_ptr<GRay::Math::Hittable> > owners; //keeps the primitives alive
+            AABB bounds;
+        };
+
+        inline LinearBvh::LinearBvh(const GRay::Math::HittableList& list, double time0, double time1, const BvhBuildOptions& options)
+        {
+            if (list.objects.empty())
+                return;
+            owners = list.objects;
+
+            //The traversal stack is fixed size; the builder already caps leaves at 65535 primitives
+            BvhBuildOptions buildOptions = options;
+            if (buildOptions.maxDepth <= 0 || buildOptions.maxDepth > maxDepth)
+                buildOptions.maxDepth = maxDepth;
+            BvhBuilder builder(buildOptions);
+            std::vector<BvhPrimitive> buildPrimitives = builder.makePrimitives(list.objects, 0, list.objects.size(), time0, time1);
+            std::unique_ptr<BvhBuildNode> root = builder.build(buildPrimitives);
+
+            //Leaves cover contiguous ranges in depth-first order, so primitives keep the builder's order
+            primitives.resize(buildPrimitives.size());
+            for (size_t i = 0; i < buildPrimitives.size(); ++i)
+                primitives[i] = buildPrimitives[i].object.get();
+            nodes.reserve(builder.nodes());
+            bounds = root->bounds;
+            flatten(*root);
+            builder.finish();
+        }
+
+        inline uint32_t LinearBvh::flatten(const BvhBuildNode& buildNode)
+        {
+            const uint32_t index = static_cast<uint32_t>(nodes.size());
+            nodes.emplace_back();
+
+            LinearBvhNode node;
+            for (int a = 0; a < 3; ++a)
+            {
+                node.boundsMin[a] = roundDownToFloat(buildNode.bounds.min()[a]);
+                node.boundsMax[a] = roundUpToFloat(buildNode.bounds.max()[a]);
+            }
+            node.axis = static_cast<uint8_t>(buildNode.axis);
+            node.pad = 0;
+
+            if (buildNode.isLeaf())
+            {
+                node.offset = static_cast<uint32_t>(buildNode.start);
+                node.primitiveCount = static_cast<uint16_t>(buildNode.count());
+            }
+            else
+            {
+                node.primitiveCount = 0;
+                flatten(*buildNode.children[0]);
+                node.offset = flatten(*buildNode.children[1]);
+            }
+            nodes[index] = node;
+            return index;
+        }
+
+        inline bool LinearBvh::hitNode(const LinearBvhNode& node, const GRay::Math::Point3& origin, const GRay::Math::Vec3& invDir, double t_min, double t_max)
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                double t0 = (node.boundsMin[a] - origin[a]) * invDir[a];
+                double t1 = (node.boundsMax[a] - origin[a]) * invDir[a];
+                if (invDir[a] < 0.0)
+                    std::swap(t0, t1);
+                t_min = t0 > t_min ? t0 : t_min;
+                t_max = t1 < t_max ? t1 : t_max;
+                if (t_max <= t_min)
+                    return false;
+            }
+            return true;
+        }
+
+        inline bool LinearBvh::intersect(const GRay::Math::Ray& r, double t_min, double t_max, GRay::Math::hitRecord& rec) const
+        {
+            if (nodes.empty())
+                return false;
+
+            const GRay::Math::Vec3 invDir(1.0 / r.direction().x(), 1.0 / r.direction().y(), 1.0 / r.direction().z());
+            const bool dirIsNeg[3] = { invDir.x() < 0, invDir.y() < 0, invDir.z() < 0 };
+
+            uint32_t stack[maxDepth];
+            int stackSize = 0;
+            uint32_t current = 0;
+            bool hitAnything = false;
+            while (true)
+            {
+                const LinearBvhNode& node = nodes[current];
+                if (hitNode(node, r.origin(), invDir, t_min, t_max))
+                {
+                    if (node.primitiveCount > 0)
+                    {
+                        for (uint32_t i = 0; i < node.primitiveCount; ++i)
+                            if (primitives[node.offset + i]->intersect(r, t_min, t_max, rec))
+                            {
+                                hitAnything = true;
+                                t_max = rec.t;
+                            }
+                        if (stackSize == 0)
+                            break;
+                        current = stack[--stackSize];
+                    }
+                    else if (dirIsNeg[node.axis])
+                    {
+                        //Ray travels towards lower coordinates, the second child is nearer
+                        stack[stackSize++] = current + 1;
+                        current = node.offset;
+                    }
+                    else
+                    {
+                        stack[stackSize++] = node.offset;
+                        current = current + 1;
+                    }
+                }
+                else
+                {
+                    if (stackSize == 0)
+                        break;
+                    current = stack[--stackSize];
+                }
+            }
+            return hitAnything;
+        }
+
+        inline bool LinearBvh::occluded(const GRay::Math::Ray& r, double t_min, double t_max) const
+        {
+            if (nodes.empty())
+                return false;
+
+            //Any hit will do, so children are visited in storage order
+            const GRay::Math::Vec3 invDir(1.0 / r.direction().x(), 1.0 / r.direction().y(), 1.0 / r.direction().z());
+            uint32_t stack[maxDepth];
+            int stackSize = 0;
+            uint32_t current = 0;
+            while (true)
+            {
+                const LinearBvhNode& node = nodes[current];
+                if (hitNode(node, r.origin(), invDir, t_min, t_max))
+                {
+                    if (node.primitiveCount == 0)
+                    {
+                        stack[stackSize++] = node.offset;
+                        current = current + 1;
+                        continue;
+                    }
+                    for (uint32_t i = 0; i < node.primitiveCount; ++i)
+                        if (primitives[node.offset + i]->occluded(r, t_min, t_max))
+                            return true;
+                }
+                if (stackSize == 0)
+                    return false;
+                current = stack[--stackSize];
+            }
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#if defined(_WIN32)
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace GRay
+{
+    namespace Utils
+    {
+        // Read-only view of a whole file: memory-mapped on POSIX systems, read into memory
+        // elsewhere.
+        class MappedFile
+        {
+        public:
+            explicit MappedFile(const std::string& path) : bytes{ nullptr }, length{ 0 }
+            {
+#if defined(_WIN32)
+                std::ifstream in(path, std::ios::binary);
+                if (!in)
+                    return;
+                buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+                bytes = reinterpret_cast<const uint8_t*>(buffer.data());
+                length = buffer.size();
+#else
+                int fd = ::open(path.c_str(), O_RDONLY);
+                if (fd < 0)
+                    return;
+                struct stat info;
+                if (fstat(fd, &info) == 0 && info.st_size > 0)
+                {
+                    void* mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (mapped != MAP_FAILED)
+                    {
+                        bytes = static_cast<const uint8_t*>(mapped);
+                        length = static_cast<size_t>(info.st_size);
+                    }
+                }
+                ::close(fd);
+#endif
+            }
+
+            ~MappedFile()
+            {
+#if !defined(_WIN32)
+                if (bytes)
+                    munmap(const_cast<uint8_t*>(bytes), length);
+#endif
+            }
+
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+
+            bool valid() const { return bytes != nullptr; }
+            const uint8_t* data() const { return bytes; }
+            size_t size() const { return length; }
+
+        private:
+            const uint8_t* bytes;
+            size_t length;
+#if defined(_WIN32)
+            std::vector<char> buffer;
+#endif
+        };
+    }
+}
@@ -12,11 +12,53 @@ namespace GRay
     {
         struct hitRecord;
     }
+    // One direction drawn by Material::sample().
+    struct BsdfSample
+    {
+        Math::Vec3 direction; //unit length
+        Math::Color weight;   //eval() / pdf, or the attenuation of a specular sample
+        double pdf;           //per unit solid angle, 0 for specular samples
+        bool specular;
+    };
+
     class Material
     {
     public:
-        virtual bool scatter(const Math::Ray& r_in, const Math::hitRecord& rec, Math::Color& attenuation, Math::Ray& scattered) const = 0;
+        virtual bool scatter(const Math::Ray& r_in, const Math::hitRecord& rec, Math::Color& attenuation, Math::Ray& scattered, Utils::Random& rng) const = 0;
         virtual Math::Color emitted(double u, double v, const Math::Point3& p) const {return Math::Color(0, 0, 0);}
+
+        // Draws an outgoing direction. The default wraps scatter() and reports a specular
+        // sample, which is right for materials that cannot evaluate their distribution.
+        virtual bool sample(const Math::Ray& r_in, const Math::hitRecord& rec, Utils::Random& rng, BsdfSample& s) const
+        {
+            Math::Ray scattered;
+            if (!scatter(r_in, rec, s.weight, scattered, rng))
+                return false;
+            s.direction = Math::unitVector(scattered.direction());
+            s.pdf = 0;
+            s.specular = true;
+            return true;
+        }
+        // Scattered radiance per unit incoming radiance from direction, cosine included.
+        // Only used at non-specular hits.
+        virtual Math::Color eval(const Math::Ray& r_in, const Math::hitRecord& rec, const Math::Vec3& direction) const {return Math::Color(0, 0, 0);}
+        // Solid angle density with which sample() picks the unit vector direction.
+        virtual double pdf(const Math::Ray& r_in, const Math::hitRecord& rec, const Math::Vec3& direction) const {return 0;}
+        // Specular materials scatter only into the directions they sample, so the
+        // integrator does not sample lights from them.
+        virtual bool isSpecular() const {return true;}
+
+    protected:
+        // scatter() for materials that implement sample().
+        bool scatterBySampling(const Math::Ray& r_in, const Math::hitRecord& rec, Math::Color& attenuation, Math::Ray& scattered, Utils::Random& rng) const
+        {
+            BsdfSample s;
+            if (!sample(r_in, rec, rng, s))
+                return false;
+            attenuation = s.weight;
+            scattered = Math::Ray(rec.p, s.direction, r_in.time());
+            return true;
+        }
     };
 
     namespace Materials
@@ -25,18 +67,34 @@ namespace GRay
         {
         public:
             Lambertian(const GRay::Math::Color& a) : albedo{make_shared<SolidColor>(a)} {}
-            Lambertian(shared_ptr<Texture> a) : albedo{a} {}
-            bool scatter(const GRay::Math::Ray& r_in, const GRay::Math::hitRecord& rec, GRay::Math::Color& attenuation, GRay::Math::Ray& scattered) const override
+            Lambertian(shared_ptr<const Texture> a) : albedo{a} {}
+            bool scatter(const GRay::Math::Ray& r_in, const GRay::Math::hitRecord& rec, GRay::Math::Color& attenuation, GRay::Math::Ray& scattered, Utils::Random& rng) const override
+            {
+                return scatterBySampling(r_in, rec, attenuation, scattered, rng);
+            }
+            bool sample(const Math::Ray& r_in, const Math::hitRecord& rec, Utils::Random& rng, BsdfSample& s) const override
             {
-                GRay::Math::Vec3 scatterDirection = rec.normal + GRay::Math::randomUnitVector();
+                //Cosine-weighted: the normal plus a point on the unit sphere
+                GRay::Math::Vec3 scatterDirection = rec.normal + GRay::Math::randomUnitVector(rng);
                 if (scatterDirection.nearZero())
                     scatterDirection = rec.normal;
-                scattered = GRay::Math::Ray(rec.p, scatterDirection, r_in.time());                
-                attenuation = albedo->value(rec.u, rec.v, rec.p);
+                s.direction = Math::unitVector(scatterDirection);
+                s.weight = albedo->filteredValue(rec.u, rec.v, rec.p, rec.uvFootprint);
+                s.pdf = pdf(r_in, rec, s.direction);
+                s.specular = false;
                 return true;
             }
+            Math::Color eval(const Math::Ray& r_in, const Math::hitRecord& rec, const Math::Vec3& direction) const override
+            {
+                return albedo->filteredValue(rec.u, rec.v, rec.p, rec.uvFootprint) * pdf(r_in, rec, Math::unitVector(direction));
+            }
+            double pdf(const Math::Ray& r_in, const Math::hitRecord& rec, const Math::Vec3& direction) const override
+            {
+                return fmax(Math::dot(direction, rec.normal), 0.0) / Math::pi;
+            }
+            bool isSpecular() const override {return false;}
         public:
-            shared_ptr<Texture> albedo;
+            shared_ptr<const Texture> albedo;
         };
 
         class Metal : public Material
@@ -44,25 +102,70 @@ namespace GRay
         public:
             Metal(const GRay::Math::Color& a, double f) : albedo{a}, fuzz{f} {}
 
-            bool scatter(const GRay::Math::Ray& r_in, const GRay::Math::hitRecord& rec, GRay::Math::Color& attenuation, GRay::Math::Ray& scattered) const override
+            bool scatter(const GRay::Math::Ray& r_in, const GRay::Math::hitRecord& rec, GRay::Math::Color& attenuation, GRay::Math::Ray& scattered, Utils::Random& rng) const override
+            {
+                return scatterBySampling(r_in, rec, attenuation, scattered, rng);
+            }
+            bool sample(const Math::Ray& r_in, const Math::hitRecord& rec, Utils::Random& rng, BsdfSample& s) const override
             {
                 GRay::Math::Vec3 reflected = GRay::Math::reflect(GRay::Math::unitVector(r_in.direction()), rec.normal);
-                scattered = GRay::Math::Ray(rec.p, reflected + fuzz * GRay::Math::randomInUnitSphere(), r_in.time());
-                attenuation = albedo;
-                return (GRay::Math::dot(scattered.direction(), rec.normal) > 0);;
+                GRay::Math::Vec3 direction = reflected + fuzz * GRay::Math::randomInUnitSphere(rng);
+                if (GRay::Math::dot(direction, rec.normal) <= 0 || direction.nearZero())
+                    return false;
+                s.direction = Math::unitVector(direction);
+                s.weight = albedo;
+                s.specular = isSpecular();
+                s.pdf = s.specular ? 0 : lobePdf(reflected, s.direction);
+                return true;
+            }
+            // Directions that would go below the surface are absorbed, so the reflectance
+            // towards a direction is the albedo times the density of the fuzzed reflection.
+            Math::Color eval(const Math::Ray& r_in, const Math::hitRecord& rec, const Math::Vec3& direction) const override
+            {
+                Math::Vec3 unitDirection = Math::unitVector(direction);
+                if (Math::dot(unitDirection, rec.normal) <= 0)
+                    return Math::Color(0, 0, 0);
+                return albedo * pdf(r_in, rec, unitDirection);
+            }
+            double pdf(const Math::Ray& r_in, const Math::hitRecord& rec, const Math::Vec3& direction) const override
+            {
+                if (isSpecular() || Math::dot(direction, rec.normal) <= 0)
+                    return 0;
+                return lobePdf(Math::reflect(Math::unitVector(r_in.direction()), rec.normal), direction);
             }
+            bool isSpecular() const override {return fuzz <= 0;}
         public:
             GRay::Math::Color albedo;
             double fuzz;
+
+        private:
+            // Density of the direction of reflected + fuzz * (uniform point in the unit ball):
+            // the ball volume swept by the ray along direction, over the ball volume.
+            double lobePdf(const Math::Vec3& reflected, const Math::Vec3& direction) const
+            {
+                double c = Math::dot(direction, reflected);
+                double discriminant = c * c - 1 + fuzz * fuzz;
+                if (discriminant <= 0)
+                    return 0;
+                double root = sqrt(discriminant);
+                double far = c + root;
+                if (far <= 0)
+                    return 0;
+                double near = fmax(c - root, 0.0);
+                return (far * far * far - near * near * near) / (4 * Math::pi * fuzz * fuzz * fuzz);
+            }
         };
 
         class Dialectric : public Material
         {
         public:
             Dialectric(double indexOfRefraction) : ir{indexOfRefraction} {}
-            bool scatter(const GRay::Math::Ray& r_in, const GRay::Math::hitRecord& rec, GRay::Math::Color& attenuation, GRay::Math::Ray& scattered) const override
+            bool scatter(const GRay::Math::Ray& r_in, const GRay::Math::hitRecord& rec, GRay::Math::Color& attenuation, GRay::Math::Ray& scattered, Utils::Random& rng) const override
+            {
+                return scatterBySampling(r_in, rec, attenuation, scattered, rng);
+            }
+            bool sample(const Math::Ray& r_in, const Math::hitRecord& rec, Utils::Random& rng, BsdfSample& s) const override
             {
-                attenuation = GRay::Math::Color(1.0, 1.0, 1.0);
                 double refractionRatio = rec.frontFace ? (1.0 / ir) : ir;
                 GRay::Math::Vec3 unitDirection = GRay::Math::unitVector(r_in.direction());
                 double cosTheta = fmin(GRay::Math::dot(-unitDirection, rec.normal), 1.0);
@@ -70,12 +173,15 @@ namespace GRay
 
                 bool cannotRefract = refractionRatio * sinTheta > 1.0;
                 GRay::Math::Vec3 direction;
-                if(cannotRefract || reflectance(cosTheta, refractionRatio) > Utils::randomDouble())
+                if(cannotRefract || reflectance(cosTheta, refractionRatio) > rng.nextDouble())
                     direction = GRay::Math::reflect(unitDirection, rec.normal);
                 else
                     direction = GRay::Math::refract(unitDirection, rec.normal, refractionRatio);
 
-                scattered = GRay::Math::Ray(rec.p, direction, r_in.time());
+                s.direction = Math::unitVector(direction);
+                s.weight = GRay::Math::Color(1.0, 1.0, 1.0);
+                s.pdf = 0;
+                s.specular = true;
                 return true;
             }
         public:
@@ -95,20 +201,24 @@ namespace GRay
         class DiffuseLight : public Material
         {
         public:
-            DiffuseLight(shared_ptr<Texture> a, double att = 1.0) : emit{a}, attenuation{att} {}
+            DiffuseLight(shared_ptr<const Texture> a, double att = 1.0) : emit{a}, attenuation{att} {}
             DiffuseLight(Math::Color c, double att = 1.0) : emit{make_shared<SolidColor>(c)}, attenuation{att} {}
 
-            bool scatter(const GRay::Math::Ray& r_in, const GRay::Math::hitRecord& rec, GRay::Math::Color& attenuation, GRay::Math::Ray& scattered) const override
+            bool scatter(const GRay::Math::Ray& r_in, const GRay::Math::hitRecord& rec, GRay::Math::Color& attenuation, GRay::Math::Ray& scattered, Utils::Random& rng) const override
             {
                 return false;                
             }
+            bool sample(const Math::Ray& r_in, const Math::hitRecord& rec, Utils::Random& rng, BsdfSample& s) const override
+            {
+                return false;
+            }
 
             Math::Color emitted(double u, double v, const Math::Point3& p) const override
             {
                 return attenuation * emit->value(u, v, p);
             }
         public:
-            shared_ptr<Texture> emit;
+            shared_ptr<const Texture> emit;
             double attenuation;
         };
 
@@ -116,15 +226,30 @@ namespace GRay
         {
         public:
             Isotropic(Math::Color c) : albedo{make_shared<SolidColor>(c)} {}
-            Isotropic(shared_ptr<Texture> t) : albedo{t} {}
-            bool scatter(const GRay::Math::Ray& r_in, const GRay::Math::hitRecord& rec, GRay::Math::Color& attenuation, GRay::Math::Ray& scattered) const override
+            Isotropic(shared_ptr<const Texture> t) : albedo{t} {}
+            bool scatter(const GRay::Math::Ray& r_in, const GRay::Math::hitRecord& rec, GRay::Math::Color& attenuation, GRay::Math::Ray& scattered, Utils::Random& rng) const override
+            {
+                return scatterBySampling(r_in, rec, attenuation, scattered, rng);
+            }
+            bool sample(const Math::Ray& r_in, const Math::hitRecord& rec, Utils::Random& rng, BsdfSample& s) const override
             {
-                scattered = Math::Ray(rec.p, Math::randomInUnitSphere(), r_in.time());
-                attenuation = albedo->value(rec.u, rec.v, rec.p);
+                s.direction = Math::randomUnitVector(rng);
+                s.weight = albedo->filteredValue(rec.u, rec.v, rec.p, rec.uvFootprint);
+                s.pdf = 1 / (4 * Math::pi);
+                s.specular = false;
                 return true;
             }
+            Math::Color eval(const Math::Ray& r_in, const Math::hitRecord& rec, const Math::Vec3& direction) const override
+            {
+                return albedo->filteredValue(rec.u, rec.v, rec.p, rec.uvFootprint) * (1 / (4 * Math::pi));
+            }
+            double pdf(const Math::Ray& r_in, const Math::hitRecord& rec, const Math::Vec3& direction) const override
+            {
+                return 1 / (4 * Math::pi);
+            }
+            bool isSpecular() const override {return false;}
         public:
-            shared_ptr<Texture> albedo;
+            shared_ptr<const Texture> albedo;
         };
     }
 }
\ No newline at end of file
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+namespace GRay
+{
+    class Material;
+
+    typedef uint32_t MaterialHandle;
+    const MaterialHandle invalidMaterial = 0xffffffffu;
+
+    // Table owning a scene's materials. Primitives and hit records carry a 32-bit handle
+    // instead of a shared_ptr, so a hit costs no reference counting. A scene owns its
+    // registry (HittableList::materials) and hands it to the integrator; its materials live
+    // as long as the registry does. Primitives built from a shared_ptr<Material> register it
+    // in current(). Entries never move once added, so get() takes no lock and stays valid
+    // while another thread adds materials.
+    class MaterialRegistry
+    {
+    public:
+        // Makes registry current() on this thread until the scope ends. Scene builders open
+        // one around the construction of their primitives.
+        class Scope
+        {
+        public:
+            explicit Scope(MaterialRegistry& registry) : previous{ active() } { active() = &registry; }
+            ~Scope() { active() = previous; }
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+        private:
+            MaterialRegistry* previous;
+        };
+
+        MaterialRegistry() : count{ 0 }
+        {
+            for (std::atomic<shared_ptr<Material>*>& segment : segments)
+                segment.store(nullptr, std::memory_order_relaxed);
+        }
+        ~MaterialRegistry() { release(); }
+        MaterialRegistry(const MaterialRegistry&) = delete;
+        MaterialRegistry& operator=(const MaterialRegistry&) = delete;
+
+        // Adding the same material twice returns the same handle; null maps to invalidMaterial.
+        MaterialHandle add(const shared_ptr<Material>& material)
+        {
+            if (!material)
+                return invalidMaterial;
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = handles.find(material.get());
+            if (found != handles.end())
+                return found->second;
+            const MaterialHandle handle = count.load(std::memory_order_relaxed);
+            if (handle == invalidMaterial)
+                return invalidMaterial;
+            uint32_t segment, offset;
+            locate(handle, segment, offset);
+            shared_ptr<Material>* entries = segments[segment].load(std::memory_order_relaxed);
+            if (!entries)
+            {
+                entries = new shared_ptr<Material>[segmentSize(segment)];
+                segments[segment].store(entries, std::memory_order_release);
+            }
+            entries[offset] = material;
+            handles.emplace(material.get(), handle);
+            count.store(handle + 1, std::memory_order_release); //publishes the entry to get()
+            return handle;
+        }
+
+        const Material* get(MaterialHandle handle) const
+        {
+            const shared_ptr<Material>* entry = find(handle);
+            return entry ? entry->get() : nullptr;
+        }
+
+        shared_ptr<Material> share(MaterialHandle handle) const
+        {
+            const shared_ptr<Material>* entry = find(handle);
+            return entry ? *entry : nullptr;
+        }
+
+        size_t size() const { return count.load(std::memory_order_acquire); }
+
+        // Invalidates every handle handed out so far. Not while rendering with this registry.
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            release();
+            handles.clear();
+        }
+
+        // Registry the shared_ptr<Material> constructors of the primitives add to: that of the
+        // innermost Scope on this thread, or global() outside of any.
+        static MaterialRegistry& current()
+        {
+            MaterialRegistry* registry = active();
+            return registry ? *registry : global();
+        }
+
+        // Lives until the process exits, for scenes built without a registry of their own.
+        static MaterialRegistry& global()
+        {
+            static MaterialRegistry registry;
+            return registry;
+        }
+
+    private:
+        //Segment k holds 64 << k entries, so 27 segments cover every handle
+        static const uint32_t firstSegmentBits = 6;
+        static const uint32_t segmentCount = 27;
+
+        static size_t segmentSize(uint32_t segment) { return size_t(1) << (firstSegmentBits + segment); }
+
+        static void locate(MaterialHandle handle, uint32_t& segment, uint32_t& offset)
+        {
+            const uint64_t position = static_cast<uint64_t>(handle) + (1u << firstSegmentBits);
+            uint32_t bit = firstSegmentBits;
+            while (position >> (bit + 1))
+                ++bit;
+            segment = bit - firstSegmentBits;
+            offset = static_cast<uint32_t>(position - (uint64_t(1) << bit));
+        }
+
+        const shared_ptr<Material>* find(MaterialHandle handle) const
+        {
+            if (handle >= count.load(std::memory_order_acquire))
+                return nullptr;
+            uint32_t segment, offset;
+            locate(handle, segment, offset);
+            return segments[segment].load(std::memory_order_acquire) + offset;
+        }
+
+        void release()
+        {
+            for (std::atomic<shared_ptr<Material>*>& segment : segments)
+                delete[] segment.exchange(nullptr);
+            count.store(0);
+        }
+
+        static MaterialRegistry*& active()
+        {
+            thread_local MaterialRegistry* registry = nullptr;
+            return registry;
+        }
+
+    private:
+        std::atomic<shared_ptr<Material>*> segments[segmentCount];
+        std::atomic<uint32_t> count;
+        std::unordered_map<const Material*, MaterialHandle> handles;
+        std::mutex mutex;
+    };
+}
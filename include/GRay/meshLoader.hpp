@@ -0,0 +1,825 @@
+#pragma once
+
+#include <GRay/triangleMesh.hpp>
+#include <GRay/mappedFile.hpp>
+#include <GRay/threadPool.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace GRay
+{
+    namespace Solids
+    {
+        namespace Detail
+        {
+            // Number parsing straight from mapped file bytes, which are not null-terminated, so
+            // strtod and friends cannot be used. Whitespace other than line breaks is skipped first.
+            inline void skipBlanks(const char*& p, const char* end)
+            {
+                while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+                    ++p;
+            }
+
+            inline void skipLine(const char*& p, const char* end)
+            {
+                const void* newline = memchr(p, '\n', static_cast<size_t>(end - p));
+                p = newline ? static_cast<const char*>(newline) + 1 : end;
+            }
+
+            inline bool parseInteger(const char*& p, const char* end, long long& value)
+            {
+                skipBlanks(p, end);
+                const bool negative = p < end && *p == '-';
+                if (p < end && (*p == '-' || *p == '+'))
+                    ++p;
+                if (p == end || *p < '0' || *p > '9')
+                    return false;
+                long long v = 0;
+                while (p < end && *p >= '0' && *p <= '9')
+                {
+                    if (v > 99999999999999999LL) //far past any index, and short of overflowing
+                        return false;
+                    v = v * 10 + (*p++ - '0');
+                }
+                value = negative ? -v : v;
+                return true;
+            }
+
+            // Decimal floats with optional exponent; accurate to float precision, which is all
+            // the mesh buffers keep.
+            inline bool parseReal(const char*& p, const char* end, double& value)
+            {
+                static const double powersOfTen[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+                skipBlanks(p, end);
+                const bool negative = p < end && *p == '-';
+                if (p < end && (*p == '-' || *p == '+'))
+                    ++p;
+
+                uint64_t mantissa = 0;
+                int exponent = 0;
+                int digits = 0;
+                bool any = false;
+                for (; p < end && *p >= '0' && *p <= '9'; ++p, any = true)
+                    if (digits < 19)
+                    {
+                        mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+                        digits += mantissa != 0;
+                    }
+                    else
+                        ++exponent;
+                if (p < end && *p == '.')
+                    for (++p; p < end && *p >= '0' && *p <= '9'; ++p, any = true)
+                        if (digits < 19)
+                        {
+                            mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+                            digits += mantissa != 0;
+                            --exponent;
+                        }
+                if (!any)
+                    return false;
+                if (p < end && (*p == 'e' || *p == 'E'))
+                {
+                    long long e;
+                    const char* at = p + 1;
+                    if (parseInteger(at, end, e))
+                    {
+                        exponent += static_cast<int>(std::max(-400LL, std::min(400LL, e)));
+                        p = at;
+                    }
+                }
+
+                double v = static_cast<double>(mantissa);
+                for (; exponent > 22; exponent -= 22)
+                    v *= 1e22;
+                for (; exponent < -22; exponent += 22)
+                    v /= 1e22;
+                v = exponent < 0 ? v / powersOfTen[-exponent] : v * powersOfTen[exponent];
+                value = negative ? -v : v;
+                return true;
+            }
+
+            // Splits [begin, end) into about count pieces that start at line beginnings.
+            inline std::vector<const char*> lineChunks(const char* begin, const char* end, size_t count)
+            {
+                std::vector<const char*> bounds(1, begin);
+                const size_t step = static_cast<size_t>(end - begin) / std::max<size_t>(count, 1) + 1;
+                while (end - bounds.back() > static_cast<ptrdiff_t>(step))
+                {
+                    const char* at = bounds.back() + step;
+                    skipLine(at, end);
+                    bounds.push_back(at);
+                }
+                if (bounds.back() != end)
+                    bounds.push_back(end);
+                return bounds;
+            }
+
+            // Runs task(i) for i in [0, count) on the pool, or inline without one.
+            template <typename Task>
+            inline void runChunks(Utils::ThreadPool* pool, size_t count, Task task)
+            {
+                if (!pool)
+                {
+                    for (size_t i = 0; i < count; ++i)
+                        task(i);
+                    return;
+                }
+                std::vector<std::future<void> > done;
+                done.reserve(count);
+                for (size_t i = 0; i < count; ++i)
+                    done.push_back(pool->submit([&task, i] { task(i); }));
+                for (std::future<void>& result : done)
+                    result.get();
+            }
+
+            // OBJ statements counted per chunk in the first pass, and the chunk's offsets into
+            // the mesh buffers in the second.
+            struct ObjChunk
+            {
+                size_t positions = 0;
+                size_t normals = 0;
+                size_t uvs = 0;
+                size_t triangles = 0;
+                bool faceNormals = false;
+                bool faceUvs = false;
+            };
+
+            inline bool objKeyword(const char* p, const char* end, const char* keyword, size_t length)
+            {
+                return static_cast<size_t>(end - p) > length && memcmp(p, keyword, length) == 0 && (p[length] == ' ' || p[length] == '\t');
+            }
+
+            inline void countObjChunk(const char* p, const char* end, ObjChunk& chunk)
+            {
+                while (p < end)
+                {
+                    skipBlanks(p, end);
+                    if (objKeyword(p, end, "v", 1))
+                        ++chunk.positions;
+                    else if (objKeyword(p, end, "vn", 2))
+                        ++chunk.normals;
+                    else if (objKeyword(p, end, "vt", 2))
+                        ++chunk.uvs;
+                    else if (objKeyword(p, end, "f", 1))
+                    {
+                        //Corners are the whitespace separated words after "f"
+                        const void* newline = memchr(p, '\n', static_cast<size_t>(end - p));
+                        const char* lineEnd = newline ? static_cast<const char*>(newline) : end;
+                        const char* comment = static_cast<const char*>(memchr(p, '#', static_cast<size_t>(lineEnd - p)));
+                        if (comment)
+                            lineEnd = comment;
+                        size_t corners = 0;
+                        for (const char* at = p + 1; at < lineEnd; )
+                        {
+                            while (at < lineEnd && (*at == ' ' || *at == '\t' || *at == '\r'))
+                                ++at;
+                            const char* word = at;
+                            while (at < lineEnd && *at != ' ' && *at != '\t' && *at != '\r')
+                                ++at;
+                            if (word == at)
+                                continue;
+                            ++corners;
+                            //v, v/vt, v//vn or v/vt/vn
+                            const char* slash = static_cast<const char*>(memchr(word, '/', static_cast<size_t>(at - word)));
+                            if (!slash)
+                                continue;
+                            chunk.faceUvs |= slash + 1 < at && slash[1] != '/';
+                            const char* second = static_cast<const char*>(memchr(slash + 1, '/', static_cast<size_t>(at - slash - 1)));
+                            chunk.faceNormals |= second && second + 1 < at;
+                        }
+                        chunk.triangles += corners > 2 ? corners - 2 : 0;
+                    }
+                    skipLine(p, end);
+                }
+            }
+
+            // Resolves a 1-based or negative (relative) OBJ index against the count so far.
+            inline bool objIndex(long long index, size_t seen, size_t total, uint32_t& resolved)
+            {
+                const long long zeroBased = index < 0 ? static_cast<long long>(seen) + index : index - 1;
+                if (index == 0 || zeroBased < 0 || zeroBased >= static_cast<long long>(total))
+                    return false;
+                resolved = static_cast<uint32_t>(zeroBased);
+                return true;
+            }
+
+            // Second pass over a chunk: writes its statements at the chunk's offsets. Faces are
+            // fanned into triangles, at most up to triangleLimit, where the next chunk starts.
+            // Returns false on malformed input.
+            inline bool parseObjChunk(const char* p, const char* end, const ObjChunk& offsets, const ObjChunk& totals,
+                size_t triangleLimit, MeshData& mesh)
+            {
+                size_t positions = offsets.positions, normals = offsets.normals, uvs = offsets.uvs, triangle = offsets.triangles;
+                while (p < end)
+                {
+                    skipBlanks(p, end);
+                    double x, y, z;
+                    if (objKeyword(p, end, "v", 1))
+                    {
+                        p += 1;
+                        if (!parseReal(p, end, x) || !parseReal(p, end, y) || !parseReal(p, end, z))
+                            return false;
+                        float* out = &mesh.positions[3 * positions++];
+                        out[0] = static_cast<float>(x);
+                        out[1] = static_cast<float>(y);
+                        out[2] = static_cast<float>(z);
+                    }
+                    else if (objKeyword(p, end, "vn", 2))
+                    {
+                        p += 2;
+                        if (!parseReal(p, end, x) || !parseReal(p, end, y) || !parseReal(p, end, z))
+                            return false;
+                        float* out = &mesh.normals[3 * normals++];
+                        out[0] = static_cast<float>(x);
+                        out[1] = static_cast<float>(y);
+                        out[2] = static_cast<float>(z);
+                    }
+                    else if (objKeyword(p, end, "vt", 2))
+                    {
+                        p += 2;
+                        if (!parseReal(p, end, x))
+                            return false;
+                        if (!parseReal(p, end, y))
+                            y = 0;
+                        float* out = &mesh.uvs[2 * uvs++];
+                        out[0] = static_cast<float>(x);
+                        out[1] = static_cast<float>(y);
+                    }
+                    else if (objKeyword(p, end, "f", 1))
+                    {
+                        p += 1;
+                        uint32_t first[3] = {}, previous[3] = {}, current[3];
+                        int corners = 0;
+                        for (;;)
+                        {
+                            skipBlanks(p, end);
+                            if (p == end || *p == '\n' || *p == '#')
+                                break;
+                            long long index;
+                            if (!parseInteger(p, end, index) || !objIndex(index, positions, totals.positions, current[0]))
+                                return false;
+                            current[1] = current[2] = MeshData::noAttribute;
+                            if (p < end && *p == '/')
+                            {
+                                ++p;
+                                if (p < end && *p != '/' && (!parseInteger(p, end, index) || !objIndex(index, uvs, totals.uvs, current[2])))
+                                    return false;
+                                if (p < end && *p == '/')
+                                {
+                                    ++p;
+                                    if (!parseInteger(p, end, index) || !objIndex(index, normals, totals.normals, current[1]))
+                                        return false;
+                                }
+                            }
+                            //Corners end where the first pass split the words
+                            if (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != '#')
+                                return false;
+                            if (corners == 0)
+                                std::copy(current, current + 3, first);
+                            else if (corners >= 2)
+                            {
+                                if (triangle >= triangleLimit)
+                                    return false;
+                                const size_t base = 3 * triangle++;
+                                const uint32_t* fan[3] = { first, previous, current };
+                                for (int k = 0; k < 3; ++k)
+                                {
+                                    mesh.indices[base + k] = fan[k][0];
+                                    if (!mesh.normalIndices.empty())
+                                        mesh.normalIndices[base + k] = fan[k][1];
+                                    if (!mesh.uvIndices.empty())
+                                        mesh.uvIndices[base + k] = fan[k][2];
+                                }
+                            }
+                            std::copy(current, current + 3, previous);
+                            ++corners;
+                        }
+                    }
+                    skipLine(p, end);
+                }
+                return true;
+            }
+
+            enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64, Invalid };
+
+            inline PlyType plyType(const std::string& name)
+            {
+                if (name == "char" || name == "int8") return PlyType::Int8;
+                if (name == "uchar" || name == "uint8") return PlyType::UInt8;
+                if (name == "short" || name == "int16") return PlyType::Int16;
+                if (name == "ushort" || name == "uint16") return PlyType::UInt16;
+                if (name == "int" || name == "int32") return PlyType::Int32;
+                if (name == "uint" || name == "uint32") return PlyType::UInt32;
+                if (name == "float" || name == "float32") return PlyType::Float32;
+                if (name == "double" || name == "float64") return PlyType::Float64;
+                return PlyType::Invalid;
+            }
+
+            inline size_t plyTypeSize(PlyType type)
+            {
+                static const size_t sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, 0 };
+                return sizes[static_cast<int>(type)];
+            }
+
+            struct PlyProperty
+            {
+                std::string name;
+                PlyType type;
+                PlyType countType; //Invalid unless this is a list
+                size_t offset;     //within a record of fixed size
+            };
+
+            struct PlyElement
+            {
+                std::string name;
+                size_t count;
+                std::vector<PlyProperty> properties;
+                size_t stride; //0 when records contain lists
+
+                int find(const char* property) const
+                {
+                    for (size_t i = 0; i < properties.size(); ++i)
+                        if (properties[i].name == property)
+                            return static_cast<int>(i);
+                    return -1;
+                }
+                // Smallest possible record, with empty lists: one byte per value in ASCII files.
+                size_t minimumSize(bool ascii) const
+                {
+                    size_t size = 0;
+                    for (const PlyProperty& property : properties)
+                        size += ascii ? 1 : plyTypeSize(property.countType == PlyType::Invalid ? property.type : property.countType);
+                    return size;
+                }
+            };
+
+            // Reads PLY values from binary records of either byte order.
+            struct PlyBinaryReader
+            {
+                const uint8_t* p;
+                const uint8_t* end;
+                bool swapBytes;
+
+                bool read(PlyType type, double& value)
+                {
+                    const size_t size = plyTypeSize(type);
+                    if (static_cast<size_t>(end - p) < size)
+                        return false;
+                    value = decode(p, type, swapBytes);
+                    p += size;
+                    return true;
+                }
+
+                static double decode(const uint8_t* at, PlyType type, bool swapBytes)
+                {
+                    uint8_t bytes[8];
+                    const size_t size = plyTypeSize(type);
+                    for (size_t i = 0; i < size; ++i)
+                        bytes[i] = at[swapBytes ? size - 1 - i : i];
+                    switch (type)
+                    {
+                        case PlyType::Int8: { int8_t v; memcpy(&v, bytes, 1); return v; }
+                        case PlyType::UInt8: return bytes[0];
+                        case PlyType::Int16: { int16_t v; memcpy(&v, bytes, 2); return v; }
+                        case PlyType::UInt16: { uint16_t v; memcpy(&v, bytes, 2); return v; }
+                        case PlyType::Int32: { int32_t v; memcpy(&v, bytes, 4); return v; }
+                        case PlyType::UInt32: { uint32_t v; memcpy(&v, bytes, 4); return v; }
+                        case PlyType::Float32: { float v; memcpy(&v, bytes, 4); return v; }
+                        case PlyType::Float64: { double v; memcpy(&v, bytes, 8); return v; }
+                        default: return 0;
+                    }
+                }
+            };
+
+            // Reads PLY values from whitespace separated text.
+            struct PlyAsciiReader
+            {
+                const char* p;
+                const char* end;
+
+                bool read(PlyType, double& value)
+                {
+                    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+                        ++p;
+                    return parseReal(p, end, value);
+                }
+            };
+
+            // Reads the length of a list property. It may come in any PLY type, so it is checked
+            // to be a count before being used as one.
+            template <typename Reader>
+            inline bool readPlyListLength(Reader& reader, PlyType countType, uint32_t& length)
+            {
+                double count;
+                if (!reader.read(countType, count) || !(count >= 0 && count <= 4294967295.0))
+                    return false;
+                length = static_cast<uint32_t>(count);
+                return true;
+            }
+
+            // Where the loader wants the properties of a vertex record; -1 for ignored properties.
+            struct PlyVertexLayout
+            {
+                int position[3];
+                int normal[3];
+                int uv[2];
+            };
+
+            template <typename Reader>
+            inline bool readPlyVertices(Reader& reader, const PlyElement& element, const PlyVertexLayout& layout, size_t first, size_t last, MeshData& mesh)
+            {
+                double values[64];
+                const size_t kept = std::min<size_t>(element.properties.size(), 64);
+                for (size_t v = first; v < last; ++v)
+                {
+                    for (size_t i = 0; i < element.properties.size(); ++i)
+                    {
+                        const PlyProperty& property = element.properties[i];
+                        double value = 0;
+                        if (property.countType != PlyType::Invalid)
+                        {
+                            uint32_t length;
+                            if (!readPlyListLength(reader, property.countType, length))
+                                return false;
+                            for (uint32_t k = 0; k < length; ++k)
+                                if (!reader.read(property.type, value))
+                                    return false;
+                        }
+                        else if (!reader.read(property.type, value))
+                            return false;
+                        if (i < kept)
+                            values[i] = value;
+                    }
+                    for (int a = 0; a < 3; ++a)
+                        mesh.positions[3 * v + a] = static_cast<float>(values[layout.position[a]]);
+                    if (!mesh.normals.empty())
+                        for (int a = 0; a < 3; ++a)
+                            mesh.normals[3 * v + a] = static_cast<float>(values[layout.normal[a]]);
+                    if (!mesh.uvs.empty())
+                        for (int a = 0; a < 2; ++a)
+                            mesh.uvs[2 * v + a] = static_cast<float>(values[layout.uv[a]]);
+                }
+                return true;
+            }
+
+            // Faces are fanned into triangles; other properties of the face element are skipped.
+            template <typename Reader>
+            inline bool readPlyFaces(Reader& reader, const PlyElement& element, int indexProperty, size_t vertexCount, MeshData& mesh)
+            {
+                for (size_t f = 0; f < element.count; ++f)
+                    for (size_t i = 0; i < element.properties.size(); ++i)
+                    {
+                        const PlyProperty& property = element.properties[i];
+                        double value;
+                        if (property.countType == PlyType::Invalid)
+                        {
+                            if (!reader.read(property.type, value))
+                                return false;
+                            continue;
+                        }
+                        uint32_t length;
+                        if (!readPlyListLength(reader, property.countType, length))
+                            return false;
+                        uint32_t first = 0, previous = 0;
+                        for (uint32_t k = 0; k < length; ++k)
+                        {
+                            if (!reader.read(property.type, value))
+                                return false;
+                            if (static_cast<int>(i) != indexProperty)
+                                continue;
+                            if (value < 0 || value >= static_cast<double>(vertexCount))
+                                return false;
+                            const uint32_t index = static_cast<uint32_t>(value);
+                            if (k == 0)
+                                first = index;
+                            else if (k >= 2)
+                            {
+                                mesh.indices.push_back(first);
+                                mesh.indices.push_back(previous);
+                                mesh.indices.push_back(index);
+                            }
+                            previous = index;
+                        }
+                    }
+                return true;
+            }
+
+            // Skips the records of an element the loader has no use for.
+            template <typename Reader>
+            inline bool skipPlyElement(Reader& reader, const PlyElement& element)
+            {
+                for (size_t r = 0; r < element.count; ++r)
+                    for (const PlyProperty& property : element.properties)
+                    {
+                        double value;
+                        uint32_t length = 1;
+                        if (property.countType != PlyType::Invalid && !readPlyListLength(reader, property.countType, length))
+                            return false;
+                        for (uint32_t k = 0; k < length; ++k)
+                            if (!reader.read(property.type, value))
+                                return false;
+                    }
+                return true;
+            }
+
+            inline bool meshLoadError(const std::string& path, const char* reason)
+            {
+                std::cerr << "ERROR: Could not load mesh file '" << path << "': " << reason << ".\n";
+                return false;
+            }
+
+            // Parses the header and picks the vertex properties; on success body points past it.
+            inline bool readPlyHeader(const std::string& path, const char* text, const char* end, std::vector<PlyElement>& elements,
+                int& format, const char*& body)
+            {
+                format = -1; //0 ascii, 1 binary little endian, 2 binary big endian
+                const char* p = text;
+                std::string line;
+                for (bool first = true; ; first = false)
+                {
+                    if (p >= end)
+                        return meshLoadError(path, "truncated PLY header");
+                    const char* lineStart = p;
+                    skipLine(p, end);
+                    line.assign(lineStart, p);
+                    while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+                        line.pop_back();
+
+                    std::vector<std::string> words;
+                    for (size_t at = 0; at < line.size(); )
+                    {
+                        const size_t start = line.find_first_not_of(" \t", at);
+                        if (start == std::string::npos)
+                            break;
+                        const size_t stop = std::min(line.find_first_of(" \t", start), line.size());
+                        words.push_back(line.substr(start, stop - start));
+                        at = stop;
+                    }
+                    if (first)
+                    {
+                        if (words.size() != 1 || words[0] != "ply")
+                            return meshLoadError(path, "not a PLY file");
+                        continue;
+                    }
+                    if (words.empty() || words[0] == "comment" || words[0] == "obj_info")
+                        continue;
+                    if (words[0] == "end_header")
+                        break;
+                    if (words[0] == "format" && words.size() >= 2)
+                        format = words[1] == "ascii" ? 0 : words[1] == "binary_little_endian" ? 1 : words[1] == "binary_big_endian" ? 2 : -1;
+                    else if (words[0] == "element" && words.size() == 3)
+                        elements.push_back(PlyElement{ words[1], static_cast<size_t>(std::strtoull(words[2].c_str(), nullptr, 10)), {}, 0 });
+                    else if (words[0] == "property" && !elements.empty() && words.size() == 3 && plyType(words[1]) != PlyType::Invalid)
+                        elements.back().properties.push_back(PlyProperty{ words[2], plyType(words[1]), PlyType::Invalid, 0 });
+                    else if (words[0] == "property" && !elements.empty() && words.size() == 5 && words[1] == "list"
+                        && plyType(words[2]) != PlyType::Invalid && plyType(words[3]) != PlyType::Invalid)
+                        elements.back().properties.push_back(PlyProperty{ words[4], plyType(words[3]), plyType(words[2]), 0 });
+                    else
+                        return meshLoadError(path, ("unsupported PLY header line '" + line + "'").c_str());
+                }
+                if (format < 0)
+                    return meshLoadError(path, "unknown PLY format");
+
+                for (PlyElement& element : elements)
+                {
+                    size_t offset = 0;
+                    bool fixed = true;
+                    for (PlyProperty& property : element.properties)
+                    {
+                        property.offset = offset;
+                        offset += plyTypeSize(property.type);
+                        fixed = fixed && property.countType == PlyType::Invalid;
+                    }
+                    element.stride = fixed ? offset : 0;
+                }
+                body = p;
+                return true;
+            }
+        }
+
+        // Binary (either byte order) or ASCII PLY: the "vertex" element with x, y, z and
+        // optional nx, ny, nz and u, v (or s, t) properties, and the "face" element with a
+        // vertex_indices list. Binary files are read straight from a memory mapping, vertices on
+        // threadCount threads (0 - one per hardware thread, 1 - serial). On failure the error is
+        // reported on std::cerr, mesh is left empty and false is returned.
+        inline bool loadPly(const std::string& path, MeshData& mesh, size_t threadCount = 0)
+        {
+            using namespace Detail;
+            mesh = MeshData();
+            Utils::MappedFile file(path);
+            if (!file.valid())
+                return meshLoadError(path, "cannot open file");
+            const char* text = reinterpret_cast<const char*>(file.data());
+            const char* end = text + file.size();
+
+            std::vector<PlyElement> elements;
+            int format;
+            const char* body;
+            if (!readPlyHeader(path, text, end, elements, format, body))
+                return false;
+
+            const PlyElement* vertices = nullptr;
+            const PlyElement* faces = nullptr;
+            for (const PlyElement& element : elements)
+            {
+                if (element.name == "vertex" && !vertices)
+                    vertices = &element;
+                else if (element.name == "face" && !faces)
+                    faces = &element;
+            }
+            if (!vertices || !faces)
+                return meshLoadError(path, "PLY file without vertex or face element");
+
+            PlyVertexLayout layout;
+            const char* positionNames[3] = { "x", "y", "z" };
+            const char* normalNames[3] = { "nx", "ny", "nz" };
+            for (int a = 0; a < 3; ++a)
+            {
+                layout.position[a] = vertices->find(positionNames[a]);
+                layout.normal[a] = vertices->find(normalNames[a]);
+            }
+            layout.uv[0] = vertices->find("u") >= 0 ? vertices->find("u") : vertices->find("s") >= 0 ? vertices->find("s") : vertices->find("texture_u");
+            layout.uv[1] = vertices->find("v") >= 0 ? vertices->find("v") : vertices->find("t") >= 0 ? vertices->find("t") : vertices->find("texture_v");
+            if (layout.position[0] < 0 || layout.position[1] < 0 || layout.position[2] < 0)
+                return meshLoadError(path, "PLY vertices without x, y and z");
+            const bool hasNormals = layout.normal[0] >= 0 && layout.normal[1] >= 0 && layout.normal[2] >= 0;
+            const bool hasUvs = layout.uv[0] >= 0 && layout.uv[1] >= 0;
+            const int largest = std::max({ layout.position[0], layout.position[1], layout.position[2],
+                hasNormals ? std::max({ layout.normal[0], layout.normal[1], layout.normal[2] }) : 0, hasUvs ? std::max(layout.uv[0], layout.uv[1]) : 0 });
+            if (largest >= 64)
+                return meshLoadError(path, "too many PLY vertex properties");
+            int indexProperty = faces->find("vertex_indices");
+            if (indexProperty < 0)
+                indexProperty = faces->find("vertex_index");
+            if (indexProperty < 0 || faces->properties[indexProperty].countType == PlyType::Invalid)
+                return meshLoadError(path, "PLY faces without a vertex_indices list");
+
+            //Counts from the header have to fit in the file before anything is allocated for them
+            const bool ascii = format == 0;
+            size_t remaining = static_cast<size_t>(end - body);
+            for (const PlyElement& element : elements)
+            {
+                const size_t recordSize = element.minimumSize(ascii);
+                if (recordSize > 0 && element.count > remaining / recordSize)
+                    return meshLoadError(path, "PLY element count exceeds the file size");
+                remaining -= element.count * recordSize;
+            }
+
+            mesh.positions.resize(3 * vertices->count);
+            if (hasNormals)
+                mesh.normals.resize(3 * vertices->count);
+            if (hasUvs)
+                mesh.uvs.resize(2 * vertices->count);
+            //Exact for triangle meshes, grows for polygons; no more triangles than the file holds
+            const size_t triangleSize = faces->minimumSize(ascii) + 3 * (ascii ? 1 : plyTypeSize(faces->properties[indexProperty].type));
+            mesh.indices.reserve(3 * std::min(faces->count, static_cast<size_t>(end - body) / triangleSize));
+
+            bool ok = true;
+            if (ascii)
+            {
+                PlyAsciiReader reader{ body, end };
+                for (const PlyElement& element : elements)
+                    if (&element == vertices)
+                        ok = ok && readPlyVertices(reader, element, layout, 0, element.count, mesh);
+                    else if (&element == faces)
+                        ok = ok && readPlyFaces(reader, element, indexProperty, vertices->count, mesh);
+                    else
+                        ok = ok && skipPlyElement(reader, element);
+            }
+            else
+            {
+                const uint16_t probe = 1;
+                const bool littleEndianHost = *reinterpret_cast<const uint8_t*>(&probe) == 1;
+                const bool swapBytes = (format == 2) == littleEndianHost;
+                PlyBinaryReader reader{ reinterpret_cast<const uint8_t*>(body), file.data() + file.size(), swapBytes };
+                for (const PlyElement& element : elements)
+                    if (&element == vertices && element.stride > 0)
+                    {
+                        //Fixed size records: split into ranges read in parallel
+                        if (static_cast<size_t>(reader.end - reader.p) / element.stride < element.count)
+                            return meshLoadError(path, "truncated PLY vertex data");
+                        const size_t chunkSize = 1 << 16;
+                        const size_t chunks = (element.count + chunkSize - 1) / chunkSize;
+                        std::unique_ptr<Utils::ThreadPool> pool;
+                        if (threadCount != 1 && chunks > 1)
+                            pool.reset(new Utils::ThreadPool(threadCount));
+                        std::atomic<bool> chunksOk(true);
+                        const uint8_t* start = reader.p;
+                        runChunks(pool.get(), chunks, [&](size_t c)
+                        {
+                            const size_t first = c * chunkSize;
+                            const size_t last = std::min(element.count, first + chunkSize);
+                            PlyBinaryReader range{ start + first * element.stride, start + last * element.stride, swapBytes };
+                            if (!readPlyVertices(range, element, layout, first, last, mesh))
+                                chunksOk = false;
+                        });
+                        ok = ok && chunksOk;
+                        reader.p += element.count * element.stride;
+                    }
+                    else if (&element == vertices)
+                        ok = ok && readPlyVertices(reader, element, layout, 0, element.count, mesh);
+                    else if (&element == faces)
+                        ok = ok && readPlyFaces(reader, element, indexProperty, vertices->count, mesh);
+                    else
+                        ok = ok && skipPlyElement(reader, element);
+            }
+            if (!ok)
+            {
+                mesh = MeshData();
+                return meshLoadError(path, "malformed PLY data or vertex index out of range");
+            }
+            mesh.indices.shrink_to_fit();
+            return true;
+        }
+
+        // Wavefront OBJ: v, vt, vn and f statements (faces fanned into triangles, negative
+        // indices resolved); groups, materials and other statements are ignored. The mapped
+        // file is split at line breaks and parsed on threadCount threads (0 - one per hardware
+        // thread, 1 - serial) in two passes: the first counts statements, so the second can
+        // write every chunk straight into buffers allocated once. Errors as for loadPly().
+        inline bool loadObj(const std::string& path, MeshData& mesh, size_t threadCount = 0)
+        {
+            using namespace Detail;
+            mesh = MeshData();
+            Utils::MappedFile file(path);
+            if (!file.valid())
+                return meshLoadError(path, "cannot open file");
+            const char* text = reinterpret_cast<const char*>(file.data());
+            const char* end = text + file.size();
+
+            //A few chunks per thread, but none smaller than 1 MiB
+            const size_t threads = threadCount == 0 ? Utils::ThreadPool::defaultThreadCount() : threadCount;
+            const size_t chunkCount = std::max<size_t>(1, std::min(4 * threads, file.size() >> 20));
+            const std::vector<const char*> bounds = lineChunks(text, end, chunkCount);
+            const size_t chunks = bounds.size() - 1;
+            std::unique_ptr<Utils::ThreadPool> pool;
+            if (threads > 1 && chunks > 1)
+                pool.reset(new Utils::ThreadPool(threads));
+
+            std::vector<ObjChunk> counts(chunks);
+            runChunks(pool.get(), chunks, [&](size_t c) { countObjChunk(bounds[c], bounds[c + 1], counts[c]); });
+
+            //Offsets of each chunk's statements, and the totals
+            std::vector<ObjChunk> offsets(chunks + 1);
+            for (size_t c = 0; c < chunks; ++c)
+            {
+                offsets[c + 1].positions = offsets[c].positions + counts[c].positions;
+                offsets[c + 1].normals = offsets[c].normals + counts[c].normals;
+                offsets[c + 1].uvs = offsets[c].uvs + counts[c].uvs;
+                offsets[c + 1].triangles = offsets[c].triangles + counts[c].triangles;
+                offsets[c + 1].faceNormals = offsets[c].faceNormals || counts[c].faceNormals;
+                offsets[c + 1].faceUvs = offsets[c].faceUvs || counts[c].faceUvs;
+            }
+            const ObjChunk& totals = offsets[chunks];
+            if (totals.positions > MeshData::noAttribute || totals.normals > MeshData::noAttribute || totals.uvs > MeshData::noAttribute)
+                return meshLoadError(path, "too many vertices");
+
+            mesh.positions.resize(3 * totals.positions);
+            mesh.normals.resize(3 * totals.normals);
+            mesh.uvs.resize(2 * totals.uvs);
+            mesh.indices.resize(3 * totals.triangles);
+            mesh.normalIndices.resize(totals.faceNormals ? 3 * totals.triangles : 0);
+            mesh.uvIndices.resize(totals.faceUvs ? 3 * totals.triangles : 0);
+
+            std::atomic<bool> ok(true);
+            runChunks(pool.get(), chunks, [&](size_t c)
+            {
+                if (!parseObjChunk(bounds[c], bounds[c + 1], offsets[c], totals, offsets[c + 1].triangles, mesh))
+                    ok = false;
+            });
+            if (!ok)
+            {
+                mesh = MeshData();
+                return meshLoadError(path, "malformed OBJ statement or index out of range");
+            }
+            //Attributes no face refers to would be indexed like the positions
+            if (!totals.faceNormals)
+                std::vector<float>().swap(mesh.normals);
+            if (!totals.faceUvs)
+                std::vector<float>().swap(mesh.uvs);
+            return true;
+        }
+
+        // loadPly() or loadObj() by file extension.
+        inline bool loadMesh(const std::string& path, MeshData& mesh, size_t threadCount = 0)
+        {
+            const size_t dot = path.find_last_of('.');
+            std::string extension = dot == std::string::npos ? "" : path.substr(dot + 1);
+            std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+            if (extension == "ply")
+                return loadPly(path, mesh, threadCount);
+            if (extension == "obj")
+                return loadObj(path, mesh, threadCount);
+            mesh = MeshData();
+            return Detail::meshLoadError(path, "unknown mesh file extension");
+        }
+    }
+}
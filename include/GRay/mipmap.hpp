@@ -0,0 +1,223 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/texelFormat.hpp>
+#include <algorithm>
+#include <cmath>
+#include <list>
+#include <vector>
+
+namespace GRay
+{
+    namespace Materials
+    {
+        // Pyramid levels stored as square tiles of tileSize x tileSize RGB texels, row by row
+        // within a tile and tiles row by row within a level, in one TexelFormat. Edge tiles are
+        // padded to full size.
+        class TileSource
+        {
+        public:
+            static const int tileSize = 32;
+            static const size_t tileTexels = static_cast<size_t>(tileSize) * tileSize;
+
+            static size_t tileBytes(TexelFormat format) { return tileTexels * texelBytes(format); }
+
+            static size_t tilesAcross(int width) { return (width + tileSize - 1) / tileSize; }
+            static size_t tileCount(int width, int height) { return tilesAcross(width) * tilesAcross(height); }
+
+            virtual ~TileSource() = default;
+            // Texels of tile index of a level. The pointer stays valid until the calling thread
+            // asks this source for another tile.
+            virtual const uint8_t* tile(int level, size_t index) const = 0;
+        };
+
+        // Box-filtered pyramid over a float RGB image, top row first. Levels are either stored
+        // row by row in memory, level 0 being the caller's pixels, which must outlive the
+        // pyramid, or fetched tile by tile from a TileSource. Every level after the first
+        // averages 2x2 texels of the previous one, down to a single texel.
+        class MipPyramid
+        {
+        public:
+            // One level of the pyramid, possibly living in memory the pyramid does not own.
+            struct LevelView
+            {
+                int width, height;
+                const float* texels; //row by row, or null when the level comes from the tile source
+            };
+
+            MipPyramid() : wrapX{ false }, tileFormat{ TexelFormat::Float32 } {}
+            // wrap: x repeats (lat-long maps); otherwise both axes clamp to the edge.
+            MipPyramid(const float* pixels, int width, int height, bool wrap) : wrapX{ wrap }, tileFormat{ TexelFormat::Float32 }
+            {
+                if (!pixels)
+                    return;
+                views.push_back(LevelView{ width, height, pixels });
+                int w = width, h = height;
+                while (w > 1 || h > 1)
+                {
+                    std::vector<float> next;
+                    int nextWidth = std::max(w / 2, 1);
+                    int nextHeight = std::max(h / 2, 1);
+                    next.resize(static_cast<size_t>(nextWidth) * nextHeight * 3);
+                    int level = levels() - 1;
+                    for (int j = 0; j < nextHeight; ++j)
+                        for (int i = 0; i < nextWidth; ++i)
+                        {
+                            int si = std::min(2 * i + 1, w - 1);
+                            int sj = std::min(2 * j + 1, h - 1);
+                            float a[3], b[3], c[3], d[3];
+                            fetch(level, 2 * i, 2 * j, a);
+                            fetch(level, si, 2 * j, b);
+                            fetch(level, 2 * i, sj, c);
+                            fetch(level, si, sj, d);
+                            float* out = &next[(static_cast<size_t>(j) * nextWidth + i) * 3];
+                            for (int k = 0; k < 3; ++k)
+                                out[k] = 0.25f * (a[k] + b[k] + c[k] + d[k]);
+                        }
+                    storage.push_back(std::move(next));
+                    views.push_back(LevelView{ nextWidth, nextHeight, storage.back().data() });
+                    w = nextWidth;
+                    h = nextHeight;
+                }
+            }
+
+            // Adopts levels computed earlier, e.g. stored in a texture cache file; tiles holds
+            // those without texels, in format.
+            MipPyramid(const std::vector<LevelView>& levels, bool wrap, shared_ptr<const TileSource> tiles = nullptr,
+                TexelFormat format = TexelFormat::Float32)
+                : wrapX{ wrap }, views(levels), tiles{ tiles }, tileFormat{ format } {}
+
+            // Views point into storage, so copies would dangle; moves keep the buffers.
+            MipPyramid(const MipPyramid&) = delete;
+            MipPyramid& operator=(const MipPyramid&) = delete;
+            MipPyramid(MipPyramid&&) = default;
+            MipPyramid& operator=(MipPyramid&&) = default;
+
+            int levels() const { return static_cast<int>(views.size()); }
+            const LevelView& level(int index) const { return views[index]; }
+
+            // Size of the texels of every level, wherever they live.
+            size_t memoryBytes() const
+            {
+                size_t bytes = 0;
+                for (const LevelView& l : views)
+                    bytes += static_cast<size_t>(l.width) * l.height * (l.texels ? 3 * sizeof(float) : texelBytes(tileFormat));
+                return bytes;
+            }
+
+            Math::Color texel(int level, int i, int j) const
+            {
+                float c[3];
+                fetch(level, i, j, c);
+                return Math::Color(c[0], c[1], c[2]);
+            }
+
+            // Level stored tile by tile in format.
+            std::vector<uint8_t> tiledLevel(int level, TexelFormat format) const
+            {
+                const LevelView& l = views[level];
+                size_t rowBytes = TileSource::tilesAcross(l.width) * TileSource::tileBytes(format);
+                std::vector<uint8_t> tiled(TileSource::tilesAcross(l.height) * rowBytes);
+                for (size_t row = 0; row < TileSource::tilesAcross(l.height); ++row)
+                    encodeTileRow(level, row, format, &tiled[row * rowBytes]);
+                return tiled;
+            }
+
+            // Tiles of row (counted in tiles) of a level in format, tilesAcross(width) tiles of
+            // tileBytes(format) each, e.g. to write a texture cache one row at a time.
+            void encodeTileRow(int level, size_t row, TexelFormat format, uint8_t* out) const
+            {
+                const LevelView& l = views[level];
+                size_t stride = texelBytes(format);
+                std::fill(out, out + TileSource::tilesAcross(l.width) * TileSource::tileBytes(format), uint8_t(0));
+                int j1 = std::min(static_cast<int>(row + 1) * TileSource::tileSize, l.height);
+                for (int j = static_cast<int>(row) * TileSource::tileSize; j < j1; ++j)
+                    for (int i = 0; i < l.width; ++i)
+                    {
+                        size_t tile = i / TileSource::tileSize;
+                        size_t at = tile * TileSource::tileTexels + (j % TileSource::tileSize) * TileSource::tileSize + i % TileSource::tileSize;
+                        float texel[3];
+                        fetch(level, i, j, texel);
+                        encodeTexel(format, texel, out + at * stride);
+                    }
+            }
+
+            // Level whose texels match a footprint of the given width in texture coordinates.
+            double levelFor(double footprint) const
+            {
+                if (footprint <= 0 || views.empty())
+                    return 0;
+                return std::log2(footprint * std::sqrt(static_cast<double>(views[0].width) * views[0].height));
+            }
+
+            // x, y in [0, 1], y = 0 at the top row. Fractional levels blend the two nearest.
+            Math::Color trilinear(double x, double y, double level) const
+            {
+                level = Utils::clamp(level, 0.0, levels() - 1.0);
+                int lower = static_cast<int>(level);
+                double t = level - lower;
+                Math::Color c = bilinear(lower, x, y);
+                if (t > 0 && lower + 1 < levels())
+                    c = (1 - t) * c + t * bilinear(lower + 1, x, y);
+                return c;
+            }
+
+            Math::Color bilinear(int level, double x, double y) const
+            {
+                int w = views[level].width;
+                int h = views[level].height;
+                double fx = x * w - 0.5;
+                double fy = Utils::clamp(y * h - 0.5, 0.0, h - 1.0);
+                if (!wrapX)
+                    fx = Utils::clamp(fx, 0.0, w - 1.0);
+                int i0 = static_cast<int>(std::floor(fx));
+                int j0 = static_cast<int>(fy);
+                double tx = fx - i0;
+                double ty = fy - j0;
+                int i1 = i0 + 1;
+                int j1 = std::min(j0 + 1, h - 1);
+                if (wrapX)
+                {
+                    i0 = (i0 % w + w) % w;
+                    i1 = (i1 % w + w) % w;
+                }
+                else
+                    i1 = std::min(i1, w - 1);
+
+                float a[3], b[3], c[3], d[3];
+                fetch(level, i0, j0, a);
+                fetch(level, i1, j0, b);
+                fetch(level, i0, j1, c);
+                fetch(level, i1, j1, d);
+                Math::Color result;
+                for (int k = 0; k < 3; ++k)
+                    result[k] = (1 - ty) * ((1 - tx) * a[k] + tx * b[k]) + ty * ((1 - tx) * c[k] + tx * d[k]);
+                return result;
+            }
+
+        private:
+            void fetch(int level, int i, int j, float out[3]) const
+            {
+                const LevelView& l = views[level];
+                if (l.texels)
+                {
+                    const float* texel = l.texels + (static_cast<size_t>(j) * l.width + i) * 3;
+                    out[0] = texel[0];
+                    out[1] = texel[1];
+                    out[2] = texel[2];
+                    return;
+                }
+                size_t tile = (j / TileSource::tileSize) * TileSource::tilesAcross(l.width) + i / TileSource::tileSize;
+                size_t at = (j % TileSource::tileSize) * TileSource::tileSize + i % TileSource::tileSize;
+                decodeTexel(tileFormat, tiles->tile(level, tile) + at * texelBytes(tileFormat), out);
+            }
+
+        private:
+            bool wrapX;
+            std::vector<LevelView> views;
+            std::list<std::vector<float> > storage; //levels built here
+            shared_ptr<const TileSource> tiles;
+            TexelFormat tileFormat;
+        };
+    }
+}
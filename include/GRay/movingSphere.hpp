@@ -11,10 +11,45 @@ namespace GRay
         {
         public:
             MovingSphere() {}
+            MovingSphere(GRay::Math::Point3 cen0, GRay::Math::Point3 cen1, double _time0, double _time1, double r, MaterialHandle m) :
+                center0{ cen0 }, center1{ cen1 }, time0{ _time0 }, time1{ _time1 }, radius{ r }, material{ m } {}
             MovingSphere(GRay::Math::Point3 cen0, GRay::Math::Point3 cen1, double _time0, double _time1, double r, shared_ptr<GRay::Material> m) :
-                center0{ cen0 }, center1{ cen1 }, time0{ _time0 }, time1{ _time1 }, radius{ r }, matPtr{ m } {}
+                MovingSphere(cen0, cen1, _time0, _time1, r, MaterialRegistry::current().add(m)) {}
 
             bool hit(const GRay::Math::Ray& r, double t_min, double t_max, GRay::Math::hitRecord& rec) const override
+            {
+                return intersectAndFinalize(r, t_min, t_max, rec);
+            }
+            bool intersect(const GRay::Math::Ray& r, double t_min, double t_max, GRay::Math::hitRecord& rec) const override
+            {
+                double t;
+                if (!nearestRoot(r, t_min, t_max, t))
+                    return false;
+                rec.t = t;
+                rec.object = this;
+                return true;
+            }
+            void finalizeHit(const GRay::Math::Ray& r, GRay::Math::hitRecord& rec) const override
+            {
+                rec.p = r.at(rec.t);
+                Math::Vec3 outwardNormal = (rec.p - center(r.time())) / radius;
+                rec.setFaceNormal(r, outwardNormal);
+                rec.material = material;
+            }
+            bool boundingBox(double _time0, double _time1, GRay::Solids::AABB& outputBox) const override;
+            bool occluded(const GRay::Math::Ray& r, double t_min, double t_max) const override
+            {
+                double root;
+                return nearestRoot(r, t_min, t_max, root);
+            }
+            GRay::Math::Point3 center(double time) const;
+        public:
+            GRay::Math::Point3 center0, center1;
+            double time0, time1;
+            double radius;
+            MaterialHandle material;
+        private:
+            bool nearestRoot(const GRay::Math::Ray& r, double t_min, double t_max, double& root) const
             {
                 Math::Vec3 oc = r.origin() - center(r.time());
                 double a = r.direction().lenghtSquared();
@@ -26,27 +61,15 @@ namespace GRay
                     return false;
 
                 double sqrtd = sqrt(discriminant);
-                double root = (-half_b - sqrtd) / a;
+                root = (-half_b - sqrtd) / a;
                 if ((root < t_min) || (t_max < root))
                 {
                     root = (-half_b + sqrtd) / a;
                     if ((root < t_min) || (t_max < root))
                         return false;
                 }
-                rec.t = root;
-                rec.p = r.at(rec.t);
-                Math::Vec3 outwardNormal = (rec.p - center(r.time())) / radius;
-                rec.setFaceNormal(r, outwardNormal);
-                rec.mat_ptr = matPtr;
                 return true;
             }
-            bool boundingBox(double _time0, double _time1, GRay::Solids::AABB& outputBox) const override;
-            GRay::Math::Point3 center(double time) const;
-        public:
-            GRay::Math::Point3 center0, center1;
-            double time0, time1;
-            double radius;
-            shared_ptr<GRay::Material> matPtr;
         };
 
         GRay::Math::Point3 MovingSphere::center(double time) const
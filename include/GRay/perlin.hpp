@@ -9,16 +9,21 @@ namespace GRay
         class Perlin
         {
         public:
-            Perlin()
+            // Tables are a pure function of the seed.
+            Perlin(uint32_t seed = 0)
             {
+                Utils::Random rng(seed, 0, 0x5eed);
                 ranVec = new Math::Vec3[pointCount];
                 for (int i = 0; i < pointCount; i++)
-                    ranVec[i] = Math::randomUnitVector();
-                permX = perlinGeneratePerm();
-                permY = perlinGeneratePerm();
-                permZ = perlinGeneratePerm();
+                    ranVec[i] = Math::randomUnitVector(rng);
+                permX = perlinGeneratePerm(rng);
+                permY = perlinGeneratePerm(rng);
+                permZ = perlinGeneratePerm(rng);
             }
 
+            Perlin(const Perlin&) = delete;
+            Perlin& operator=(const Perlin&) = delete;
+
             ~Perlin()
             {
                 delete[] ranVec;
@@ -27,6 +32,8 @@ namespace GRay
                 delete[] permZ;
             }
 
+            size_t tableBytes() const { return pointCount * (sizeof(Math::Vec3) + 3 * sizeof(int)); }
+
             double turb(const Math::Point3& p, int depth = 7) const
             {
                 double accum = 0.0;
@@ -70,20 +77,20 @@ namespace GRay
             int* permY;
             int* permZ;
 
-            static int* perlinGeneratePerm()
+            static int* perlinGeneratePerm(Utils::Random& rng)
             {
                 auto p = new int[pointCount];
                 for (int i = 0; i < pointCount; ++i)
                     p[i] = i;
-                permute(p, pointCount);
+                permute(p, pointCount, rng);
                 return p;
             }
 
-            static void permute(int* p, int n)
+            static void permute(int* p, int n, Utils::Random& rng)
             {
                 for (int i = n - 1; i > 0; --i)
                 {
-                    int target = Utils::randomInt(0, i);
+                    int target = rng.nextInt(0, i);
                     int tmp = p[i];
                     p[i] = p[target];
                     p[target] = tmp;
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <sys/resource.h>
+#endif
+
+namespace GRay
+{
+    namespace Utils
+    {
+        class Timer
+        {
+        public:
+            Timer() : start{ std::chrono::steady_clock::now() } {}
+
+            double milliseconds() const
+            {
+                return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            }
+
+        private:
+            std::chrono::steady_clock::time_point start;
+        };
+
+        // Reads a "Key:   1234 kB" line from /proc/self/status, 0 when unavailable.
+        inline size_t procStatusBytes(const char* key)
+        {
+            std::ifstream status("/proc/self/status");
+            std::string line;
+            const std::string prefix = std::string(key) + ":";
+            while (std::getline(status, line))
+                if (line.compare(0, prefix.size(), prefix) == 0)
+                    return static_cast<size_t>(std::stoull(line.substr(prefix.size()))) * 1024;
+            return 0;
+        }
+
+        inline size_t currentMemoryBytes()
+        {
+            return procStatusBytes("VmRSS");
+        }
+
+        // High-water mark of the resident set size of the process.
+        inline size_t peakMemoryBytes()
+        {
+            size_t peak = procStatusBytes("VmHWM");
+#if defined(__unix__) || defined(__APPLE__)
+            if (peak == 0)
+            {
+                rusage usage;
+                if (getrusage(RUSAGE_SELF, &usage) == 0)
+                {
+    #if defined(__APPLE__)
+                    peak = static_cast<size_t>(usage.ru_maxrss);
+    #else
+                    peak = static_cast<size_t>(usage.ru_maxrss) * 1024;
+    #endif
+                }
+            }
+#endif
+            return peak;
+        }
+
+        // Resets the high-water mark to the current RSS (Linux only); false when not supported.
+        inline bool resetPeakMemory()
+        {
+            std::ofstream clearRefs("/proc/self/clear_refs");
+            if (!clearRefs)
+                return false;
+            clearRefs << "5";
+            return static_cast<bool>(clearRefs.flush());
+        }
+    }
+}
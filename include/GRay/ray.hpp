@@ -20,10 +20,20 @@ namespace GRay
                 return orig + t * dir;
             }
 
+            // Width of the ray cone at parameter t.
+            double coneWidthAt(double t) const
+            {
+                return coneWidth + t * dir.length() * coneSpread;
+            }
+
         public:
             Point3 orig;
             Point3 dir;
             double tm;
+            //Ray cone for texture filtering: footprint width at the origin and its growth
+            //per unit distance. A zero cone disables filtering.
+            double coneWidth = 0;
+            double coneSpread = 0;
         };
     }
 }
\ No newline at end of file
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/camera.hpp>
+#include <GRay/framebuffer.hpp>
+#include <GRay/threadPool.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace GRay
+{
+    namespace Rendering
+    {
+        struct RenderSettings
+        {
+            RenderSettings(int width, int height, int spp) :
+                imageWidth{ width }, imageHeight{ height }, samplesPerPixel{ spp },
+                tileSize{ 16 }, threadCount{ 0 }, seed{ 0 }, reportProgress{ true } {}
+
+            int imageWidth;
+            int imageHeight;
+            int samplesPerPixel;
+            int tileSize;
+            size_t threadCount; //0 - one thread per hardware thread
+            uint32_t seed;
+            bool reportProgress;
+        };
+
+        // Image region in raster coordinates (y grows downwards), [x0, x1) x [y0, y1).
+        struct Tile
+        {
+            int x0, y0, x1, y1;
+            uint32_t mortonCode;
+        };
+
+        // Interleaves the bits of x and y so that nearby tiles get nearby codes.
+        inline uint32_t mortonCode2D(uint32_t x, uint32_t y)
+        {
+            auto spread = [](uint32_t v)
+            {
+                v &= 0x0000ffff;
+                v = (v | (v << 8)) & 0x00ff00ff;
+                v = (v | (v << 4)) & 0x0f0f0f0f;
+                v = (v | (v << 2)) & 0x33333333;
+                v = (v | (v << 1)) & 0x55555555;
+                return v;
+            };
+            return spread(x) | (spread(y) << 1);
+        }
+
+        class TileRenderer
+        {
+        public:
+            // Receives the camera ray and the sample's random stream, positioned at bounce 1 (bounce 0 is the camera's).
+            typedef std::function<Math::Color(const Math::Ray&, Utils::Random&)> RadianceFunction;
+
+            explicit TileRenderer(const RenderSettings& s) : settings{ s }, pool{ s.threadCount } {}
+
+            Framebuffer render(const Camera& cam, const RadianceFunction& radiance);
+
+            std::vector<Tile> makeTiles() const;
+
+        private:
+            struct TileQueue
+            {
+                std::mutex mutex;
+                std::deque<Tile> tiles;
+            };
+
+            static bool nextTile(std::vector<std::unique_ptr<TileQueue> >& queues, size_t self, Tile& tile);
+            void renderTile(const Tile& tile, const Camera& cam, const RadianceFunction& radiance, Framebuffer& fb) const;
+
+        private:
+            RenderSettings settings;
+            Utils::ThreadPool pool;
+        };
+
+        inline std::vector<Tile> TileRenderer::makeTiles() const
+        {
+            const int tileSize = std::max(1, settings.tileSize);
+            std::vector<Tile> tiles;
+            for (int ty = 0; ty * tileSize < settings.imageHeight; ++ty)
+                for (int tx = 0; tx * tileSize < settings.imageWidth; ++tx)
+                {
+                    Tile tile;
+                    tile.x0 = tx * tileSize;
+                    tile.y0 = ty * tileSize;
+                    tile.x1 = std::min(tile.x0 + tileSize, settings.imageWidth);
+                    tile.y1 = std::min(tile.y0 + tileSize, settings.imageHeight);
+                    tile.mortonCode = mortonCode2D(tx, ty);
+                    tiles.push_back(tile);
+                }
+            std::sort(tiles.begin(), tiles.end(), [](const Tile& a, const Tile& b) { return a.mortonCode < b.mortonCode; });
+            return tiles;
+        }
+
+        // Pops from the front of the worker's own queue, otherwise steals from the back of another one.
+        inline bool TileRenderer::nextTile(std::vector<std::unique_ptr<TileQueue> >& queues, size_t self, Tile& tile)
+        {
+            {
+                TileQueue& own = *queues[self];
+                std::lock_guard<std::mutex> lock(own.mutex);
+                if (!own.tiles.empty())
+                {
+                    tile = own.tiles.front();
+                    own.tiles.pop_front();
+                    return true;
+                }
+            }
+            for (size_t k = 1; k < queues.size(); ++k)
+            {
+                TileQueue& victim = *queues[(self + k) % queues.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.tiles.empty())
+                {
+                    tile = victim.tiles.back();
+                    victim.tiles.pop_back();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        inline void TileRenderer::renderTile(const Tile& tile, const Camera& cam, const RadianceFunction& radiance, Framebuffer& fb) const
+        {
+            const int width = settings.imageWidth;
+            const int height = settings.imageHeight;
+            const double coneSpread = cam.pixelSpread(height);
+            for (int y = tile.y0; y < tile.y1; ++y)
+            {
+                const int j = height - 1 - y;
+                for (int i = tile.x0; i < tile.x1; ++i)
+                {
+                    const uint32_t pixelIndex = static_cast<uint32_t>(y) * width + i;
+                    Math::Color pixelColor(0, 0, 0);
+                    for (int s = 0; s < settings.samplesPerPixel; ++s)
+                    {
+                        Utils::Random rng(pixelIndex, s, settings.seed);
+                        double u = (i + rng.nextDouble()) / (width - 1);
+                        double v = (j + rng.nextDouble()) / (height - 1);
+                        Math::Ray ray = cam.getRay(u, v, rng);
+                        ray.coneSpread = coneSpread;
+                        rng.setBounce(1); //bounce 0 belongs to the camera, paths start after it
+                        pixelColor += radiance(ray, rng);
+                    }
+                    fb.at(i, y) = pixelColor;
+                }
+            }
+        }
+
+        inline Framebuffer TileRenderer::render(const Camera& cam, const RadianceFunction& radiance)
+        {
+            Framebuffer fb(settings.imageWidth, settings.imageHeight);
+            std::vector<Tile> tiles = makeTiles();
+
+            //Hand out contiguous runs of the Morton curve so each worker starts on a compact image region
+            const size_t workerCount = std::max<size_t>(1, std::min(pool.size(), tiles.size()));
+            std::vector<std::unique_ptr<TileQueue> > queues;
+            for (size_t w = 0; w < workerCount; ++w)
+            {
+                queues.emplace_back(new TileQueue());
+                size_t begin = tiles.size() * w / workerCount;
+                size_t end = tiles.size() * (w + 1) / workerCount;
+                queues.back()->tiles.assign(tiles.begin() + begin, tiles.begin() + end);
+            }
+
+            std::atomic<size_t> tilesDone(0);
+            std::vector<std::future<void> > workers;
+            for (size_t w = 0; w < workerCount; ++w)
+                workers.push_back(pool.submit([&, w]
+                {
+                    Tile tile;
+                    while (nextTile(queues, w, tile))
+                    {
+                        renderTile(tile, cam, radiance, fb);
+                        ++tilesDone;
+                    }
+                }));
+
+            for (std::future<void>& worker : workers)
+            {
+                while (worker.wait_for(std::chrono::milliseconds(250)) != std::future_status::ready)
+                    if (settings.reportProgress)
+                        std::cerr << "\rTiles remaining: " << tiles.size() - tilesDone << "   " << std::flush;
+                worker.get();
+            }
+            if (settings.reportProgress)
+                std::cerr << "\rTiles remaining: 0   " << std::flush;
+
+            return fb;
+        }
+    }
+}
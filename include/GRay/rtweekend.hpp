@@ -3,7 +3,8 @@
 #include <cmath>
 #include <limits>
 #include <memory>
-#include <cstdlib>
+#include <cstdint>
+#include <atomic>
 
 //Usings
 using std::shared_ptr;
@@ -25,9 +26,87 @@ namespace GRay
             return degrees * pi / 180.0;
         }
 
+        // Counter-based generator (pcg4d hash, Jarzynski & Olano 2020). Every value is a pure
+        // function of (pixel, sample, bounce, dimension), so a sample can be reproduced
+        // bit-exactly regardless of which thread renders it or in which order.
+        class Random
+        {
+        public:
+            Random(uint32_t pixel = 0, uint32_t sample = 0, uint32_t seed = 0) :
+                pixelKey{ pixel + seed * 0x9e3779b9u }, sampleKey{ sample }, bounce{ 0 }, dimension{ 0 }, cached{ 4 } {}
+
+            // Restarts the dimension counter for a new path vertex.
+            void setBounce(uint32_t b)
+            {
+                bounce = b;
+                dimension = 0;
+                cached = 4;
+            }
+
+            uint32_t bounceIndex() const { return bounce; }
+
+            uint32_t nextUInt()
+            {
+                if (cached == 4)
+                {
+                    pcg4d(pixelKey, sampleKey, bounce, dimension, block);
+                    dimension += 4;
+                    if (dimension == 0)
+                        ++bounce; //counter wrapped, keep the stream going
+                    cached = 0;
+                }
+                return block[cached++];
+            }
+
+            // Uniform in [0, 1).
+            double nextDouble()
+            {
+                return nextUInt() * (1.0 / 4294967296.0);
+            }
+
+            double nextDouble(double min, double max)
+            {
+                return min + (max - min) * nextDouble();
+            }
+
+            int nextInt(int min, int max)
+            {
+                return static_cast<int>(nextDouble(min, max + 1));
+            }
+
+            static void pcg4d(uint32_t x, uint32_t y, uint32_t z, uint32_t w, uint32_t out[4])
+            {
+                x = x * 1664525u + 1013904223u;
+                y = y * 1664525u + 1013904223u;
+                z = z * 1664525u + 1013904223u;
+                w = w * 1664525u + 1013904223u;
+                x += y * w; y += z * x; z += x * y; w += y * z;
+                x ^= x >> 16; y ^= y >> 16; z ^= z >> 16; w ^= w >> 16;
+                x += y * w; y += z * x; z += x * y; w += y * z;
+                out[0] = x; out[1] = y; out[2] = z; out[3] = w;
+            }
+
+        private:
+            uint32_t pixelKey;
+            uint32_t sampleKey;
+            uint32_t bounce;
+            uint32_t dimension;
+            uint32_t block[4];
+            int cached;
+        };
+
+        // Stream for code that is not driven by a render sample (scene construction, tools).
+        // Each thread gets its own stream; the first thread to ask (normally main) gets stream 0.
+        inline Random& threadRandom()
+        {
+            static std::atomic<uint32_t> nextStream(0);
+            thread_local Random rng(0xffffffffu, nextStream++);
+            return rng;
+        }
+
         inline double randomDouble()
         {
-            return rand() / (RAND_MAX + 1.0);
+            return threadRandom().nextDouble();
         }
 
         inline double randomDouble(double min, double max)
@@ -7,19 +7,66 @@ namespace GRay
 {
     namespace Solids
     {
+        namespace Detail
+        {
+            // Nearest root of the ray-sphere quadratic inside [t_min, t_max].
+            inline bool nearestSphereRoot(const Math::Point3& center, double radius, const Math::Ray& r, double t_min, double t_max, double& root)
+            {
+                Math::Vec3 oc = r.origin() - center;
+                double a = r.direction().lenghtSquared();
+                double half_b = Math::dot(oc, r.direction());
+                double c = oc.lenghtSquared() - radius * radius;
+                double discriminant = half_b * half_b - a * c;
+
+                if (discriminant < 0)
+                    return false;
+
+                double sqrtd = sqrt(discriminant);
+                root = (-half_b - sqrtd) / a;
+                if ((root < t_min) || (t_max < root))
+                {
+                    root = (-half_b + sqrtd) / a;
+                    if ((root < t_min) || (t_max < root))
+                        return false;
+                }
+                return true;
+            }
+        }
+
         class Sphere : public GRay::Math::Hittable
         {
         public:
             Sphere() {}
-            Sphere(Math::Point3 cen, double r, shared_ptr<GRay::Material> m) : center{ cen }, radius{ r }, mat_ptr{ m } {}
+            Sphere(Math::Point3 cen, double r, MaterialHandle m) : center{ cen }, radius{ r }, material{ m } {}
+            Sphere(Math::Point3 cen, double r, shared_ptr<GRay::Material> m) : Sphere(cen, r, MaterialRegistry::current().add(m)) {}
 
-            bool hit(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const override;
+            bool hit(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const override
+            {
+                return intersectAndFinalize(r, t_min, t_max, rec);
+            }
+            bool intersect(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const override
+            {
+                double t;
+                if (!nearestRoot(r, t_min, t_max, t))
+                    return false;
+                rec.t = t;
+                rec.object = this;
+                return true;
+            }
+            void finalizeHit(const Math::Ray& r, Math::hitRecord& rec) const override;
+            bool sampleSurface(const Math::Point3& origin, Utils::Random& rng, Math::SurfaceSample& sample) const override;
+            double surfacePdf(const Math::Point3& origin, const Math::hitRecord& rec) const override;
             bool boundingBox(double time0, double time1, GRay::Solids::AABB& outputBox) const override;
+            bool occluded(const Math::Ray& r, double t_min, double t_max) const override
+            {
+                double root;
+                return nearestRoot(r, t_min, t_max, root);
+            }
         public:
             Math::Point3 center;
             double radius;
-            shared_ptr<GRay::Material> mat_ptr;
-        private:
+            MaterialHandle material;
+
             static void getSphereUV(const Math::Point3& p, double& u, double& v)
             {
                 // p: a given point on the sphere of radius one, centered at the origin.
@@ -33,34 +80,85 @@ namespace GRay
                 u = phi / 2 / Math::pi;
                 v = theta / Math::pi;
             }
+        private:
+            bool nearestRoot(const Math::Ray& r, double t_min, double t_max, double& root) const;
+            bool containsPoint(const Math::Point3& p) const { return (center - p).lenghtSquared() <= radius * radius * (1 + 1e-6); }
+            double areaPdf(const Math::Point3& origin, const Math::Point3& p) const;
+            double conePdf(const Math::Point3& origin) const;
         };
 
-        bool Sphere::hit(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const
+        inline bool Sphere::nearestRoot(const Math::Ray& r, double t_min, double t_max, double& root) const
+        {
+            return Detail::nearestSphereRoot(center, radius, r, t_min, t_max, root);
+        }
+
+        inline void Sphere::finalizeHit(const Math::Ray& r, Math::hitRecord& rec) const
         {
-            Math::Vec3 oc = r.origin() - center;
-            double a = r.direction().lenghtSquared();
-            double half_b = Math::dot(oc, r.direction());
-            double c = oc.lenghtSquared() - radius * radius;
-            double discriminant = half_b * half_b - a * c;
-
-            if (discriminant < 0)
-                return false;
-
-            double sqrtd = sqrt(discriminant);
-            double root = (-half_b - sqrtd) / a;
-            if ((root < t_min) || (t_max < root))
-            {
-                root = (-half_b + sqrtd) / a;
-                if ((root < t_min) || (t_max < root))
-                    return false;
-            }
-            rec.t = root;
             rec.p = r.at(rec.t);
             Math::Vec3 outwardNormal = (rec.p - center) / radius;
             rec.setFaceNormal(r, outwardNormal);
             getSphereUV(outwardNormal, rec.u, rec.v);
-            rec.mat_ptr = mat_ptr;
-            return true;
+            rec.uvDensity = 1 / (Math::pi * fabs(radius) * sqrt(2.0)); //geometric mean of du and dv at the equator
+            rec.material = material;
+        }
+
+        // Solid angle density of a uniformly chosen surface point.
+        inline double Sphere::areaPdf(const Math::Point3& origin, const Math::Point3& p) const
+        {
+            Math::Vec3 toLight = p - origin;
+            double distanceSquared = toLight.lenghtSquared();
+            double cosine = fabs(Math::dot(toLight, (p - center) / radius)) / sqrt(distanceSquared);
+            if (cosine < 1e-8)
+                return 0;
+            return distanceSquared / (cosine * 4 * Math::pi * radius * radius);
+        }
+
+        // Density of a uniform direction inside the cone the sphere subtends from origin.
+        inline double Sphere::conePdf(const Math::Point3& origin) const
+        {
+            double cosThetaMax = sqrt(1 - radius * radius / (center - origin).lenghtSquared());
+            return 1 / (2 * Math::pi * (1 - cosThetaMax));
+        }
+
+        // Outside the sphere, samples directions uniformly inside the cone it subtends, so the
+        // pdf is constant; inside, falls back to uniform area sampling.
+        inline bool Sphere::sampleSurface(const Math::Point3& origin, Utils::Random& rng, Math::SurfaceSample& sample) const
+        {
+            if (containsPoint(origin))
+            {
+                sample.normal = Math::randomUnitVector(rng);
+                sample.p = center + radius * sample.normal;
+                sample.pdf = areaPdf(origin, sample.p);
+            }
+            else
+            {
+                Math::Vec3 toCenter = center - origin;
+                double distanceSquared = toCenter.lenghtSquared();
+                double cosThetaMax = sqrt(1 - radius * radius / distanceSquared);
+                double cosTheta = 1 + rng.nextDouble() * (cosThetaMax - 1);
+                double sinTheta = sqrt(fmax(0.0, 1 - cosTheta * cosTheta));
+                double phi = 2 * Math::pi * rng.nextDouble();
+
+                Math::Vec3 w = toCenter / sqrt(distanceSquared);
+                Math::Vec3 a, b;
+                Math::orthonormalBasis(w, a, b);
+                Math::Vec3 direction = cos(phi) * sinTheta * a + sin(phi) * sinTheta * b + cosTheta * w;
+
+                double t;
+                if (!nearestRoot(Math::Ray(origin, direction), 0, Utils::infinity, t))
+                    t = Math::dot(toCenter, direction); //grazing direction that missed by rounding
+                sample.p = origin + t * direction;
+                sample.normal = (sample.p - center) / radius;
+                sample.pdf = conePdf(origin);
+            }
+            getSphereUV(sample.normal, sample.u, sample.v);
+            sample.material = material;
+            return sample.pdf > 0;
+        }
+
+        inline double Sphere::surfacePdf(const Math::Point3& origin, const Math::hitRecord& rec) const
+        {
+            return containsPoint(origin) ? areaPdf(origin, rec.p) : conePdf(origin);
         }
 
         bool Sphere::boundingBox(double time0, double time1, GRay::Solids::AABB& outputBox) const
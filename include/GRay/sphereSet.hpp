@@ -0,0 +1,296 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/hittable.hpp>
+#include <GRay/sphere.hpp>
+#include <GRay/bvhBuilder.hpp>
+#include <GRay/wideBvh.hpp>
+#include <GRay/alignedAllocator.hpp>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace GRay
+{
+    namespace Solids
+    {
+        // Up to eight spheres in SoA layout, so one SIMD pass tests all of them. Unused lanes
+        // have NaN centres, which fail every comparison.
+        struct alignas(32) SpherePacket
+        {
+            static const int lanes = 8;
+
+            float centerX[lanes];
+            float centerY[lanes];
+            float centerZ[lanes];
+            float radius[lanes];
+        };
+
+        // Ray data in the float layout the packet tests want, computed once per ray.
+        struct SpherePacketRay
+        {
+            explicit SpherePacketRay(const GRay::Math::Ray& r)
+            {
+                for (int a = 0; a < 3; ++a)
+                {
+                    origin[a] = static_cast<float>(r.origin()[a]);
+                    direction[a] = static_cast<float>(r.direction()[a]);
+                }
+                lengthSquared = direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2];
+            }
+
+            float origin[3];
+            float direction[3];
+            float lengthSquared;
+        };
+
+        namespace Detail
+        {
+            // Relative slack on the float discriminant, several times its rounding error, so the
+            // packet test only drops spheres the double precision test would miss as well.
+            const float spherePacketSlack = 1e-5f;
+
+            // Sets bit i when the ray's line may cross the sphere in lane i. Candidates still need
+            // nearestSphereRoot() for the distance.
+            inline unsigned spherePacketTestScalar(const SpherePacket& packet, const SpherePacketRay& ray, int first, int lanes)
+            {
+                unsigned mask = 0;
+                for (int i = first; i < first + lanes; ++i)
+                {
+                    const float ocx = ray.origin[0] - packet.centerX[i];
+                    const float ocy = ray.origin[1] - packet.centerY[i];
+                    const float ocz = ray.origin[2] - packet.centerZ[i];
+                    const float halfB = ocx * ray.direction[0] + ocy * ray.direction[1] + ocz * ray.direction[2];
+                    const float ocSquared = ocx * ocx + ocy * ocy + ocz * ocz;
+                    const float radiusSquared = packet.radius[i] * packet.radius[i];
+                    const float discriminant = halfB * halfB - ray.lengthSquared * (ocSquared - radiusSquared);
+                    const float slack = spherePacketSlack * (halfB * halfB + ray.lengthSquared * (ocSquared + radiusSquared));
+                    if (discriminant >= -slack)
+                        mask |= 1u << i;
+                }
+                return mask;
+            }
+
+#if defined(GRAY_WIDE_BVH_SSE)
+            inline unsigned spherePacketTestSse(const SpherePacket& packet, const SpherePacketRay& ray, int first)
+            {
+                const __m128 ocx = _mm_sub_ps(_mm_set1_ps(ray.origin[0]), _mm_load_ps(packet.centerX + first));
+                const __m128 ocy = _mm_sub_ps(_mm_set1_ps(ray.origin[1]), _mm_load_ps(packet.centerY + first));
+                const __m128 ocz = _mm_sub_ps(_mm_set1_ps(ray.origin[2]), _mm_load_ps(packet.centerZ + first));
+                const __m128 radius = _mm_load_ps(packet.radius + first);
+                const __m128 halfB = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, _mm_set1_ps(ray.direction[0])),
+                    _mm_mul_ps(ocy, _mm_set1_ps(ray.direction[1]))), _mm_mul_ps(ocz, _mm_set1_ps(ray.direction[2])));
+                const __m128 ocSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz));
+                const __m128 radiusSquared = _mm_mul_ps(radius, radius);
+                const __m128 a = _mm_set1_ps(ray.lengthSquared);
+                const __m128 halfBSquared = _mm_mul_ps(halfB, halfB);
+                const __m128 discriminant = _mm_sub_ps(halfBSquared, _mm_mul_ps(a, _mm_sub_ps(ocSquared, radiusSquared)));
+                const __m128 slack = _mm_mul_ps(_mm_set1_ps(-spherePacketSlack), _mm_add_ps(halfBSquared, _mm_mul_ps(a, _mm_add_ps(ocSquared, radiusSquared))));
+                //Ordered compare: NaN lanes are never candidates
+                return static_cast<unsigned>(_mm_movemask_ps(_mm_cmpge_ps(discriminant, slack))) << first;
+            }
+#endif
+
+#if defined(GRAY_WIDE_BVH_AVX)
+            inline unsigned spherePacketTestAvx(const SpherePacket& packet, const SpherePacketRay& ray)
+            {
+                const __m256 ocx = _mm256_sub_ps(_mm256_set1_ps(ray.origin[0]), _mm256_load_ps(packet.centerX));
+                const __m256 ocy = _mm256_sub_ps(_mm256_set1_ps(ray.origin[1]), _mm256_load_ps(packet.centerY));
+                const __m256 ocz = _mm256_sub_ps(_mm256_set1_ps(ray.origin[2]), _mm256_load_ps(packet.centerZ));
+                const __m256 radius = _mm256_load_ps(packet.radius);
+                const __m256 halfB = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, _mm256_set1_ps(ray.direction[0])),
+                    _mm256_mul_ps(ocy, _mm256_set1_ps(ray.direction[1]))), _mm256_mul_ps(ocz, _mm256_set1_ps(ray.direction[2])));
+                const __m256 ocSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz));
+                const __m256 radiusSquared = _mm256_mul_ps(radius, radius);
+                const __m256 a = _mm256_set1_ps(ray.lengthSquared);
+                const __m256 halfBSquared = _mm256_mul_ps(halfB, halfB);
+                const __m256 discriminant = _mm256_sub_ps(halfBSquared, _mm256_mul_ps(a, _mm256_sub_ps(ocSquared, radiusSquared)));
+                const __m256 slack = _mm256_mul_ps(_mm256_set1_ps(-spherePacketSlack), _mm256_add_ps(halfBSquared, _mm256_mul_ps(a, _mm256_add_ps(ocSquared, radiusSquared))));
+                return static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(discriminant, slack, _CMP_GE_OQ)));
+            }
+#endif
+
+            inline unsigned spherePacketTest(const SpherePacket& packet, const SpherePacketRay& ray)
+            {
+#if defined(GRAY_WIDE_BVH_AVX)
+                return spherePacketTestAvx(packet, ray);
+#elif defined(GRAY_WIDE_BVH_SSE)
+                return spherePacketTestSse(packet, ray, 0) | spherePacketTestSse(packet, ray, 4);
+#else
+                return spherePacketTestScalar(packet, ray, 0, SpherePacket::lanes);
+#endif
+            }
+        }
+
+        // Many static spheres as one primitive: centres and radii stored as floats in
+        // SpherePackets, materials as handles, under an 8-wide BVH whose leaves are packets.
+        // Leaves are tested in one SIMD pass, and the set takes 30-40 bytes per sphere (partly
+        // filled packets included) against well over 100 for Spheres behind shared_ptrs and a
+        // BVH. Candidate hits are confirmed in double precision, so surfaces match Spheres of
+        // the float-rounded centres and radii.
+        class SphereSet : public GRay::Math::Hittable
+        {
+        public:
+            struct Particle
+            {
+                float center[3];
+                float radius;
+                MaterialHandle material;
+            };
+
+            SphereSet() : sphereCount{ 0 } {}
+            // The build sees every sphere once (about 100 bytes each while it runs); leaves hold
+            // up to a packet of spheres.
+            explicit SphereSet(const std::vector<Particle>& spheres, const BvhBuildOptions& options = BvhBuildOptions(BvhSplitMethod::SAH));
+
+            bool hit(const GRay::Math::Ray& r, double t_min, double t_max, GRay::Math::hitRecord& rec) const override
+            {
+                return intersectAndFinalize(r, t_min, t_max, rec);
+            }
+            bool intersect(const GRay::Math::Ray& r, double t_min, double t_max, GRay::Math::hitRecord& rec) const override;
+            void finalizeHit(const GRay::Math::Ray& r, GRay::Math::hitRecord& rec) const override;
+            bool occluded(const GRay::Math::Ray& r, double t_min, double t_max) const override;
+            bool boundingBox(double time0, double time1, GRay::Solids::AABB& outputBox) const override
+            {
+                outputBox = bounds;
+                return !nodes.empty();
+            }
+
+            size_t size() const { return sphereCount; }
+            size_t nodeCount() const { return nodes.size(); }
+            size_t memoryUsage() const
+            {
+                return nodes.size() * sizeof(WideBvhNode<8>) + packets.size() * sizeof(SpherePacket) + materials.size() * sizeof(MaterialHandle);
+            }
+
+        private:
+            Math::Point3 center(uint32_t index) const
+            {
+                const SpherePacket& packet = packets[index / SpherePacket::lanes];
+                const int lane = index % SpherePacket::lanes;
+                return Math::Point3(packet.centerX[lane], packet.centerY[lane], packet.centerZ[lane]);
+            }
+            double radius(uint32_t index) const { return packets[index / SpherePacket::lanes].radius[index % SpherePacket::lanes]; }
+
+        private:
+            std::vector<WideBvhNode<8>, Utils::AlignedAllocator<WideBvhNode<8>, 64> > nodes; //leaf children index packets
+            std::vector<SpherePacket, Utils::AlignedAllocator<SpherePacket, 64> > packets;
+            std::vector<MaterialHandle> materials; //one per packet lane
+            size_t sphereCount;
+            AABB bounds;
+        };
+
+        inline SphereSet::SphereSet(const std::vector<Particle>& spheres, const BvhBuildOptions& options) : sphereCount{ spheres.size() }
+        {
+            if (spheres.empty())
+                return;
+
+            //A packet costs about as much as one sphere, so SAH should fill leaves up to a packet
+            BvhBuildOptions buildOptions = options;
+            buildOptions.maxLeafSize = SpherePacket::lanes;
+            buildOptions.intersectionCost = options.intersectionCost / SpherePacket::lanes;
+            if (buildOptions.maxDepth <= 0 || buildOptions.maxDepth > Detail::wideBvhMaxDepth)
+                buildOptions.maxDepth = Detail::wideBvhMaxDepth;
+            BvhBuilder builder(buildOptions);
+
+            std::vector<BvhPrimitive> primitives(spheres.size());
+            for (size_t i = 0; i < spheres.size(); ++i)
+            {
+                const Particle& sphere = spheres[i];
+                Math::Point3 c(sphere.center[0], sphere.center[1], sphere.center[2]);
+                Math::Vec3 extent(sphere.radius, sphere.radius, sphere.radius);
+                primitives[i].box = AABB(c - extent, c + extent);
+                primitives[i].centroid = c;
+                primitives[i].mortonCode = 0;
+                primitives[i].index = static_cast<uint32_t>(i);
+            }
+            std::unique_ptr<BvhBuildNode> root = builder.build(primitives);
+            bounds = root->bounds;
+
+            //Packets are laid out leaf by leaf as the wide nodes reach them
+            packets.reserve(spheres.size() / 4 + 1);
+            materials.reserve(packets.capacity() * SpherePacket::lanes);
+            nodes.reserve(builder.nodes() / 7 + 1);
+            Detail::collapseWide<8>(*root, nodes, [&](const BvhBuildNode& leaf, uint32_t& first, uint32_t& count)
+            {
+                first = static_cast<uint32_t>(packets.size());
+                for (size_t start = leaf.start; start < leaf.end; start += SpherePacket::lanes)
+                {
+                    SpherePacket packet;
+                    for (int lane = 0; lane < SpherePacket::lanes; ++lane)
+                    {
+                        const bool used = start + lane < leaf.end;
+                        const Particle* sphere = used ? &spheres[primitives[start + lane].index] : nullptr;
+                        const float unused = std::numeric_limits<float>::quiet_NaN();
+                        packet.centerX[lane] = used ? sphere->center[0] : unused;
+                        packet.centerY[lane] = used ? sphere->center[1] : unused;
+                        packet.centerZ[lane] = used ? sphere->center[2] : unused;
+                        packet.radius[lane] = used ? sphere->radius : 0.0f;
+                        materials.push_back(used ? sphere->material : invalidMaterial);
+                    }
+                    packets.push_back(packet);
+                }
+                count = static_cast<uint32_t>(packets.size()) - first;
+            });
+            builder.finish();
+        }
+
+        inline bool SphereSet::intersect(const GRay::Math::Ray& r, double t_min, double t_max, GRay::Math::hitRecord& rec) const
+        {
+            const SpherePacketRay ray(r);
+            return Detail::wideClosestHit<8>(nodes, r, t_min, t_max, [&](uint32_t first, uint32_t count, double& tMax)
+            {
+                bool hitAnything = false;
+                for (uint32_t p = first; p < first + count; ++p)
+                    for (unsigned mask = Detail::spherePacketTest(packets[p], ray); mask != 0; mask &= mask - 1)
+                    {
+                        int lane = 0;
+                        while (!((mask >> lane) & 1u))
+                            ++lane;
+                        const uint32_t index = p * SpherePacket::lanes + lane;
+                        double t;
+                        if (Detail::nearestSphereRoot(center(index), radius(index), r, t_min, tMax, t))
+                        {
+                            hitAnything = true;
+                            tMax = t;
+                            rec.t = t;
+                            rec.object = this;
+                            rec.primitive = index;
+                        }
+                    }
+                return hitAnything;
+            });
+        }
+
+        inline bool SphereSet::occluded(const GRay::Math::Ray& r, double t_min, double t_max) const
+        {
+            const SpherePacketRay ray(r);
+            return Detail::wideAnyHit<8>(nodes, r, t_min, t_max, [&](uint32_t first, uint32_t count)
+            {
+                for (uint32_t p = first; p < first + count; ++p)
+                    for (unsigned mask = Detail::spherePacketTest(packets[p], ray); mask != 0; mask &= mask - 1)
+                    {
+                        int lane = 0;
+                        while (!((mask >> lane) & 1u))
+                            ++lane;
+                        const uint32_t index = p * SpherePacket::lanes + lane;
+                        double t;
+                        if (Detail::nearestSphereRoot(center(index), radius(index), r, t_min, t_max, t))
+                            return true;
+                    }
+                return false;
+            });
+        }
+
+        inline void SphereSet::finalizeHit(const GRay::Math::Ray& r, GRay::Math::hitRecord& rec) const
+        {
+            const double sphereRadius = radius(rec.primitive);
+            rec.p = r.at(rec.t);
+            Math::Vec3 outwardNormal = (rec.p - center(rec.primitive)) / sphereRadius;
+            rec.setFaceNormal(r, outwardNormal);
+            Sphere::getSphereUV(outwardNormal, rec.u, rec.v);
+            rec.uvDensity = 1 / (Math::pi * fabs(sphereRadius) * sqrt(2.0)); //as Sphere does
+            rec.material = materials[rec.primitive];
+        }
+    }
+}
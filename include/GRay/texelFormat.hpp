@@ -0,0 +1,190 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__F16C__)
+    #define GRAY_TEXEL_F16C 1
+    #include <immintrin.h>
+#endif
+
+namespace GRay
+{
+    namespace Materials
+    {
+        // Storage of one RGB texel: three floats, three IEEE half floats, or Radiance RGBE
+        // (8-bit mantissas sharing an exponent, as in .hdr files). Half keeps about three
+        // significant digits, RGBE about two relative to the brightest channel.
+        enum class TexelFormat : uint32_t
+        {
+            Float32 = 0,
+            Half = 1,
+            Rgbe = 2
+        };
+
+        inline size_t texelBytes(TexelFormat format)
+        {
+            switch (format)
+            {
+            case TexelFormat::Half: return 3 * sizeof(uint16_t);
+            case TexelFormat::Rgbe: return 4;
+            default: return 3 * sizeof(float);
+            }
+        }
+
+        inline const char* texelFormatName(TexelFormat format)
+        {
+            switch (format)
+            {
+            case TexelFormat::Half: return "half";
+            case TexelFormat::Rgbe: return "rgbe";
+            default: return "float";
+            }
+        }
+
+        namespace Texels
+        {
+            inline uint32_t floatBits(float f) { uint32_t u; std::memcpy(&u, &f, sizeof(u)); return u; }
+            inline float bitsFloat(uint32_t u) { float f; std::memcpy(&f, &u, sizeof(f)); return f; }
+
+            // Round to nearest even; overflow goes to infinity, NaN stays NaN.
+            inline uint16_t floatToHalf(float value)
+            {
+                uint32_t f = floatBits(value);
+                uint32_t sign = (f >> 16) & 0x8000u;
+                f &= 0x7fffffffu;
+                uint16_t h;
+                if (f >= 0x47800000u) //too large for a half, or inf/NaN
+                    h = f > 0x7f800000u ? 0x7e00 : 0x7c00;
+                else if (f < 0x38800000u) //subnormal half or zero: let the FPU round
+                    h = static_cast<uint16_t>(floatBits(bitsFloat(f) + 0.5f) - floatBits(0.5f));
+                else
+                {
+                    uint32_t mantissaOdd = (f >> 13) & 1;
+                    f += (static_cast<uint32_t>(15 - 127) << 23) + 0xfff;
+                    f += mantissaOdd;
+                    h = static_cast<uint16_t>(f >> 13);
+                }
+                return static_cast<uint16_t>(h | sign);
+            }
+
+            // Integer and select operations only, so loops over texels vectorize.
+            inline float halfToFloat(uint16_t h)
+            {
+                const float magic = bitsFloat(113u << 23);
+                uint32_t o = static_cast<uint32_t>(h & 0x7fff) << 13;
+                uint32_t exponent = o & 0x0f800000u;
+                o += (127 - 15) << 23;
+                float f;
+                if (exponent == 0x0f800000u) //inf/NaN
+                    f = bitsFloat(o + ((128 - 16) << 23));
+                else if (exponent == 0) //zero or subnormal
+                    f = bitsFloat(o + (1u << 23)) - magic;
+                else
+                    f = bitsFloat(o);
+                return bitsFloat(floatBits(f) | (static_cast<uint32_t>(h & 0x8000) << 16));
+            }
+
+            // Scale of an RGBE exponent byte: 2^(e - 136), and 0 for the zero texel.
+            inline const float* rgbeScales()
+            {
+                static const struct Table
+                {
+                    Table()
+                    {
+                        scale[0] = 0;
+                        for (int e = 1; e < 256; ++e)
+                            scale[e] = static_cast<float>(std::ldexp(1.0, e - 136));
+                    }
+                    float scale[256];
+                } table;
+                return table.scale;
+            }
+        }
+
+        // Negative components clamp to 0 in RGBE, which cannot hold them.
+        inline void encodeTexel(TexelFormat format, const float in[3], uint8_t* out)
+        {
+            switch (format)
+            {
+            case TexelFormat::Half:
+            {
+                uint16_t h[3];
+#if defined(GRAY_TEXEL_F16C)
+                for (int k = 0; k < 3; ++k)
+                    h[k] = _cvtss_sh(in[k], 0);
+#else
+                for (int k = 0; k < 3; ++k)
+                    h[k] = Texels::floatToHalf(in[k]);
+#endif
+                std::memcpy(out, h, sizeof(h));
+                break;
+            }
+            case TexelFormat::Rgbe:
+            {
+                float r = std::max(in[0], 0.0f), g = std::max(in[1], 0.0f), b = std::max(in[2], 0.0f);
+                float v = std::max(r, std::max(g, b));
+                if (!(v >= 1e-32f))
+                {
+                    out[0] = out[1] = out[2] = out[3] = 0;
+                    break;
+                }
+                //Round to nearest, moving to the next exponent if the largest mantissa rounds to 256
+                int e;
+                std::frexp(static_cast<double>(v), &e);
+                double scale = std::ldexp(1.0, 8 - e);
+                if (v * scale + 0.5 >= 256)
+                {
+                    ++e;
+                    scale *= 0.5;
+                }
+                out[0] = static_cast<uint8_t>(r * scale + 0.5);
+                out[1] = static_cast<uint8_t>(g * scale + 0.5);
+                out[2] = static_cast<uint8_t>(b * scale + 0.5);
+                out[3] = static_cast<uint8_t>(std::min(e + 128, 255));
+                break;
+            }
+            default:
+                std::memcpy(out, in, 3 * sizeof(float));
+            }
+        }
+
+        inline void decodeTexel(TexelFormat format, const uint8_t* in, float out[3])
+        {
+            switch (format)
+            {
+            case TexelFormat::Half:
+            {
+#if defined(GRAY_TEXEL_F16C)
+                uint16_t h[4] = { 0, 0, 0, 0 };
+                std::memcpy(h, in, 3 * sizeof(uint16_t));
+                float f[4];
+                _mm_storeu_ps(f, _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(h))));
+                out[0] = f[0];
+                out[1] = f[1];
+                out[2] = f[2];
+#else
+                uint16_t h[3];
+                std::memcpy(h, in, sizeof(h));
+                for (int k = 0; k < 3; ++k)
+                    out[k] = Texels::halfToFloat(h[k]);
+#endif
+                break;
+            }
+            case TexelFormat::Rgbe:
+            {
+                //Mantissas were rounded to nearest, so no half-bucket offset (matches stb_image)
+                float scale = Texels::rgbeScales()[in[3]];
+                for (int k = 0; k < 3; ++k)
+                    out[k] = in[k] * scale;
+                break;
+            }
+            default:
+                std::memcpy(out, in, 3 * sizeof(float));
+            }
+        }
+    }
+}
@@ -2,7 +2,14 @@
 
 #include <GRay/rtweekend.hpp>
 #include <GRay/perlin.hpp>
+#include <GRay/mipmap.hpp>
+#include <GRay/tileCache.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <iostream>
+#include <mutex>
+#include <vector>
 #include <stb/rtw_stb_image.hpp>
 
 namespace GRay
@@ -13,6 +20,12 @@ namespace GRay
         {
         public:
             virtual GRay::Math::Color value(double u, double v, const GRay::Math::Point3& p) const = 0;
+            // Lookup averaged over a footprint of the given width in texture coordinates, as
+            // computed from the ray cone. Textures without prefiltering ignore it.
+            virtual GRay::Math::Color filteredValue(double u, double v, const GRay::Math::Point3& p, double footprint) const
+            {
+                return value(u, v, p);
+            }
         };
 
         class SolidColor : public Texture
@@ -30,7 +43,7 @@ namespace GRay
         {
         public:
             CheckerTexture() {}
-            CheckerTexture(shared_ptr<Texture> _even, shared_ptr<Texture> _odd) : odd{ _odd }, even{ _even } {}
+            CheckerTexture(shared_ptr<const Texture> _even, shared_ptr<const Texture> _odd) : odd{ _odd }, even{ _even } {}
             CheckerTexture(GRay::Math::Color c1, GRay::Math::Color c2) : even{ make_shared<SolidColor>(c1) }, odd{ make_shared<SolidColor>(c2) } {}
             GRay::Math::Color value(double u, double v, const GRay::Math::Point3& p) const override
             {
@@ -42,52 +55,73 @@ namespace GRay
             }
 
         public:
-            shared_ptr<Texture> odd;
-            shared_ptr<Texture> even;
+            shared_ptr<const Texture> odd;
+            shared_ptr<const Texture> even;
         };
 
         class NoiseTexture : public Texture
         {
         public:
-            NoiseTexture() {}
-            NoiseTexture(double sc) : scale{ sc } {}
+            NoiseTexture() : noise{ make_shared<Perlin>() }, scale{ 1 } {}
+            NoiseTexture(double sc, uint32_t seed = 0) : noise{ make_shared<Perlin>(seed) }, scale{ sc } {}
+            // Shares the tables of noise, e.g. from AssetRegistry::perlin().
+            NoiseTexture(double sc, shared_ptr<const Perlin> noise) : noise{ noise }, scale{ sc } {}
             GRay::Math::Color value(double u, double v, const GRay::Math::Point3& p) const override
             {
-                //return GRay::Math::Color(1, 1, 1) * 0.5 * (1.0 + noise.noise(scale * p)); //simple
-                return GRay::Math::Color(1, 1, 1) * noise.turb(scale * p); //turbulence
-                //return GRay::Math::Color(1, 1, 1) * 0.5 * (1 + sin(scale * p.z() + 10 * noise.turb(p))); //marble
+                //return GRay::Math::Color(1, 1, 1) * 0.5 * (1.0 + noise->noise(scale * p)); //simple
+                return GRay::Math::Color(1, 1, 1) * noise->turb(scale * p); //turbulence
+                //return GRay::Math::Color(1, 1, 1) * 0.5 * (1 + sin(scale * p.z() + 10 * noise->turb(p))); //marble
             }
         public:
-            Perlin noise;
+            shared_ptr<const Perlin> noise;
             double scale;
         };
 
+        // With a TextureCache directory set, cache files, mapped or paged through the TileCache,
+        // hold the pixels and the source image is decoded only when its cache is missing or
+        // stale. Without one the decoded pixels stay in memory.
         class ImageTexture : public Texture
         {
         public:
             const static int bytesPerPixel = 3;
 
-            ImageTexture() : data{ nullptr }, width{ 0 }, height{ 0 }, bytesPerScanline{ 0 } {}
-            ImageTexture(const char* fileName)
+            ImageTexture() : width{ 0 }, height{ 0 } {}
+            ImageTexture(const char* fileName) : width{ 0 }, height{ 0 }
             {
-                auto componentsPerPixel = bytesPerPixel;
-                data = stbi_load(fileName, &width, &height, &componentsPerPixel, componentsPerPixel);
-                if (!data)
+                if (!openCachedPyramid(fileName, cacheKind, false, mips))
                 {
-                    std::cerr << "ERROR: Could not load texture image file '" << fileName << "'.\n";
-                    width = height = 0;
+                    auto componentsPerPixel = bytesPerPixel;
+                    unsigned char* data = stbi_load(fileName, &width, &height, &componentsPerPixel, componentsPerPixel);
+                    if (!data)
+                    {
+                        std::cerr << "ERROR: Could not load texture image file '" << fileName << "'.\n";
+                        width = height = 0;
+                        return;
+                    }
+                    linear.resize(static_cast<size_t>(width) * height * bytesPerPixel);
+                    for (size_t k = 0; k < linear.size(); ++k)
+                        linear[k] = data[k] / 255.0f;
+                    stbi_image_free(data);
+                    mips = MipPyramid(linear.data(), width, height, false);
+
+                    //Continue from the cache, so the decoded pixels need not stay resident
+                    MipPyramid cached;
+                    if (TextureCache::writePyramid(fileName, cacheKind, mips, TexelFormat::Float32) && openCachedPyramid(fileName, cacheKind, false, cached))
+                    {
+                        mips = std::move(cached);
+                        std::vector<float>().swap(linear);
+                    }
                 }
-                bytesPerScanline = bytesPerPixel * width;
+                width = mips.level(0).width;
+                height = mips.level(0).height;
             }
 
-            ~ImageTexture()
-            {
-                delete data;
-            }
+            ImageTexture(const ImageTexture&) = delete;
+            ImageTexture& operator=(const ImageTexture&) = delete;
 
             GRay::Math::Color value(double u, double v, const GRay::Math::Point3& p) const override
             {
-                if (data == nullptr)
+                if (!loaded())
                     return Math::Color(0, 1, 1);
 
                 u = Utils::clamp(u, 0.0, 1.0);
@@ -99,105 +133,223 @@ namespace GRay
                 if (i >= width) i = width - 1;
                 if (j >= height) j = height - 1;
 
-                const auto colorScale = 1.0 / 255;
-                auto pixel = data + j * bytesPerScanline + i * bytesPerPixel;
+                return mips.texel(0, i, j);
+            }
 
-                return Math::Color(colorScale * pixel[0], colorScale * pixel[1], colorScale * pixel[2]);
+            // Trilinear once the footprint covers more than a texel, nearest below that.
+            GRay::Math::Color filteredValue(double u, double v, const GRay::Math::Point3& p, double footprint) const override
+            {
+                double level = mips.levelFor(footprint);
+                if (!loaded() || level <= 0)
+                    return value(u, v, p);
+                return mips.trilinear(Utils::clamp(u, 0.0, 1.0), 1.0 - Utils::clamp(v, 0.0, 1.0), level);
             }
 
+            bool loaded() const { return mips.levels() > 0; }
+            // Size of the decoded pixels and mip levels, wherever they live.
+            size_t decodedBytes() const { return mips.memoryBytes(); }
+
+        private:
+            static const uint32_t cacheKind = 1;
+
         private:
-            unsigned char* data;
             int width, height;
-            int bytesPerScanline;
+            std::vector<float> linear; //level 0 of the pyramid until the cache takes over
+            MipPyramid mips;
         };
 
+        // Float RGB environment image. Besides nearest lookups it keeps a mip pyramid for
+        // trilinear filtering and, once a box-filtered lookup is requested, a summed-area table
+        // for box filters of any radius. u wraps around, v is clamped at the poles. Pixels are
+        // stored as format, in the texture cache file like those of ImageTexture or, without a
+        // cache directory, in memory.
         class ImageTextureHDRI : public Texture
         {
         public:
             const static int partsPerPixel = 3;
-            bool subSampling;
-            double subSamplingRadius;
-            double subSamplingRaysCnt;
-            bool useClamping;
-            double remapingFactor;
-
-            ImageTextureHDRI() : data{ nullptr }, width{ 0 }, height{ 0 }, partsPerScanline{ 0 },
-                subSampling{ false }, subSamplingRadius{ 0.01 }, subSamplingRaysCnt{ 100 },
-                useClamping{ false }, remapingFactor{ 1 / 2.2 } {}
-            ImageTextureHDRI(const char* fileName)
+            const bool subSampling;           //box-filter lookups of half-width subSamplingRadius
+            const double subSamplingRadius;   //in texture coordinates
+
+            ImageTextureHDRI() : subSampling{ false }, subSamplingRadius{ 0.01 }, width{ 0 }, height{ 0 }, format{ TexelFormat::Float32 } {}
+            // useClamping raises every texel to remapingFactor once, before the pyramid is built.
+            ImageTextureHDRI(const char* fileName, TexelFormat format = TexelFormat::Float32, bool useClamping = false,
+                double remapingFactor = 1 / 2.2, bool subSampling = false, double subSamplingRadius = 0.01)
+                : subSampling{ subSampling }, subSamplingRadius{ subSamplingRadius }, width{ 0 }, height{ 0 }, format{ format }
             {
-                auto componentsPerPixel = partsPerPixel;
-                data = stbi_loadf(fileName, &width, &height, &componentsPerPixel, componentsPerPixel);
-                if (!data)
+                std::string variant = cacheVariant(format, useClamping, remapingFactor);
+                if (!openCachedPyramid(fileName, cacheKind, true, mips, format, variant))
                 {
-                    std::cerr << "ERROR: Could not load texture image file '" << fileName << "'.\n";
-                    width = height = 0;
+                    auto componentsPerPixel = partsPerPixel;
+                    float* data = stbi_loadf(fileName, &width, &height, &componentsPerPixel, componentsPerPixel);
+                    if (!data)
+                    {
+                        std::cerr << "ERROR: Could not load texture image file '" << fileName << "'.\n";
+                        width = height = 0;
+                        return;
+                    }
+                    if (useClamping)
+                        for (size_t k = 0; k < static_cast<size_t>(width) * height * partsPerPixel; ++k)
+                            data[k] = static_cast<float>(pow(data[k], remapingFactor));
+                    mips = MipPyramid(data, width, height, true);
+
+                    //Continue from the cache, so the decoded pixels need not stay resident
+                    MipPyramid cached;
+                    bool useCache = TextureCache::writePyramid(fileName, cacheKind, mips, format, variant) &&
+                        openCachedPyramid(fileName, cacheKind, true, cached, format, variant);
+                    if (useCache)
+                    {
+                        mips = std::move(cached);
+                        stbi_image_free(data);
+                    }
+                    else if (format != TexelFormat::Float32)
+                    {
+                        mips = residentPyramid(mips, true, format);
+                        stbi_image_free(data);
+                    }
+                    else
+                        decoded.reset(data, stbi_image_free);
                 }
-                partsPerScanline = partsPerPixel * width;
-                subSampling = false;
-                subSamplingRadius = 0.01;
-                subSamplingRaysCnt = 100;
-                useClamping = false;
-                remapingFactor = 1 / 2.2;
+                width = mips.level(0).width;
+                height = mips.level(0).height;
             }
 
-            ~ImageTextureHDRI()
-            {
-                delete data;
-            }
+            ImageTextureHDRI(const ImageTextureHDRI&) = delete;
+            ImageTextureHDRI& operator=(const ImageTextureHDRI&) = delete;
 
             GRay::Math::Color value(double u, double v, const GRay::Math::Point3& p) const override
             {
-                if (data == nullptr)
+                if (!loaded())
                     return Math::Color(0, 1, 1);
 
                 u = Utils::clamp(u, 0.0, 1.0);
                 v = 1.0 - Utils::clamp(v, 0.0, 1.0);
 
-                Math::Color res;
                 if (subSampling)
+                    return boxFilter(u, v, subSamplingRadius);
+
+                int i = static_cast<int>(u * width);
+                int j = static_cast<int>(v * height);
+                if (i >= width) i = width - 1;
+                if (j >= height) j = height - 1;
+                return texel(i, j);
+            }
+
+            int getWidth() const { return width; }
+            int getHeight() const { return height; }
+            TexelFormat texelFormat() const { return format; }
+            // Trilinear once the footprint covers more than a texel. Box-filtered lookups
+            // (subSampling) are already blurred and ignore the footprint.
+            GRay::Math::Color filteredValue(double u, double v, const GRay::Math::Point3& p, double footprint) const override
+            {
+                double level = mips.levelFor(footprint);
+                if (!loaded() || subSampling || level <= 0)
+                    return value(u, v, p);
+                return mips.trilinear(Utils::clamp(u, 0.0, 1.0), 1.0 - Utils::clamp(v, 0.0, 1.0), level);
+            }
+
+            // Unfiltered pixel, row 0 at the top (v = 1).
+            Math::Color texel(int i, int j) const { return mips.texel(0, i, j); }
+            bool loaded() const { return mips.levels() > 0; }
+            // Size of the decoded pixels and mip levels, wherever they live.
+            size_t decodedBytes() const { return mips.memoryBytes(); }
+
+            int mipLevels() const { return mips.levels(); }
+
+            // Trilinear lookup; level 0 is full resolution. x, y are image coordinates in
+            // [0, 1] with y = 0 at the top row.
+            Math::Color trilinear(double x, double y, double level) const
+            {
+                if (!loaded())
+                    return Math::Color(0, 1, 1);
+                return mips.trilinear(x, y, level);
+            }
+
+            // Mean over the texels within radius (in texture coordinates) of x, y.
+            Math::Color boxFilter(double x, double y, double radius) const
+            {
+                std::call_once(summedAreaOnce, [this] { buildSummedAreaTable(); });
+                int i0 = static_cast<int>(std::floor((x - radius) * width));
+                int i1 = static_cast<int>(std::floor((x + radius) * width));
+                int j0 = std::max(static_cast<int>(std::floor((y - radius) * height)), 0);
+                int j1 = std::min(static_cast<int>(std::floor((y + radius) * height)), height - 1);
+                if (i1 - i0 + 1 >= width)
                 {
-                    for (int k = 0; k < subSamplingRaysCnt; k++)
+                    i0 = 0;
+                    i1 = width - 1;
+                }
+                j0 = std::min(j0, height - 1);
+                j1 = std::max(j1, j0);
+
+                //Split the column range where it wraps around
+                double sum[3] = { 0, 0, 0 };
+                int wrappedStart = ((i0 % width) + width) % width;
+                int columns = i1 - i0 + 1;
+                int firstSpan = std::min(columns, width - wrappedStart);
+                addSummedArea(wrappedStart, wrappedStart + firstSpan - 1, j0, j1, sum);
+                if (columns > firstSpan)
+                    addSummedArea(0, columns - firstSpan - 1, j0, j1, sum);
+
+                double count = static_cast<double>(columns) * (j1 - j0 + 1);
+                return Math::Color(sum[0] / count, sum[1] / count, sum[2] / count);
+            }
+
+        private:
+            static const uint32_t cacheKind = 2;
+
+            // Float texels keep the name without a variant.
+            static std::string cacheVariant(TexelFormat format, bool useClamping, double remapingFactor)
+            {
+                std::string variant;
+                if (format != TexelFormat::Float32)
+                    variant += std::string(".") + texelFormatName(format);
+                if (useClamping)
+                {
+                    char remap[32];
+                    std::snprintf(remap, sizeof(remap), ".pow%.9g", remapingFactor);
+                    variant += remap;
+                }
+                return variant;
+            }
+
+            // Double precision: float sums of a 4k HDR lose the small values entirely.
+            void buildSummedAreaTable() const
+            {
+                const size_t stride = static_cast<size_t>(width + 1) * partsPerPixel;
+                summedArea.assign(stride * (height + 1), 0.0);
+                for (int j = 0; j < height; ++j)
+                {
+                    double row[3] = { 0, 0, 0 };
+                    for (int i = 0; i < width; ++i)
                     {
-                        Math::Vec3 vv = Math::randomInUnitDisc() * subSamplingRadius;
-                        vv[0] += u;
-                        vv[1] += v;
-                        if (vv[0] < 0) vv[0] += 1;
-                        if (vv[1] < 0) vv[1] += 1;
-                        if (vv[0] > 1) vv[0] -= 1;
-                        if (vv[1] > 1) vv[1] -= 1;
-
-                        int i = static_cast<int>(vv[0] * width);
-                        int j = static_cast<int>(vv[1] * height);
-
-                        if (i >= width) i = width - 1;
-                        if (j >= height) j = height - 1;
-
-                        //std::cerr << i << " " << j << "\n";
-                        auto pixel = data + j * partsPerScanline + i * partsPerPixel;
-                        res += Math::Color(pixel[0], pixel[1], pixel[2]);
+                        Math::Color pixel = texel(i, j);
+                        for (int k = 0; k < 3; ++k)
+                        {
+                            row[k] += pixel[k];
+                            size_t at = (j + 1) * stride + (i + 1) * partsPerPixel + k;
+                            summedArea[at] = summedArea[at - stride] + row[k];
+                        }
                     }
-                    res /= subSamplingRaysCnt;
                 }
-                else
+            }
+
+            // Adds the sums over columns [i0, i1] and rows [j0, j1].
+            void addSummedArea(int i0, int i1, int j0, int j1, double sum[3]) const
+            {
+                const size_t stride = static_cast<size_t>(width + 1) * partsPerPixel;
+                for (int k = 0; k < 3; ++k)
                 {
-                    int i = static_cast<int>(u * width);
-                    int j = static_cast<int>(v * height);
-                    if (i >= width) i = width - 1;
-                    if (j >= height) j = height - 1;
-                    auto pixel = data + j * partsPerScanline + i * partsPerPixel;
-                    if (useClamping)
-                        res = Math::Color(pow(pixel[0], remapingFactor), pow(pixel[1], remapingFactor), pow(pixel[2], remapingFactor));
-                    else
-                        res = Math::Color(pixel[0], pixel[1], pixel[2]);
+                    auto at = [&](int i, int j) { return summedArea[j * stride + i * partsPerPixel + k]; };
+                    sum[k] += at(i1 + 1, j1 + 1) - at(i0, j1 + 1) - at(i1 + 1, j0) + at(i0, j0);
                 }
-                return res;
             }
 
         private:
-            float* data;
             int width, height;
-            int partsPerScanline;
+            TexelFormat format;
+            shared_ptr<float> decoded; //level 0 of float textures without a cache
+            MipPyramid mips;
+            mutable std::vector<double> summedArea;
+            mutable std::once_flag summedAreaOnce;
         };
     }
-}
\ No newline at end of file
+}
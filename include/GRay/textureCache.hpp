@@ -0,0 +1,387 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/mipmap.hpp>
+#include <GRay/mappedFile.hpp>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace GRay
+{
+    namespace Utils
+    {
+        // Reads byte ranges of a file from any thread without keeping it in memory.
+        class FileReader
+        {
+        public:
+            explicit FileReader(const std::string& path)
+            {
+#if defined(_WIN32)
+                in.open(path, std::ios::binary);
+#else
+                fd = ::open(path.c_str(), O_RDONLY);
+#endif
+            }
+
+            ~FileReader()
+            {
+#if !defined(_WIN32)
+                if (fd >= 0)
+                    ::close(fd);
+#endif
+            }
+
+            FileReader(const FileReader&) = delete;
+            FileReader& operator=(const FileReader&) = delete;
+
+#if defined(_WIN32)
+            bool valid() const { return in.is_open(); }
+#else
+            bool valid() const { return fd >= 0; }
+#endif
+
+            bool read(uint64_t offset, void* destination, size_t size) const
+            {
+#if defined(_WIN32)
+                std::lock_guard<std::mutex> lock(mutex);
+                in.clear();
+                in.seekg(static_cast<std::streamoff>(offset));
+                in.read(static_cast<char*>(destination), static_cast<std::streamsize>(size));
+                return static_cast<size_t>(in.gcount()) == size;
+#else
+                char* at = static_cast<char*>(destination);
+                while (size > 0)
+                {
+                    ssize_t count = pread(fd, at, size, static_cast<off_t>(offset));
+                    if (count <= 0)
+                        return false;
+                    at += count;
+                    offset += static_cast<uint64_t>(count);
+                    size -= static_cast<size_t>(count);
+                }
+                return true;
+#endif
+            }
+
+        private:
+#if defined(_WIN32)
+            mutable std::ifstream in;
+            mutable std::mutex mutex;
+#else
+            int fd;
+#endif
+        };
+    }
+
+    namespace Materials
+    {
+        // Decoded texture data stored in a cache directory, so later runs read it instead of
+        // decoding again. Caching is off until setDirectory() names a directory; the file of a
+        // source is then "<directory>/<file name>.<path hash><variant>.gcache". It starts with a
+        // header identifying the source (size and modification time to the nanosecond where the
+        // platform has it) and a table of sections, each 64-byte aligned. What the sections hold
+        // is up to the texture type, identified by kind, and the texel format; variants tell
+        // apart caches of one source stored differently.
+        class TextureCache
+        {
+        public:
+            struct Section
+            {
+                const void* data;
+                uint64_t size;
+            };
+
+            // Up-to-date cache contents, or nothing when the cache is missing or stale.
+            class Entry
+            {
+            public:
+                bool valid() const { return reader != nullptr; }
+                int width() const { return header.width; }
+                int height() const { return header.height; }
+                TexelFormat format() const { return static_cast<TexelFormat>(header.format); }
+                size_t sectionCount() const { return sections.size(); }
+                uint64_t sectionOffset(size_t index) const { return sections[index].offset; }
+                uint64_t sectionSize(size_t index) const { return sections[index].size; }
+                // Only for entries opened with map = true.
+                const void* section(size_t index) const { return file->data() + sections[index].offset; }
+                // Keep the sections readable after the entry is gone.
+                const shared_ptr<Utils::MappedFile>& mapping() const { return file; }
+                const shared_ptr<Utils::FileReader>& fileReader() const { return reader; }
+
+            private:
+                friend class TextureCache;
+                struct SectionEntry
+                {
+                    uint64_t offset;
+                    uint64_t size;
+                };
+                shared_ptr<Utils::FileReader> reader;
+                shared_ptr<Utils::MappedFile> file;
+                std::vector<SectionEntry> sections;
+                struct Header
+                {
+                    char magic[8];
+                    uint32_t version;
+                    uint32_t kind;
+                    uint64_t sourceSize;
+                    int64_t sourceTime; //nanoseconds since the epoch
+                    int32_t width;
+                    int32_t height;
+                    uint32_t sectionCount;
+                    uint32_t format;
+                } header{};
+            };
+
+            // Turns caching on, writing and reading caches in directory, which must exist; an
+            // empty directory turns it off again. Applies to textures loaded afterwards.
+            static void setDirectory(const std::string& directory)
+            {
+                std::lock_guard<std::mutex> lock(settingsMutex());
+                directoryName() = directory;
+            }
+
+            static std::string directory()
+            {
+                std::lock_guard<std::mutex> lock(settingsMutex());
+                return directoryName();
+            }
+
+            static bool enabled() { return !directory().empty(); }
+
+            // The path hash keeps sources of the same name in different directories apart.
+            static std::string pathFor(const std::string& source, const std::string& variant = "")
+            {
+                uint64_t hash = 14695981039346656037ull; //FNV-1a
+                for (char c : source)
+                    hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+                char hex[17];
+                std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+                const size_t slash = source.find_last_of("/\\");
+                const std::string name = slash == std::string::npos ? source : source.substr(slash + 1);
+                return directory() + "/" + name + "." + hex + variant + ".gcache";
+            }
+
+            // map: also map the whole file, for Entry::section(). Otherwise sections are read
+            // on demand through Entry::fileReader().
+            static Entry open(const std::string& source, uint32_t kind, bool map, const std::string& variant = "")
+            {
+                Entry entry;
+                Entry::Header expected;
+                uint64_t fileSize;
+                if (!enabled())
+                    return entry;
+                std::string path = pathFor(source, variant);
+                if (!describeSource(source, kind, TexelFormat::Float32, 0, 0, 0, expected) || !fileSizeOf(path, fileSize))
+                    return entry;
+                auto reader = make_shared<Utils::FileReader>(path);
+                Entry::Header header;
+                if (!reader->valid() || !reader->read(0, &header, sizeof(header)))
+                    return entry;
+                if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.version != expected.version ||
+                    header.kind != kind || header.sourceSize != expected.sourceSize || header.sourceTime != expected.sourceTime)
+                    return entry;
+
+                if (fileSize < sizeof(header) + static_cast<uint64_t>(header.sectionCount) * sizeof(Entry::SectionEntry))
+                    return entry;
+                entry.sections.resize(header.sectionCount);
+                if (header.sectionCount > 0 && !reader->read(sizeof(header), entry.sections.data(), header.sectionCount * sizeof(Entry::SectionEntry)))
+                    return Entry();
+                for (const Entry::SectionEntry& section : entry.sections)
+                    if (section.offset + section.size > fileSize)
+                        return Entry();
+                if (map)
+                {
+                    entry.file = make_shared<Utils::MappedFile>(path);
+                    if (!entry.file->valid() || entry.file->size() != fileSize)
+                        return Entry();
+                }
+                entry.header = header;
+                entry.reader = reader;
+                return entry;
+            }
+
+            // Writes through a temporary file and a rename, so concurrent renders never read
+            // a half-written cache. Returns false if the cache could not be written.
+            static bool write(const std::string& source, uint32_t kind, TexelFormat format, int width, int height,
+                const std::vector<Section>& sections, const std::string& variant = "")
+            {
+                std::vector<uint64_t> sizes;
+                for (const Section& section : sections)
+                    sizes.push_back(section.size);
+                return write(source, kind, format, width, height, sizes, [&](size_t index, std::ostream& out)
+                {
+                    out.write(static_cast<const char*>(sections[index].data), static_cast<std::streamsize>(sections[index].size));
+                }, variant);
+            }
+
+            // Like write(), but writeSection(index, out) produces the bytes of each section
+            // while the file is written, so they need not all be in memory at once. It must
+            // write exactly sectionSizes[index] bytes.
+            template<class WriteSection>
+            static bool write(const std::string& source, uint32_t kind, TexelFormat format, int width, int height,
+                const std::vector<uint64_t>& sectionSizes, WriteSection writeSection, const std::string& variant = "")
+            {
+                Entry::Header header;
+                if (!enabled() || !describeSource(source, kind, format, width, height, static_cast<uint32_t>(sectionSizes.size()), header))
+                    return false;
+
+                std::vector<Entry::SectionEntry> table(sectionSizes.size());
+                uint64_t offset = alignUp(sizeof(header) + table.size() * sizeof(Entry::SectionEntry));
+                for (size_t i = 0; i < sectionSizes.size(); ++i)
+                {
+                    table[i].offset = offset;
+                    table[i].size = sectionSizes[i];
+                    offset = alignUp(offset + sectionSizes[i]);
+                }
+
+                std::string path = pathFor(source, variant);
+                //Unique across processes and across threads of this one
+                static std::atomic<unsigned> writes(0);
+#if defined(_WIN32)
+                const long long process = _getpid();
+#else
+                const long long process = getpid();
+#endif
+                std::string temporary = path + ".tmp" + std::to_string(process) + "." + std::to_string(writes++);
+                {
+                    std::ofstream out(temporary, std::ios::binary);
+                    if (!out)
+                        return false;
+                    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                    if (!table.empty())
+                        out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(Entry::SectionEntry));
+                    uint64_t written = sizeof(header) + table.size() * sizeof(Entry::SectionEntry);
+                    const char padding[64] = {};
+                    for (size_t i = 0; i < table.size() && out; ++i)
+                    {
+                        out.write(padding, static_cast<std::streamsize>(table[i].offset - written));
+                        writeSection(i, out);
+                        written = table[i].offset + table[i].size;
+                    }
+                    if (!out || static_cast<uint64_t>(out.tellp()) != written)
+                    {
+                        out.close();
+                        std::remove(temporary.c_str());
+                        return false;
+                    }
+                }
+                if (std::rename(temporary.c_str(), path.c_str()) != 0)
+                {
+                    std::remove(temporary.c_str());
+                    return false;
+                }
+                return true;
+            }
+
+            // Stores every level of mips, tiled as TileSource describes, one section per level.
+            // Tiles are encoded one row of tiles at a time as the file is written.
+            static bool writePyramid(const std::string& source, uint32_t kind, const MipPyramid& mips, TexelFormat format,
+                const std::string& variant = "")
+            {
+                if (mips.levels() == 0)
+                    return false;
+                std::vector<uint64_t> sizes;
+                for (int i = 0; i < mips.levels(); ++i)
+                    sizes.push_back(TileSource::tileCount(mips.level(i).width, mips.level(i).height) * TileSource::tileBytes(format));
+                std::vector<uint8_t> row;
+                return write(source, kind, format, mips.level(0).width, mips.level(0).height, sizes, [&](size_t index, std::ostream& out)
+                {
+                    const int level = static_cast<int>(index);
+                    row.resize(TileSource::tilesAcross(mips.level(level).width) * TileSource::tileBytes(format));
+                    for (size_t j = 0; j < TileSource::tilesAcross(mips.level(level).height) && out; ++j)
+                    {
+                        mips.encodeTileRow(level, j, format, row.data());
+                        out.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size()));
+                    }
+                }, variant);
+            }
+
+            // Levels written by writePyramid(); false unless the sections match the shape
+            // MipPyramid builds for the entry's size.
+            static bool pyramidLevels(const Entry& entry, std::vector<MipPyramid::LevelView>& levels)
+            {
+                levels.clear();
+                int w = entry.width(), h = entry.height();
+                for (size_t i = 0; i < entry.sectionCount(); ++i)
+                {
+                    if (w <= 0 || h <= 0 || entry.sectionSize(i) != TileSource::tileCount(w, h) * TileSource::tileBytes(entry.format()))
+                        return false;
+                    levels.push_back(MipPyramid::LevelView{ w, h, nullptr });
+                    if (w == 1 && h == 1)
+                        return i + 1 == entry.sectionCount();
+                    w = std::max(w / 2, 1);
+                    h = std::max(h / 2, 1);
+                }
+                return false;
+            }
+
+        private:
+            static uint64_t alignUp(uint64_t offset) { return (offset + 63) & ~uint64_t(63); }
+
+            static std::mutex& settingsMutex()
+            {
+                static std::mutex mutex;
+                return mutex;
+            }
+
+            static std::string& directoryName()
+            {
+                static std::string name;
+                return name;
+            }
+
+            //Whole seconds alone miss an edit within the second the cache was written
+            static int64_t modificationTime(const struct stat& info)
+            {
+                int64_t nanoseconds = 0;
+#if defined(__APPLE__)
+                nanoseconds = info.st_mtimespec.tv_nsec;
+#elif !defined(_WIN32)
+                nanoseconds = info.st_mtim.tv_nsec;
+#endif
+                return static_cast<int64_t>(info.st_mtime) * 1000000000 + nanoseconds;
+            }
+
+            static bool fileSizeOf(const std::string& path, uint64_t& size)
+            {
+                struct stat info;
+                if (stat(path.c_str(), &info) != 0)
+                    return false;
+                size = static_cast<uint64_t>(info.st_size);
+                return true;
+            }
+
+            static bool describeSource(const std::string& source, uint32_t kind, TexelFormat format, int width, int height, uint32_t sectionCount,
+                Entry::Header& header)
+            {
+                struct stat info;
+                if (stat(source.c_str(), &info) != 0)
+                    return false;
+                std::memset(&header, 0, sizeof(header));
+                std::memcpy(header.magic, "GRAYTEX", 8);
+                header.version = 3;
+                header.kind = kind;
+                header.sourceSize = static_cast<uint64_t>(info.st_size);
+                header.sourceTime = modificationTime(info);
+                header.width = width;
+                header.height = height;
+                header.sectionCount = sectionCount;
+                header.format = static_cast<uint32_t>(format);
+                return true;
+            }
+        };
+    }
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace GRay
+{
+    namespace Utils
+    {
+        class ThreadPool
+        {
+        public:
+            // threadCount == 0 picks one worker per hardware thread.
+            explicit ThreadPool(size_t threadCount = 0)
+            {
+                if (threadCount == 0)
+                    threadCount = defaultThreadCount();
+                workers.reserve(threadCount);
+                for (size_t i = 0; i < threadCount; ++i)
+                    workers.emplace_back([this] { workerLoop(); });
+            }
+
+            ~ThreadPool()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(queueMutex);
+                    stopping = true;
+                }
+                queueCondition.notify_all();
+                for (std::thread& worker : workers)
+                    worker.join();
+            }
+
+            ThreadPool(const ThreadPool&) = delete;
+            ThreadPool& operator=(const ThreadPool&) = delete;
+
+            size_t size() const { return workers.size(); }
+
+            template <typename F>
+            std::future<typename std::result_of<F()>::type> submit(F task)
+            {
+                typedef typename std::result_of<F()>::type Result;
+                auto packaged = std::make_shared<std::packaged_task<Result()> >(std::move(task));
+                std::future<Result> result = packaged->get_future();
+                {
+                    std::lock_guard<std::mutex> lock(queueMutex);
+                    tasks.push([packaged] { (*packaged)(); });
+                }
+                queueCondition.notify_one();
+                return result;
+            }
+
+            // Runs one queued task on the calling thread; false when there was nothing to run.
+            bool runPendingTask()
+            {
+                std::function<void()> task;
+                {
+                    std::lock_guard<std::mutex> lock(queueMutex);
+                    if (tasks.empty())
+                        return false;
+                    task = std::move(tasks.front());
+                    tasks.pop();
+                }
+                task();
+                return true;
+            }
+
+            // Waits for a task submitted to this pool, running other queued tasks in the meantime.
+            // Safe to call from inside a task (fork/join), where a plain get() could deadlock.
+            template <typename T>
+            T waitFor(std::future<T>& result)
+            {
+                while (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                    if (!runPendingTask())
+                        std::this_thread::yield();
+                return result.get();
+            }
+
+            // Calls body(chunkBegin, chunkEnd) over [begin, end) in chunks of at least grain items.
+            template <typename F>
+            void parallelFor(size_t begin, size_t end, size_t grain, F body)
+            {
+                if (end <= begin)
+                    return;
+                grain = std::max<size_t>(grain, 1);
+                size_t chunks = std::max<size_t>(std::min((end - begin + grain - 1) / grain, 4 * size()), 1);
+                std::vector<std::future<void> > pending;
+                for (size_t c = 1; c < chunks; ++c)
+                {
+                    size_t b = begin + (end - begin) * c / chunks;
+                    size_t e = begin + (end - begin) * (c + 1) / chunks;
+                    pending.push_back(submit([=] { body(b, e); }));
+                }
+                body(begin, begin + (end - begin) / chunks);
+                for (std::future<void>& chunk : pending)
+                    waitFor(chunk);
+            }
+
+            static size_t defaultThreadCount()
+            {
+                unsigned hw = std::thread::hardware_concurrency();
+                return hw == 0 ? 1 : hw;
+            }
+
+        private:
+            void workerLoop()
+            {
+                while (true)
+                {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(queueMutex);
+                        queueCondition.wait(lock, [this] { return stopping || !tasks.empty(); });
+                        if (stopping && tasks.empty())
+                            return;
+                        task = std::move(tasks.front());
+                        tasks.pop();
+                    }
+                    task();
+                }
+            }
+
+        private:
+            std::vector<std::thread> workers;
+            std::queue<std::function<void()> > tasks;
+            std::mutex queueMutex;
+            std::condition_variable queueCondition;
+            bool stopping = false;
+        };
+    }
+}
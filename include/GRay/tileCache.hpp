@@ -0,0 +1,302 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/mipmap.hpp>
+#include <GRay/textureCache.hpp>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace GRay
+{
+    namespace Materials
+    {
+        // Texture tiles resident in memory, shared by every paged texture. Least recently used
+        // tiles are dropped once the resident bytes exceed the budget; a budget of 0 turns
+        // paging off and textures map their cache files whole instead.
+        // Tiles are split over independently locked shards, each holding its share of the budget.
+        class TileCache
+        {
+        public:
+            typedef shared_ptr<const std::vector<uint8_t> > TilePtr;
+
+            struct Statistics
+            {
+                uint64_t hits;
+                uint64_t misses;
+                uint64_t evictions;
+                size_t residentBytes;
+                size_t peakBytes;
+            };
+
+            static TileCache& global()
+            {
+                static TileCache cache;
+                return cache;
+            }
+
+            TileCache() : budgetBytes{ 0 }, nextOwner{ 1 }, resident{ 0 }, peak{ 0 } {}
+            TileCache(const TileCache&) = delete;
+            TileCache& operator=(const TileCache&) = delete;
+
+            // Applies to textures loaded afterwards.
+            void setBudget(size_t bytes) { budgetBytes = bytes; }
+            size_t budget() const { return budgetBytes; }
+
+            // Identifies the tiles of one texture.
+            uint64_t newOwner() { return nextOwner++; }
+
+            // Tile key of owner, calling load(texels) to read it on a miss.
+            template<class Load>
+            TilePtr get(uint64_t owner, uint64_t key, Load load)
+            {
+                Shard& shard = shardFor(owner, key);
+                {
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+                    auto found = shard.index.find(Key{ owner, key });
+                    if (found != shard.index.end())
+                    {
+                        ++shard.hits;
+                        shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+                        return found->second->texels;
+                    }
+                    ++shard.misses;
+                }
+
+                //Read outside the lock; if another thread loaded the tile meanwhile, use theirs
+                auto texels = make_shared<std::vector<uint8_t> >();
+                load(*texels);
+                size_t bytes = texels->size();
+
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                auto found = shard.index.find(Key{ owner, key });
+                if (found != shard.index.end())
+                    return found->second->texels;
+                shard.lru.push_front(Node{ Key{ owner, key }, texels, bytes });
+                shard.index.emplace(Key{ owner, key }, shard.lru.begin());
+                shard.bytes += bytes;
+                addResident(bytes);
+                size_t shardBudget = budgetBytes / shardCount;
+                while (shard.bytes > shardBudget && shard.lru.size() > 1)
+                {
+                    const Node& victim = shard.lru.back();
+                    shard.bytes -= victim.bytes;
+                    resident -= victim.bytes;
+                    ++shard.evictions;
+                    shard.index.erase(victim.key);
+                    shard.lru.pop_back();
+                }
+                return texels;
+            }
+
+            // Drops every tile of owner, e.g. when its texture is destroyed.
+            void release(uint64_t owner)
+            {
+                for (Shard& shard : shards)
+                {
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+                    for (auto node = shard.lru.begin(); node != shard.lru.end();)
+                    {
+                        if (node->key.owner != owner)
+                        {
+                            ++node;
+                            continue;
+                        }
+                        shard.bytes -= node->bytes;
+                        resident -= node->bytes;
+                        shard.index.erase(node->key);
+                        node = shard.lru.erase(node);
+                    }
+                }
+            }
+
+            // Hits and misses count lookups reaching the cache; repeated lookups of the tile a
+            // thread used last are served before that.
+            Statistics statistics() const
+            {
+                Statistics s{ 0, 0, 0, resident.load(), peak.load() };
+                for (const Shard& shard : shards)
+                {
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+                    s.hits += shard.hits;
+                    s.misses += shard.misses;
+                    s.evictions += shard.evictions;
+                }
+                return s;
+            }
+
+            void resetStatistics()
+            {
+                for (Shard& shard : shards)
+                {
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+                    shard.hits = shard.misses = shard.evictions = 0;
+                }
+                peak = resident.load();
+            }
+
+        private:
+            static const size_t shardCount = 16;
+
+            struct Key
+            {
+                uint64_t owner;
+                uint64_t tile;
+                bool operator==(const Key& other) const { return owner == other.owner && tile == other.tile; }
+            };
+            struct KeyHash
+            {
+                size_t operator()(const Key& k) const { return std::hash<uint64_t>()(k.owner * 0x9e3779b97f4a7c15ull ^ k.tile); }
+            };
+            struct Node
+            {
+                Key key;
+                TilePtr texels;
+                size_t bytes;
+            };
+            struct Shard
+            {
+                Shard() : bytes{ 0 }, hits{ 0 }, misses{ 0 }, evictions{ 0 } {}
+                mutable std::mutex mutex;
+                std::list<Node> lru; //most recently used first
+                std::unordered_map<Key, std::list<Node>::iterator, KeyHash> index;
+                size_t bytes;
+                uint64_t hits, misses, evictions;
+            };
+
+            Shard& shardFor(uint64_t owner, uint64_t key) { return shards[KeyHash()(Key{ owner, key }) % shardCount]; }
+
+            void addResident(size_t bytes)
+            {
+                size_t now = resident += bytes;
+                size_t highest = peak.load();
+                while (now > highest && !peak.compare_exchange_weak(highest, now)) {}
+            }
+
+        private:
+            std::atomic<size_t> budgetBytes;
+            std::atomic<uint64_t> nextOwner;
+            std::atomic<size_t> resident;
+            std::atomic<size_t> peak;
+            Shard shards[shardCount];
+        };
+
+        // Tiles of a texture cache file mapped whole.
+        class MappedTiles : public TileSource
+        {
+        public:
+            MappedTiles(shared_ptr<Utils::MappedFile> file, std::vector<uint64_t> levelOffsets, TexelFormat format)
+                : file{ file }, levelOffsets(levelOffsets), bytesPerTile{ tileBytes(format) } {}
+
+            const uint8_t* tile(int level, size_t index) const override
+            {
+                return file->data() + levelOffsets[level] + index * bytesPerTile;
+            }
+
+        private:
+            shared_ptr<Utils::MappedFile> file;
+            std::vector<uint64_t> levelOffsets;
+            size_t bytesPerTile;
+        };
+
+        // Tiles of a texture cache file read on first use and kept in a TileCache.
+        class PagedTiles : public TileSource
+        {
+        public:
+            PagedTiles(shared_ptr<Utils::FileReader> reader, std::vector<uint64_t> levelOffsets, TexelFormat format,
+                TileCache& cache = TileCache::global())
+                : reader{ reader }, levelOffsets(levelOffsets), bytesPerTile{ tileBytes(format) }, cache(cache), owner{ cache.newOwner() } {}
+
+            ~PagedTiles() { cache.release(owner); }
+
+            const uint8_t* tile(int level, size_t index) const override
+            {
+                //Bilinear lookups mostly stay within one tile, so skip the cache for repeats
+                struct LastTile
+                {
+                    uint64_t owner;
+                    uint64_t key;
+                    TileCache::TilePtr texels;
+                };
+                static thread_local LastTile last{ 0, 0, nullptr };
+
+                uint64_t key = (static_cast<uint64_t>(level) << 48) | index;
+                if (last.owner == owner && last.key == key)
+                    return last.texels->data();
+
+                uint64_t offset = levelOffsets[level] + index * bytesPerTile;
+                TileCache::TilePtr texels = cache.get(owner, key, [&](std::vector<uint8_t>& out)
+                {
+                    out.resize(bytesPerTile);
+                    if (!reader->read(offset, out.data(), bytesPerTile))
+                        std::fill(out.begin(), out.end(), 0);
+                });
+                last = LastTile{ owner, key, texels };
+                return texels->data();
+            }
+
+        private:
+            shared_ptr<Utils::FileReader> reader;
+            std::vector<uint64_t> levelOffsets;
+            size_t bytesPerTile;
+            TileCache& cache;
+            uint64_t owner;
+        };
+
+        // Tiles of a pyramid encoded in memory, for textures kept in a compact format without a
+        // texture cache.
+        class ResidentTiles : public TileSource
+        {
+        public:
+            ResidentTiles(const MipPyramid& mips, TexelFormat format) : bytesPerTile{ tileBytes(format) }
+            {
+                for (int i = 0; i < mips.levels(); ++i)
+                    levelTexels.push_back(mips.tiledLevel(i, format));
+            }
+
+            const uint8_t* tile(int level, size_t index) const override
+            {
+                return levelTexels[level].data() + index * bytesPerTile;
+            }
+
+        private:
+            std::vector<std::vector<uint8_t> > levelTexels;
+            size_t bytesPerTile;
+        };
+
+        // mips re-encoded as format and held by ResidentTiles, so the float levels can go.
+        inline MipPyramid residentPyramid(const MipPyramid& mips, bool wrap, TexelFormat format)
+        {
+            std::vector<MipPyramid::LevelView> levels;
+            for (int i = 0; i < mips.levels(); ++i)
+                levels.push_back(MipPyramid::LevelView{ mips.level(i).width, mips.level(i).height, nullptr });
+            return MipPyramid(levels, wrap, make_shared<ResidentTiles>(mips, format), format);
+        }
+
+        // Pyramid stored in the texture cache of source by TextureCache::writePyramid(), mapped
+        // whole or, with a TileCache budget, paged in tile by tile. False if the cache is
+        // missing, stale or not in format.
+        inline bool openCachedPyramid(const std::string& source, uint32_t kind, bool wrap, MipPyramid& mips,
+            TexelFormat format = TexelFormat::Float32, const std::string& variant = "")
+        {
+            bool paged = TileCache::global().budget() > 0;
+            TextureCache::Entry entry = TextureCache::open(source, kind, !paged, variant);
+            std::vector<MipPyramid::LevelView> levels;
+            if (!entry.valid() || entry.format() != format || !TextureCache::pyramidLevels(entry, levels))
+                return false;
+            std::vector<uint64_t> offsets;
+            for (size_t i = 0; i < entry.sectionCount(); ++i)
+                offsets.push_back(entry.sectionOffset(i));
+            shared_ptr<const TileSource> tiles;
+            if (paged)
+                tiles = make_shared<PagedTiles>(entry.fileReader(), offsets, format);
+            else
+                tiles = make_shared<MappedTiles>(entry.mapping(), offsets, format);
+            mips = MipPyramid(levels, wrap, tiles, format);
+            return true;
+        }
+    }
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/aabb.h>
+
+namespace GRay
+{
+    namespace Math
+    {
+        // Affine transform kept as the top three rows of a 4x4 matrix; the bottom row is
+        // always (0, 0, 0, 1). Directions are transformed without the translation column and
+        // without normalising, so ray distances t carry over between the two spaces.
+        class Transform
+        {
+        public:
+            Transform()
+            {
+                for (int i = 0; i < 3; ++i)
+                    for (int j = 0; j < 4; ++j)
+                        m[i][j] = i == j ? 1.0 : 0.0;
+            }
+
+            static Transform translation(const Vec3& offset)
+            {
+                Transform t;
+                for (int i = 0; i < 3; ++i)
+                    t.m[i][3] = offset[i];
+                return t;
+            }
+
+            static Transform scaling(const Vec3& factors)
+            {
+                Transform t;
+                for (int i = 0; i < 3; ++i)
+                    t.m[i][i] = factors[i];
+                return t;
+            }
+
+            // Counter-clockwise by degrees when looking down axis towards the origin. About
+            // (0, 1, 0) this is the rotation of RotateY.
+            static Transform rotation(const Vec3& axis, double degrees);
+
+            // Applies other first, then this.
+            Transform operator*(const Transform& other) const;
+            Transform inverse() const;
+
+            Point3 applyToPoint(const Point3& p) const
+            {
+                return Point3(m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3],
+                              m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3],
+                              m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]);
+            }
+            Vec3 applyToVector(const Vec3& v) const
+            {
+                return Vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                            m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                            m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+            }
+            // Normals go through the inverse transpose: call this on the inverse of the
+            // transform that moves the surface.
+            Vec3 applyTransposeToVector(const Vec3& v) const
+            {
+                return Vec3(m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+                            m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+                            m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]);
+            }
+            Ray applyToRay(const Ray& r) const
+            {
+                return Ray(applyToPoint(r.origin()), applyToVector(r.direction()), r.time());
+            }
+            // Bounds of the transformed box (Arvo, Graphics Gems 1990).
+            Solids::AABB applyToBox(const Solids::AABB& box) const;
+
+            double determinant() const
+            {
+                return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                     - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                     + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+            }
+            // Length scale of the transform: the edge of a cube of the transformed volume.
+            double scale() const { return std::cbrt(fabs(determinant())); }
+            bool isIdentity() const
+            {
+                for (int i = 0; i < 3; ++i)
+                    for (int j = 0; j < 4; ++j)
+                        if (m[i][j] != (i == j ? 1.0 : 0.0))
+                            return false;
+                return true;
+            }
+
+        public:
+            double m[3][4];
+        };
+
+        inline Transform Transform::rotation(const Vec3& axis, double degrees)
+        {
+            const Vec3 a = unitVector(axis);
+            const double radians = Utils::degreesToRadians(degrees);
+            const double s = sin(radians);
+            const double c = cos(radians);
+            //Rodrigues' formula
+            Transform t;
+            for (int i = 0; i < 3; ++i)
+                for (int j = 0; j < 3; ++j)
+                    t.m[i][j] = a[i] * a[j] * (1 - c) + (i == j ? c : 0.0);
+            t.m[0][1] -= a[2] * s;
+            t.m[0][2] += a[1] * s;
+            t.m[1][0] += a[2] * s;
+            t.m[1][2] -= a[0] * s;
+            t.m[2][0] -= a[1] * s;
+            t.m[2][1] += a[0] * s;
+            return t;
+        }
+
+        inline Transform Transform::operator*(const Transform& other) const
+        {
+            Transform t;
+            for (int i = 0; i < 3; ++i)
+                for (int j = 0; j < 4; ++j)
+                    t.m[i][j] = m[i][0] * other.m[0][j] + m[i][1] * other.m[1][j] + m[i][2] * other.m[2][j] + (j == 3 ? m[i][3] : 0.0);
+            return t;
+        }
+
+        inline Transform Transform::inverse() const
+        {
+            //Adjugate of the linear part over its determinant, then the translation undone
+            const double invDet = 1.0 / determinant();
+            Transform t;
+            t.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * invDet;
+            t.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * invDet;
+            t.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invDet;
+            t.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * invDet;
+            t.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invDet;
+            t.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * invDet;
+            t.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * invDet;
+            t.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * invDet;
+            t.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invDet;
+            for (int i = 0; i < 3; ++i)
+                t.m[i][3] = -(t.m[i][0] * m[0][3] + t.m[i][1] * m[1][3] + t.m[i][2] * m[2][3]);
+            return t;
+        }
+
+        inline Solids::AABB Transform::applyToBox(const Solids::AABB& box) const
+        {
+            Point3 lo, hi;
+            for (int i = 0; i < 3; ++i)
+            {
+                lo[i] = hi[i] = m[i][3];
+                for (int j = 0; j < 3; ++j)
+                {
+                    const double a = m[i][j] * box.min()[j];
+                    const double b = m[i][j] * box.max()[j];
+                    lo[i] += fmin(a, b);
+                    hi[i] += fmax(a, b);
+                }
+            }
+            return Solids::AABB(lo, hi);
+        }
+    }
+}
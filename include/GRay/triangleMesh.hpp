@@ -0,0 +1,304 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/hittable.hpp>
+#include <GRay/bvhBuilder.hpp>
+#include <GRay/wideBvh.hpp>
+#include <GRay/alignedAllocator.hpp>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace GRay
+{
+    namespace Solids
+    {
+        // Indexed triangles over shared vertex buffers, stored as floats. Normals and UVs have
+        // index lists of their own, as in OBJ files; an empty list means the attribute is
+        // indexed like the positions, as in PLY files.
+        struct MeshData
+        {
+            static const uint32_t noAttribute = 0xffffffffu; //corner without a normal or UV
+
+            std::vector<float> positions;        //x, y, z per vertex
+            std::vector<float> normals;          //x, y, z per normal, may be empty
+            std::vector<float> uvs;              //u, v per texture coordinate, may be empty
+            std::vector<uint32_t> indices;       //three positions per triangle
+            std::vector<uint32_t> normalIndices; //three per triangle, or empty
+            std::vector<uint32_t> uvIndices;     //three per triangle, or empty
+
+            size_t triangleCount() const { return indices.size() / 3; }
+            size_t vertexCount() const { return positions.size() / 3; }
+            size_t memoryUsage() const
+            {
+                return (positions.size() + normals.size() + uvs.size()) * sizeof(float)
+                    + (indices.size() + normalIndices.size() + uvIndices.size()) * sizeof(uint32_t);
+            }
+        };
+
+        namespace Detail
+        {
+            // Ray sheared so that it runs along +z from the origin, for the watertight triangle
+            // test of Woop, Benthin and Wald (JCGT 2013). Computed once per ray.
+            struct WatertightRay
+            {
+                explicit WatertightRay(const Math::Ray& r) : origin{ r.origin() }
+                {
+                    const Math::Vec3 d = r.direction();
+                    kz = fabs(d.x()) > fabs(d.y()) ? (fabs(d.x()) > fabs(d.z()) ? 0 : 2) : (fabs(d.y()) > fabs(d.z()) ? 1 : 2);
+                    kx = (kz + 1) % 3;
+                    ky = (kx + 1) % 3;
+                    //Keep the winding, so edge function signs mean the same for every ray
+                    if (d[kz] < 0)
+                        std::swap(kx, ky);
+                    shearX = d[kx] / d[kz];
+                    shearY = d[ky] / d[kz];
+                    shearZ = 1.0 / d[kz];
+                }
+
+                Math::Point3 origin;
+                int kx, ky, kz;
+                double shearX, shearY, shearZ;
+            };
+
+            // Rays through a shared edge or vertex hit at least one of the triangles around it.
+            // On a hit, b1 and b2 are the barycentric weights of p1 and p2.
+            inline bool watertightTriangle(const WatertightRay& ray, const float* p0, const float* p1, const float* p2,
+                double t_min, double t_max, double& t, double& b1, double& b2)
+            {
+                const double az = p0[ray.kz] - ray.origin[ray.kz];
+                const double bz = p1[ray.kz] - ray.origin[ray.kz];
+                const double cz = p2[ray.kz] - ray.origin[ray.kz];
+                const double ax = p0[ray.kx] - ray.origin[ray.kx] - ray.shearX * az;
+                const double ay = p0[ray.ky] - ray.origin[ray.ky] - ray.shearY * az;
+                const double bx = p1[ray.kx] - ray.origin[ray.kx] - ray.shearX * bz;
+                const double by = p1[ray.ky] - ray.origin[ray.ky] - ray.shearY * bz;
+                const double cx = p2[ray.kx] - ray.origin[ray.kx] - ray.shearX * cz;
+                const double cy = p2[ray.ky] - ray.origin[ray.ky] - ray.shearY * cz;
+
+                //Edge functions; the ray misses when they disagree in sign
+                const double u = cx * by - cy * bx;
+                const double v = ax * cy - ay * cx;
+                const double w = bx * ay - by * ax;
+                if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+                    return false;
+                const double det = u + v + w;
+                if (det == 0)
+                    return false;
+
+                const double root = (u * az + v * bz + w * cz) * ray.shearZ / det;
+                if (root < t_min || t_max < root)
+                    return false;
+                t = root;
+                b1 = v / det;
+                b2 = w / det;
+                return true;
+            }
+        }
+
+        // Triangle mesh with its own 8-wide BVH over triangle indices. Triangles are reordered
+        // into leaf order at construction, so leaves are plain index ranges and a hit triangle
+        // is reported in rec.primitive. Triangles are two-sided; the geometric normal faces
+        // where the corners run counter-clockwise, and interpolated normals are used for
+        // shading when the mesh has them. Without UVs the barycentric coordinates are used.
+        class TriangleMesh : public Math::Hittable
+        {
+        public:
+            TriangleMesh() : material{ invalidMaterial } {}
+            TriangleMesh(MeshData data, MaterialHandle meshMaterial, const BvhBuildOptions& options = defaultBuildOptions());
+            TriangleMesh(MeshData data, shared_ptr<Material> mat_ptr, const BvhBuildOptions& options = defaultBuildOptions()) :
+                TriangleMesh(std::move(data), MaterialRegistry::current().add(mat_ptr), options) {}
+
+            // SAH with up to four triangles per leaf.
+            static BvhBuildOptions defaultBuildOptions()
+            {
+                BvhBuildOptions options(BvhSplitMethod::SAH);
+                options.maxLeafSize = 4;
+                return options;
+            }
+
+            bool hit(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const override
+            {
+                return intersectAndFinalize(r, t_min, t_max, rec);
+            }
+            bool intersect(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const override;
+            void finalizeHit(const Math::Ray& r, Math::hitRecord& rec) const override;
+            bool occluded(const Math::Ray& r, double t_min, double t_max) const override;
+            bool boundingBox(double time0, double time1, GRay::Solids::AABB& outputBox) const override
+            {
+                outputBox = bounds;
+                return !nodes.empty();
+            }
+
+            size_t size() const { return mesh.triangleCount(); }
+            size_t nodeCount() const { return nodes.size(); }
+            size_t memoryUsage() const { return nodes.size() * sizeof(WideBvhNode<8>) + mesh.memoryUsage(); }
+            // Triangles are in BVH leaf order, not input order.
+            const MeshData& data() const { return mesh; }
+
+        private:
+            const float* corner(uint32_t triangle, int k) const { return &mesh.positions[3 * static_cast<size_t>(mesh.indices[3 * static_cast<size_t>(triangle) + k])]; }
+            bool triangleHit(const Detail::WatertightRay& ray, uint32_t triangle, double t_min, double t_max, double& t, double& b1, double& b2) const
+            {
+                return Detail::watertightTriangle(ray, corner(triangle, 0), corner(triangle, 1), corner(triangle, 2), t_min, t_max, t, b1, b2);
+            }
+
+        private:
+            MeshData mesh;
+            std::vector<WideBvhNode<8>, Utils::AlignedAllocator<WideBvhNode<8>, 64> > nodes; //leaf children index triangles
+            MaterialHandle material;
+            AABB bounds;
+        };
+
+        inline TriangleMesh::TriangleMesh(MeshData data, MaterialHandle meshMaterial, const BvhBuildOptions& options) :
+            mesh(std::move(data)), material{ meshMaterial }
+        {
+            const size_t triangles = mesh.triangleCount();
+            if (triangles == 0)
+                return;
+
+            BvhBuildOptions buildOptions = options;
+            if (buildOptions.maxDepth <= 0 || buildOptions.maxDepth > Detail::wideBvhMaxDepth)
+                buildOptions.maxDepth = Detail::wideBvhMaxDepth;
+            BvhBuilder builder(buildOptions);
+
+            std::unique_ptr<BvhBuildNode> root;
+            {
+                std::vector<BvhPrimitive> primitives(triangles);
+                for (size_t i = 0; i < triangles; ++i)
+                {
+                    Math::Point3 lo(Utils::infinity, Utils::infinity, Utils::infinity);
+                    Math::Point3 hi(-Utils::infinity, -Utils::infinity, -Utils::infinity);
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        const float* p = corner(static_cast<uint32_t>(i), k);
+                        for (int a = 0; a < 3; ++a)
+                        {
+                            lo[a] = fmin(lo[a], p[a]);
+                            hi[a] = fmax(hi[a], p[a]);
+                        }
+                    }
+                    primitives[i].box = AABB(lo, hi);
+                    primitives[i].centroid = 0.5 * (lo + hi);
+                    primitives[i].mortonCode = 0;
+                    primitives[i].index = static_cast<uint32_t>(i);
+                }
+                root = builder.build(primitives);
+
+                //Leaf order, so leaves index triangles directly
+                auto reorder = [&](std::vector<uint32_t>& list)
+                {
+                    if (list.empty())
+                        return;
+                    std::vector<uint32_t> ordered(list.size());
+                    for (size_t i = 0; i < triangles; ++i)
+                        for (int k = 0; k < 3; ++k)
+                            ordered[3 * i + k] = list[3 * static_cast<size_t>(primitives[i].index) + k];
+                    list.swap(ordered);
+                };
+                reorder(mesh.indices);
+                reorder(mesh.normalIndices);
+                reorder(mesh.uvIndices);
+            }
+            bounds = root->bounds;
+
+            nodes.reserve(builder.nodes() / 7 + 1);
+            Detail::collapseWide<8>(*root, nodes, [](const BvhBuildNode& leaf, uint32_t& first, uint32_t& count)
+            {
+                first = static_cast<uint32_t>(leaf.start);
+                count = static_cast<uint32_t>(leaf.count());
+            });
+            builder.finish();
+        }
+
+        inline bool TriangleMesh::intersect(const Math::Ray& r, double t_min, double t_max, Math::hitRecord& rec) const
+        {
+            const Detail::WatertightRay ray(r);
+            return Detail::wideClosestHit<8>(nodes, r, t_min, t_max, [&](uint32_t first, uint32_t count, double& tMax)
+            {
+                bool hitAnything = false;
+                for (uint32_t i = first; i < first + count; ++i)
+                {
+                    double t, b1, b2;
+                    if (triangleHit(ray, i, t_min, tMax, t, b1, b2))
+                    {
+                        hitAnything = true;
+                        tMax = t;
+                        rec.t = t;
+                        rec.object = this;
+                        rec.primitive = i;
+                        //Barycentrics ride along in u and v until finalizeHit()
+                        rec.u = b1;
+                        rec.v = b2;
+                    }
+                }
+                return hitAnything;
+            });
+        }
+
+        inline bool TriangleMesh::occluded(const Math::Ray& r, double t_min, double t_max) const
+        {
+            const Detail::WatertightRay ray(r);
+            return Detail::wideAnyHit<8>(nodes, r, t_min, t_max, [&](uint32_t first, uint32_t count)
+            {
+                for (uint32_t i = first; i < first + count; ++i)
+                {
+                    double t, b1, b2;
+                    if (triangleHit(ray, i, t_min, t_max, t, b1, b2))
+                        return true;
+                }
+                return false;
+            });
+        }
+
+        inline void TriangleMesh::finalizeHit(const Math::Ray& r, Math::hitRecord& rec) const
+        {
+            const size_t base = 3 * static_cast<size_t>(rec.primitive);
+            const double b1 = rec.u;
+            const double b2 = rec.v;
+            const double b0 = 1.0 - b1 - b2;
+            rec.p = r.at(rec.t);
+
+            auto point = [](const float* p) { return Math::Point3(p[0], p[1], p[2]); };
+            const Math::Point3 p0 = point(corner(rec.primitive, 0));
+            const Math::Vec3 e1 = point(corner(rec.primitive, 1)) - p0;
+            const Math::Vec3 e2 = point(corner(rec.primitive, 2)) - p0;
+            const Math::Vec3 geometricNormal = cross(e1, e2);
+            const double worldArea = geometricNormal.length();
+            rec.setFaceNormal(r, geometricNormal / worldArea);
+
+            //Interpolated normal, turned to the side the ray arrived from
+            if (!mesh.normals.empty())
+            {
+                const std::vector<uint32_t>& list = mesh.normalIndices.empty() ? mesh.indices : mesh.normalIndices;
+                if (list[base] != MeshData::noAttribute && list[base + 1] != MeshData::noAttribute && list[base + 2] != MeshData::noAttribute)
+                {
+                    Math::Vec3 shading = b0 * point(&mesh.normals[3 * static_cast<size_t>(list[base])])
+                        + b1 * point(&mesh.normals[3 * static_cast<size_t>(list[base + 1])])
+                        + b2 * point(&mesh.normals[3 * static_cast<size_t>(list[base + 2])]);
+                    const double length = shading.length();
+                    if (length > 0)
+                        rec.normal = dot(shading, rec.normal) < 0 ? -shading / length : shading / length;
+                }
+            }
+
+            //Texture coordinates: interpolated, or (0,0), (1,0), (1,1) at the corners
+            double uv[3][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 } };
+            if (!mesh.uvs.empty())
+            {
+                const std::vector<uint32_t>& list = mesh.uvIndices.empty() ? mesh.indices : mesh.uvIndices;
+                if (list[base] != MeshData::noAttribute && list[base + 1] != MeshData::noAttribute && list[base + 2] != MeshData::noAttribute)
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        uv[k][0] = mesh.uvs[2 * static_cast<size_t>(list[base + k])];
+                        uv[k][1] = mesh.uvs[2 * static_cast<size_t>(list[base + k]) + 1];
+                    }
+            }
+            rec.u = b0 * uv[0][0] + b1 * uv[1][0] + b2 * uv[2][0];
+            rec.v = b0 * uv[0][1] + b1 * uv[1][1] + b2 * uv[2][1];
+            const double uvArea = fabs((uv[1][0] - uv[0][0]) * (uv[2][1] - uv[0][1]) - (uv[2][0] - uv[0][0]) * (uv[1][1] - uv[0][1]));
+            rec.uvDensity = worldArea > 0 ? sqrt(uvArea / worldArea) : 0;
+            rec.material = material;
+        }
+    }
+}
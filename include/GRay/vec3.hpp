@@ -112,55 +112,110 @@ namespace GRay
                 u.e[0] * v.e[1] - u.e[1] * v.e[0]);
         }
 
+        // Rec. 709 luminance of a linear RGB color.
+        inline double luminance(const Color& c)
+        {
+            return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+        }
+
         inline Vec3 unitVector(const Vec3& v)
         {
             return v / v.length();
         }
 
+        inline static Vec3 random(Random& rng)
+        {
+            //Draw in a fixed order, argument evaluation order is unspecified
+            double x = rng.nextDouble();
+            double y = rng.nextDouble();
+            double z = rng.nextDouble();
+            return Vec3(x, y, z);
+        }
+
+        inline static Vec3 random(double min, double max, Random& rng)
+        {
+            double x = rng.nextDouble(min, max);
+            double y = rng.nextDouble(min, max);
+            double z = rng.nextDouble(min, max);
+            return Vec3(x, y, z);
+        }
+
         inline static Vec3 random()
         {
-            return Vec3(randomDouble(), randomDouble(), randomDouble());
+            return random(threadRandom());
         }
 
         inline static Vec3 random(double min, double max)
         {
-            return Vec3(randomDouble(min, max), randomDouble(min, max), randomDouble(min, max));
+            return random(min, max, threadRandom());
         }
 
-        inline Vec3 randomInUnitSphere()
+        inline Vec3 randomInUnitSphere(Random& rng)
         {
             while (true)
             {
-                Vec3 p = random(-1, 1);
+                Vec3 p = random(-1, 1, rng);
                 if (p.lenghtSquared() >= 1) continue;
                 return p;
             }
         }
 
+        inline Vec3 randomInUnitSphere()
+        {
+            return randomInUnitSphere(threadRandom());
+        }
+
+        inline Vec3 randomUnitVector(Random& rng)
+        {
+            return unitVector(randomInUnitSphere(rng));
+        }
+
         inline Vec3 randomUnitVector()
         {
-            return unitVector(randomInUnitSphere());
+            return randomUnitVector(threadRandom());
         }
 
-        inline Vec3 randomInHemisphere(const Vec3& normal)
+        inline Vec3 randomInHemisphere(const Vec3& normal, Random& rng)
         {
-            Vec3 inUnitSphere = randomInUnitSphere();
+            Vec3 inUnitSphere = randomInUnitSphere(rng);
             if (dot(inUnitSphere, normal) > 0.0)
                 return inUnitSphere;
             else
                 return -inUnitSphere;
         }
 
-        inline Vec3 randomInUnitDisc()
+        inline Vec3 randomInHemisphere(const Vec3& normal)
+        {
+            return randomInHemisphere(normal, threadRandom());
+        }
+
+        inline Vec3 randomInUnitDisc(Random& rng)
         {
             while (true)
             {
-                Vec3 p = Vec3(randomDouble(-1, 1), randomDouble(-1, 1), 0);
+                double x = rng.nextDouble(-1, 1);
+                double y = rng.nextDouble(-1, 1);
+                Vec3 p = Vec3(x, y, 0);
                 if (p.lenghtSquared() >= 1) continue;
                 return p;
             }
         }
 
+        inline Vec3 randomInUnitDisc()
+        {
+            return randomInUnitDisc(threadRandom());
+        }
+
+        // Completes the unit vector w to an orthonormal basis (Duff et al. 2017).
+        inline void orthonormalBasis(const Vec3& w, Vec3& u, Vec3& v)
+        {
+            double sign = std::copysign(1.0, w.z());
+            double a = -1.0 / (sign + w.z());
+            double b = w.x() * w.y() * a;
+            u = Vec3(1.0 + sign * w.x() * w.x() * a, sign * b, -sign * w.x());
+            v = Vec3(b, sign + w.y() * w.y() * a, -w.y());
+        }
+
         inline Vec3 reflect(const Vec3& v, const Vec3& n)
         {
             return v - 2 * dot(v, n) * n;
@@ -0,0 +1,441 @@
+#pragma once
+
+#include <GRay/rtweekend.hpp>
+#include <GRay/hittable.hpp>
+#include <GRay/hittableList.hpp>
+#include <GRay/bvh.h>
+#include <GRay/alignedAllocator.hpp>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #define GRAY_WIDE_BVH_SSE 1
+    #include <xmmintrin.h>
+#endif
+#if defined(__AVX__)
+    #define GRAY_WIDE_BVH_AVX 1
+    #include <immintrin.h>
+#endif
+
+namespace GRay
+{
+    namespace Solids
+    {
+        // Width child boxes in SoA layout so one SIMD slab test covers every child.
+        // Interior children: count == 0, child is a node index. Leaf children: child is
+        // the first primitive, count > 0. Unused slots have inverted (empty) bounds.
+        template <int Width>
+        struct alignas(64) WideBvhNode
+        {
+            float boundsMin[3][Width];
+            float boundsMax[3][Width];
+            uint32_t child[Width];
+            uint16_t count[Width];
+        };
+
+        // Ray data in the float layout the slab tests want, computed once per ray.
+        struct WideBvhRay
+        {
+            explicit WideBvhRay(const GRay::Math::Ray& r)
+            {
+                for (int a = 0; a < 3; ++a)
+                {
+                    origin[a] = static_cast<float>(r.origin()[a]);
+                    invDir[a] = static_cast<float>(1.0 / r.direction()[a]);
+                    dirIsNeg[a] = invDir[a] < 0.0f;
+                }
+            }
+
+            float origin[3];
+            float invDir[3];
+            bool dirIsNeg[3];
+        };
+
+        namespace Detail
+        {
+            // Slack on the far distances so float rounding cannot reject a box the ray touches.
+            const float wideSlabSlack = 1.0f + 1e-5f;
+
+            // Tests lanes [first, first + lanes) of a node; sets bit i of the result when child i is hit.
+            template <int Width>
+            inline unsigned wideSlabTestScalar(const WideBvhNode<Width>& node, const WideBvhRay& ray, float tMin, float tMax, float* tNear, int first, int lanes)
+            {
+                unsigned mask = 0;
+                for (int i = first; i < first + lanes; ++i)
+                {
+                    float lo = tMin;
+                    float hi = tMax;
+                    for (int a = 0; a < 3; ++a)
+                    {
+                        const float nearPlane = ray.dirIsNeg[a] ? node.boundsMax[a][i] : node.boundsMin[a][i];
+                        const float farPlane = ray.dirIsNeg[a] ? node.boundsMin[a][i] : node.boundsMax[a][i];
+                        const float t0 = (nearPlane - ray.origin[a]) * ray.invDir[a];
+                        const float t1 = (farPlane - ray.origin[a]) * ray.invDir[a] * wideSlabSlack;
+                        //NaN (0 * inf on a slab plane) must not shrink the interval
+                        lo = t0 > lo ? t0 : lo;
+                        hi = t1 < hi ? t1 : hi;
+                    }
+                    tNear[i] = lo;
+                    if (lo <= hi)
+                        mask |= 1u << i;
+                }
+                return mask;
+            }
+
+#if defined(GRAY_WIDE_BVH_SSE)
+            template <int Width>
+            inline unsigned wideSlabTestSse(const WideBvhNode<Width>& node, const WideBvhRay& ray, float tMin, float tMax, float* tNear, int first)
+            {
+                __m128 lo = _mm_set1_ps(tMin);
+                __m128 hi = _mm_set1_ps(tMax);
+                const __m128 slack = _mm_set1_ps(wideSlabSlack);
+                for (int a = 0; a < 3; ++a)
+                {
+                    const float* nearPlanes = ray.dirIsNeg[a] ? node.boundsMax[a] : node.boundsMin[a];
+                    const float* farPlanes = ray.dirIsNeg[a] ? node.boundsMin[a] : node.boundsMax[a];
+                    const __m128 origin = _mm_set1_ps(ray.origin[a]);
+                    const __m128 invDir = _mm_set1_ps(ray.invDir[a]);
+                    __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearPlanes + first), origin), invDir);
+                    __m128 t1 = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(farPlanes + first), origin), invDir), slack);
+                    //min/max return the second operand for NaN, which keeps the running interval
+                    lo = _mm_max_ps(t0, lo);
+                    hi = _mm_min_ps(t1, hi);
+                }
+                _mm_storeu_ps(tNear + first, lo);
+                return static_cast<unsigned>(_mm_movemask_ps(_mm_cmple_ps(lo, hi))) << first;
+            }
+#endif
+
+#if defined(GRAY_WIDE_BVH_AVX)
+            inline unsigned wideSlabTestAvx(const WideBvhNode<8>& node, const WideBvhRay& ray, float tMin, float tMax, float* tNear)
+            {
+                __m256 lo = _mm256_set1_ps(tMin);
+                __m256 hi = _mm256_set1_ps(tMax);
+                const __m256 slack = _mm256_set1_ps(wideSlabSlack);
+                for (int a = 0; a < 3; ++a)
+                {
+                    const float* nearPlanes = ray.dirIsNeg[a] ? node.boundsMax[a] : node.boundsMin[a];
+                    const float* farPlanes = ray.dirIsNeg[a] ? node.boundsMin[a] : node.boundsMax[a];
+                    const __m256 origin = _mm256_set1_ps(ray.origin[a]);
+                    const __m256 invDir = _mm256_set1_ps(ray.invDir[a]);
+                    __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(nearPlanes), origin), invDir);
+                    __m256 t1 = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(farPlanes), origin), invDir), slack);
+                    lo = _mm256_max_ps(t0, lo);
+                    hi = _mm256_min_ps(t1, hi);
+                }
+                _mm256_storeu_ps(tNear, lo);
+                return static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(lo, hi, _CMP_LE_OQ)));
+            }
+#endif
+
+            template <int Width>
+            inline unsigned wideSlabTest(const WideBvhNode<Width>& node, const WideBvhRay& ray, float tMin, float tMax, float* tNear)
+            {
+#if defined(GRAY_WIDE_BVH_SSE)
+                unsigned mask = 0;
+                for (int first = 0; first < Width; first += 4)
+                    mask |= wideSlabTestSse(node, ray, tMin, tMax, tNear, first);
+                return mask;
+#else
+                return wideSlabTestScalar(node, ray, tMin, tMax, tNear, 0, Width);
+#endif
+            }
+
+#if defined(GRAY_WIDE_BVH_AVX)
+            template <>
+            inline unsigned wideSlabTest<8>(const WideBvhNode<8>& node, const WideBvhRay& ray, float tMin, float tMax, float* tNear)
+            {
+                return wideSlabTestAvx(node, ray, tMin, tMax, tNear);
+            }
+#endif
+        }
+
+        namespace Detail
+        {
+            // Deepest build tree a wide BVH is collapsed from; bounds the traversal stack.
+            const int wideBvhMaxDepth = 64;
+
+            struct WideBvhStackEntry
+            {
+                uint32_t index;
+                uint32_t count; //0 - interior node, otherwise a leaf range
+                float tNear;
+            };
+
+            // Fills a slot from a build node; null leaves the slot empty. leafRange(node, first, count)
+            // says which items a leaf covers in the caller's storage.
+            template <int Width, typename LeafRange>
+            inline void setWideChild(WideBvhNode<Width>& node, int slot, const BvhBuildNode* buildNode, LeafRange& leafRange)
+            {
+                for (int a = 0; a < 3; ++a)
+                {
+                    node.boundsMin[a][slot] = buildNode ? roundDownToFloat(buildNode->bounds.min()[a]) : std::numeric_limits<float>::infinity();
+                    node.boundsMax[a][slot] = buildNode ? roundUpToFloat(buildNode->bounds.max()[a]) : -std::numeric_limits<float>::infinity();
+                }
+                node.child[slot] = 0;
+                node.count[slot] = 0;
+                if (buildNode && buildNode->isLeaf())
+                {
+                    uint32_t first, count;
+                    leafRange(*buildNode, first, count);
+                    node.child[slot] = first;
+                    node.count[slot] = static_cast<uint16_t>(count);
+                }
+            }
+
+            template <int Width, typename Nodes, typename LeafRange>
+            inline uint32_t collapseWideNode(const BvhBuildNode& buildNode, Nodes& nodes, LeafRange& leafRange)
+            {
+                const uint32_t index = static_cast<uint32_t>(nodes.size());
+                nodes.emplace_back();
+
+                //Open up the interior child with the largest surface area until all slots are used
+                const BvhBuildNode* slots[Width];
+                int used = 0;
+                slots[used++] = buildNode.children[0].get();
+                slots[used++] = buildNode.children[1].get();
+                while (used < Width)
+                {
+                    int best = -1;
+                    double bestArea = -1.0;
+                    for (int i = 0; i < used; ++i)
+                        if (!slots[i]->isLeaf() && slots[i]->bounds.surfaceArea() > bestArea)
+                        {
+                            best = i;
+                            bestArea = slots[i]->bounds.surfaceArea();
+                        }
+                    if (best < 0)
+                        break;
+                    const BvhBuildNode* opened = slots[best];
+                    slots[best] = opened->children[0].get();
+                    slots[used++] = opened->children[1].get();
+                }
+
+                WideBvhNode<Width> node;
+                for (int i = 0; i < Width; ++i)
+                {
+                    setWideChild<Width>(node, i, i < used ? slots[i] : nullptr, leafRange);
+                    if (i < used && !slots[i]->isLeaf())
+                        node.child[i] = collapseWideNode<Width>(*slots[i], nodes, leafRange);
+                }
+                nodes[index] = node;
+                return index;
+            }
+
+            // Collapses a binary build tree into Width-wide nodes, the root first.
+            template <int Width, typename Nodes, typename LeafRange>
+            inline void collapseWide(const BvhBuildNode& root, Nodes& nodes, LeafRange leafRange)
+            {
+                if (root.isLeaf())
+                {
+                    //Single leaf: one node with one occupied slot
+                    WideBvhNode<Width> node;
+                    for (int i = 0; i < Width; ++i)
+                        setWideChild<Width>(node, i, i == 0 ? &root : nullptr, leafRange);
+                    nodes.push_back(node);
+                }
+                else
+                    collapseWideNode<Width>(root, nodes, leafRange);
+            }
+
+            // Closest-hit traversal, children nearest-first. leaf(first, count, tMax) tests a leaf
+            // range and returns true on a hit, having lowered tMax to its distance.
+            template <int Width, typename Nodes, typename Leaf>
+            inline bool wideClosestHit(const Nodes& nodes, const GRay::Math::Ray& r, double t_min, double t_max, Leaf leaf)
+            {
+                if (nodes.empty())
+                    return false;
+
+                const WideBvhRay ray(r);
+                const float tMinF = roundDownToFloat(t_min);
+                //Box distances are approximate, so the far limit gets the same slack as the slabs
+                auto farLimit = [](double t) { return roundUpToFloat(t) * wideSlabSlack; };
+
+                //Every level pushes at most Width - 1 entries besides the one it continues with
+                WideBvhStackEntry stack[wideBvhMaxDepth * (Width - 1) + 1];
+                int stackSize = 0;
+                stack[stackSize++] = WideBvhStackEntry{ 0, 0, -std::numeric_limits<float>::infinity() };
+
+                bool hitAnything = false;
+                float tMaxF = farLimit(t_max);
+                while (stackSize > 0)
+                {
+                    const WideBvhStackEntry entry = stack[--stackSize];
+                    //Pushed before a closer hit was found
+                    if (entry.tNear > tMaxF)
+                        continue;
+
+                    if (entry.count > 0)
+                    {
+                        if (leaf(entry.index, entry.count, t_max))
+                        {
+                            hitAnything = true;
+                            tMaxF = farLimit(t_max);
+                        }
+                        continue;
+                    }
+
+                    const WideBvhNode<Width>& node = nodes[entry.index];
+                    alignas(32) float tNear[Width];
+                    unsigned mask = wideSlabTest<Width>(node, ray, tMinF, tMaxF, tNear);
+
+                    //Sort the hit children far to near so the nearest ends up on top of the stack
+                    int order[Width];
+                    int hitCount = 0;
+                    for (; mask != 0; mask &= mask - 1)
+                    {
+                        int slot = 0;
+                        while (!((mask >> slot) & 1u))
+                            ++slot;
+                        int k = hitCount++;
+                        while (k > 0 && tNear[order[k - 1]] < tNear[slot])
+                        {
+                            order[k] = order[k - 1];
+                            --k;
+                        }
+                        order[k] = slot;
+                    }
+                    for (int k = 0; k < hitCount; ++k)
+                    {
+                        const int slot = order[k];
+                        stack[stackSize++] = WideBvhStackEntry{ node.child[slot], node.count[slot], tNear[slot] };
+                    }
+                }
+                return hitAnything;
+            }
+
+            // Any-hit traversal: no sorting, no distance culling. leaf(first, count) returns true
+            // when the range blocks the ray.
+            template <int Width, typename Nodes, typename Leaf>
+            inline bool wideAnyHit(const Nodes& nodes, const GRay::Math::Ray& r, double t_min, double t_max, Leaf leaf)
+            {
+                if (nodes.empty())
+                    return false;
+
+                const WideBvhRay ray(r);
+                const float tMinF = roundDownToFloat(t_min);
+                const float tMaxF = roundUpToFloat(t_max) * wideSlabSlack;
+
+                WideBvhStackEntry stack[wideBvhMaxDepth * (Width - 1) + 1];
+                int stackSize = 0;
+                stack[stackSize++] = WideBvhStackEntry{ 0, 0, 0.0f };
+                while (stackSize > 0)
+                {
+                    const WideBvhStackEntry entry = stack[--stackSize];
+                    if (entry.count > 0)
+                    {
+                        if (leaf(entry.index, entry.count))
+                            return true;
+                        continue;
+                    }
+
+                    const WideBvhNode<Width>& node = nodes[entry.index];
+                    alignas(32) float tNear[Width];
+                    for (unsigned mask = wideSlabTest<Width>(node, ray, tMinF, tMaxF, tNear); mask != 0; mask &= mask - 1)
+                    {
+                        int slot = 0;
+                        while (!((mask >> slot) & 1u))
+                            ++slot;
+                        stack[stackSize++] = WideBvhStackEntry{ node.child[slot], node.count[slot], tNear[slot] };
+                    }
+                }
+                return false;
+            }
+        }
+
+        // 4-wide (QBVH) or 8-wide (OBVH) BVH collapsed from the binary build tree that BvhNode
+        // and LinearBvh use: each wide node absorbs the largest-area interior nodes below it
+        // until it has Width children. Children are visited nearest-first.
+        template <int Width>
+        class WideBvh : public GRay::Math::Hittable
+        {
+            static_assert(Width == 4 || Width == 8, "WideBvh supports 4 and 8 children per node");
+
+        public:
+            typedef WideBvhNode<Width> Node;
+            static const int maxDepth = Detail::wideBvhMaxDepth;
+
+            WideBvh() {}
+            WideBvh(const GRay::Math::HittableList& list, double time0, double time1,
+                const BvhBuildOptions& options = BvhBuildOptions(BvhSplitMethod::SAH));
+
+            bool hit(const GRay::Math::Ray& r, double t_min, double t_max, GRay::Math::hitRecord& rec) const override
+            {
+                return intersectAndFinalize(r, t_min, t_max, rec);
+            }
+            bool intersect(const GRay::Math::Ray& r, double t_min, double t_max, GRay::Math::hitRecord& rec) const override
+            {
+                return Detail::wideClosestHit<Width>(nodes, r, t_min, t_max, [&](uint32_t first, uint32_t count, double& tMax)
+                {
+                    bool hitAnything = false;
+                    for (uint32_t i = 0; i < count; ++i)
+                        if (primitives[first + i]->intersect(r, t_min, tMax, rec))
+                        {
+                            hitAnything = true;
+                            tMax = rec.t;
+                        }
+                    return hitAnything;
+                });
+            }
+            bool occluded(const GRay::Math::Ray& r, double t_min, double t_max) const override
+            {
+                return Detail::wideAnyHit<Width>(nodes, r, t_min, t_max, [&](uint32_t first, uint32_t count)
+                {
+                    for (uint32_t i = 0; i < count; ++i)
+                        if (primitives[first + i]->occluded(r, t_min, t_max))
+                            return true;
+                    return false;
+                });
+            }
+            bool boundingBox(double time0, double time1, GRay::Solids::AABB& outputBox) const override
+            {
+                outputBox = bounds;
+                return !nodes.empty();
+            }
+
+            size_t nodeCount() const { return nodes.size(); }
+            size_t memoryUsage() const
+            {
+                return nodes.size() * sizeof(Node) + primitives.size() * sizeof(const GRay::Math::Hittable*);
+            }
+
+        private:
+            std::vector<Node, Utils::AlignedAllocator<Node, 64> > nodes;
+            std::vector<const GRay::Math::Hittable*> primitives; //leaf order
+            std::vector<shared_ptr<GRay::Math::Hittable> > owners; //keeps the primitives alive
+            AABB bounds;
+        };
+
+        template <int Width>
+        inline WideBvh<Width>::WideBvh(const GRay::Math::HittableList& list, double time0, double time1, const BvhBuildOptions& options)
+        {
+            if (list.objects.empty())
+                return;
+            owners = list.objects;
+
+            BvhBuildOptions buildOptions = options;
+            if (buildOptions.maxDepth <= 0 || buildOptions.maxDepth > maxDepth)
+                buildOptions.maxDepth = maxDepth;
+            BvhBuilder builder(buildOptions);
+            std::vector<BvhPrimitive> buildPrimitives = builder.makePrimitives(list.objects, 0, list.objects.size(), time0, time1);
+            std::unique_ptr<BvhBuildNode> root = builder.build(buildPrimitives);
+
+            primitives.resize(buildPrimitives.size());
+            for (size_t i = 0; i < buildPrimitives.size(); ++i)
+                primitives[i] = buildPrimitives[i].object.get();
+            bounds = root->bounds;
+
+            nodes.reserve(builder.nodes() / (Width - 1) + 1);
+            Detail::collapseWide<Width>(*root, nodes, [](const BvhBuildNode& leaf, uint32_t& first, uint32_t& count)
+            {
+                first = static_cast<uint32_t>(leaf.start);
+                count = static_cast<uint32_t>(leaf.count());
+            });
+            builder.finish();
+        }
+
+        typedef WideBvh<4> Bvh4;
+        typedef WideBvh<8> Bvh8;
+    }
+}